@@ -63,3 +63,35 @@ int dill_brecvl(int s, struct dill_iolist *first, struct dill_iolist *last,
     return b->brecvl(b, first, last, deadline);
 }
 
+int dill_bflush(int s, int64_t deadline) {
+    struct dill_bsock_vfs *b = dill_hquery(s, dill_bsock_type);
+    if(dill_slow(!b)) return -1;
+    /* Sockets that don't buffer outbound data have nothing to flush. */
+    if(!b->bflush) return 0;
+    return b->bflush(b, deadline);
+}
+
+ssize_t dill_brecvsome(int s, void *buf, size_t len, int64_t deadline) {
+    struct dill_bsock_vfs *b = dill_hquery(s, dill_bsock_type);
+    if(dill_slow(!b)) return -1;
+    if(dill_slow(!b->brecvsomel)) {errno = ENOTSUP; return -1;}
+    if(dill_slow(!buf && len)) {errno = EINVAL; return -1;}
+    struct dill_iolist iol = {buf, len, NULL, 0};
+    return b->brecvsomel(b, &iol, &iol, deadline);
+}
+
+ssize_t dill_brecvsomel(int s, struct dill_iolist *first,
+      struct dill_iolist *last, int64_t deadline) {
+    struct dill_bsock_vfs *b = dill_hquery(s, dill_bsock_type);
+    if(dill_slow(!b)) return -1;
+    if(dill_slow(!b->brecvsomel)) {errno = ENOTSUP; return -1;}
+    if(dill_slow(!first || !last || last->iol_next)) {
+        errno = EINVAL; return -1;}
+    /* Skipping data doesn't make sense when the amount of data to be
+       received is not known in advance. */
+    struct dill_iolist *it;
+    for(it = first; it; it = it->iol_next)
+        if(dill_slow(!it->iol_base && it->iol_len)) {errno = EINVAL; return -1;}
+    return b->brecvsomel(b, first, last, deadline);
+}
+
@@ -24,6 +24,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#if defined DILL_PERFMAP
+#include <unistd.h>
+#endif
 
 #if defined DILL_VALGRIND
 #include <valgrind/valgrind.h>
@@ -32,6 +35,7 @@
 #include "cr.h"
 #include "pollset.h"
 #include "stack.h"
+#include "trace.h"
 #include "utils.h"
 #include "ctx.h"
 
@@ -48,6 +52,34 @@ struct dill_census_item {
 
 #endif
 
+#if defined DILL_PERFMAP
+
+/* Profilers can't unwind samples taken on a coroutine stack past the go()
+   call, so there's no way to tell which coroutine the sample belongs to.
+   To fix that, the ranges of coroutine stacks are logged, along with the
+   location of the go() call, into /tmp/libdill-<pid>.map. A sample can then
+   be attributed to a coroutine by looking up its stack pointer. Stacks are
+   reused, so the lines are timestamped:
+
+       <ns> go <cr> <stack-start> <stack-size> <file>:<line>
+       <ns> exit <cr>
+
+   Timestamps are taken from CLOCK_MONOTONIC, i.e. the same clock
+   'perf record -k mono' uses. Each thread has its own file handle, but
+   the file is opened in append mode and line-buffered, so that the lines
+   from different threads don't get mixed. */
+
+static FILE *dill_perfmap_open(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/libdill-%d.map", (int)getpid());
+    FILE *f = fopen(path, "a");
+    if(!f) return NULL;
+    setvbuf(f, NULL, _IOLBF, 0);
+    return f;
+}
+
+#endif
+
 /* Storage for the constant used by the go() macro. */
 volatile void *dill_unoptimisable = NULL;
 
@@ -157,6 +189,29 @@ static void dill_resume(struct dill_cr *cr, int id, int err) {
     cr->id = id;
     cr->err = err;
     dill_qlist_push(&ctx->ready, &cr->ready);
+    ctx->ready_count++;
+    /* If the coroutine is being resumed because of an external event or
+       a timer, remember when the event was detected. */
+    if(dill_slow(ctx->polling)) {
+        if(!ctx->poll_time) ctx->poll_time = dill_nsnow();
+        cr->ready_time = ctx->poll_time;
+    }
+}
+
+/* Bucket 0 holds values below 1us, bucket i values in range
+   [2^(i+9), 2^(i+10)) nanoseconds. The last bucket holds everything above. */
+static void dill_histogram_add(struct dill_histogram *h, int64_t val) {
+    if(val < 0) val = 0;
+    int bucket = 0;
+    if(val >= 1024) {
+        bucket = 63 - __builtin_clzll((unsigned long long)val) - 9;
+        if(bucket >= DILL_HISTOGRAM_BUCKETS)
+            bucket = DILL_HISTOGRAM_BUCKETS - 1;
+    }
+    h->count++;
+    h->sum += val;
+    if((uint64_t)val > h->max) h->max = val;
+    h->buckets[bucket]++;
 }
 
 int dill_canblock(void) {
@@ -193,6 +248,24 @@ int dill_ctx_cr_init(struct dill_ctx_cr *ctx) {
 #if defined DILL_CENSUS
     dill_slist_init(&ctx->census);
 #endif
+#if defined DILL_PERFMAP
+    ctx->perfmap = dill_perfmap_open();
+#endif
+    ctx->coroutines = 0;
+    ctx->spawns = 0;
+    ctx->switches = 0;
+    ctx->ready_count = 0;
+    ctx->timers_count = 0;
+    ctx->timeouts = 0;
+    ctx->busypolls = 0;
+    ctx->busypoll = 0;
+    ctx->busypoll_sockets = 0;
+    ctx->latency = 0;
+    ctx->polling = 0;
+    ctx->poll_time = 0;
+    ctx->poll_end = 0;
+    memset(&ctx->wakeup, 0, sizeof(ctx->wakeup));
+    memset(&ctx->loop, 0, sizeof(ctx->loop));
     return 0;
 }
 
@@ -207,6 +280,9 @@ void dill_ctx_cr_term(struct dill_ctx_cr *ctx) {
             ci->file, ci->line, ci->max_stack);
     }
 #endif
+#if defined DILL_PERFMAP
+    if(ctx->perfmap) fclose(ctx->perfmap);
+#endif
 }
 
 /******************************************************************************/
@@ -217,6 +293,7 @@ static void dill_timer_cancel(struct dill_clause *cl) {
     struct dill_ctx_cr *ctx = &dill_getctx->cr;
     struct dill_tmclause *tmcl = dill_cont(cl, struct dill_tmclause, cl);
     dill_rbtree_erase(&ctx->timers, &tmcl->item);
+    ctx->timers_count--;
     /* This is a safeguard. If an item isn't properly removed from the rb-tree,
        we can spot the fact by seeing that the cr has been set to NULL. */
     tmcl->cl.cr = NULL;
@@ -228,6 +305,7 @@ void dill_timer(struct dill_tmclause *tmcl, int id, int64_t deadline) {
     /* If the deadline is infinite, there's nothing to wait for. */
     if(deadline < 0) return;
     dill_rbtree_insert(&ctx->timers, deadline, &tmcl->item);
+    ctx->timers_count++;
     dill_waitfor(&tmcl->cl, id, dill_timer_cancel);
 }
 
@@ -293,6 +371,7 @@ int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len, int bndl,
     cr->ready.next = NULL;
     dill_slist_init(&cr->clauses);
     cr->closer = NULL;
+    cr->ready_time = 0;
     cr->no_blocking1 = 0;
     cr->no_blocking2 = 0;
     cr->done = 0;
@@ -320,6 +399,13 @@ int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len, int bndl,
         cr->census->max_stack = 0;
     }
     cr->stacksz = stacksz - sizeof(struct dill_cr);
+#endif
+#if defined DILL_PERFMAP
+    if(ctx->perfmap)
+        fprintf(ctx->perfmap, "%lld go %p %p %zu %s:%d\n",
+            (long long)dill_nsnow(), (void*)cr,
+            (void*)((char*)(cr + 1) - stacksz),
+            stacksz - sizeof(struct dill_cr), file, line);
 #endif
     /* Return the context of the parent coroutine to the caller so that it can
        store its current state. It can't be done here because we are at the
@@ -329,6 +415,10 @@ int dill_prologue(sigjmp_buf **jb, void **ptr, size_t len, int bndl,
     dill_resume(ctx->r, 0, 0);
     /* Mark the new coroutine as running. */
     *ptr = ctx->r = cr;
+    ctx->coroutines++;
+    ctx->spawns++;
+    ctx->switches++;
+    DILL_TRACE3(cr_start, cr, file, line);
     /* In case of success go() returns the handle, bundle_go() returns 0. */
     return new_bundle ? bndl : 0;
 error2:
@@ -346,6 +436,12 @@ void dill_epilogue(void) {
     struct dill_ctx_cr *ctx = &dill_getctx->cr;
     /* Mark the coroutine as finished. */
     ctx->r->done = 1;
+    DILL_TRACE1(cr_end, ctx->r);
+#if defined DILL_PERFMAP
+    if(ctx->perfmap)
+        fprintf(ctx->perfmap, "%lld exit %p\n", (long long)dill_nsnow(),
+            (void*)ctx->r);
+#endif
     /* If there's a coroutine waiting for us to finish, unblock it now. */
     if(ctx->r->closer)
         dill_cancel(ctx->r->closer, 0);
@@ -419,6 +515,7 @@ static void dill_cr_close(struct dill_hvfs *vfs) {
     VALGRIND_STACK_DEREGISTER(cr->sid);
 #endif
     /* Now that the coroutine is finished, deallocate it. */
+    ctx->coroutines--;
     if(!cr->mem) dill_freestack(cr + 1);
 }
 
@@ -436,6 +533,36 @@ void dill_waitfor(struct dill_clause *cl, int id,
     cl->cancel = cancel;
 }
 
+int dill_busypoll(int us, int flags) {
+    if(dill_slow(us < 0 || (flags & ~DILL_BUSYPOLL_SOCKETS))) {
+        errno = EINVAL; return -1;}
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    ctx->busypoll = us;
+    ctx->busypoll_sockets = us && (flags & DILL_BUSYPOLL_SOCKETS) ? 1 : 0;
+    return 0;
+}
+
+/* Checks for external events without blocking till one arrives or till
+   the busy-poll window elapses. The window is capped by 'timeout' which is
+   then reduced by the time spent spinning. Returns 1 if an event was
+   found. */
+static int dill_busyspin(struct dill_ctx_cr *ctx, int *timeout) {
+    int64_t window = (int64_t)ctx->busypoll * 1000;
+    if(*timeout >= 0 && window > (int64_t)*timeout * 1000000)
+        window = (int64_t)*timeout * 1000000;
+    int64_t start = dill_nsnow();
+    int64_t nw = start;
+    while(nw - start < window) {
+        if(dill_pollset_poll(0) > 0) {ctx->busypolls++; return 1;}
+        nw = dill_nsnow();
+    }
+    if(*timeout > 0) {
+        *timeout -= (int)((nw - start) / 1000000);
+        if(*timeout < 0) *timeout = 0;
+    }
+    return 0;
+}
+
 int dill_wait(void)  {
     struct dill_ctx_cr *ctx = &dill_getctx->cr;
     /* Store the context of the current coroutine, if any. */
@@ -456,6 +583,9 @@ int dill_wait(void)  {
        intensive operation. */
     if(dill_qlist_empty(&ctx->ready) || nw > ctx->last_poll + 1000) {
         int block = dill_qlist_empty(&ctx->ready);
+        /* Time spent running coroutines since the last poll. */
+        if(dill_slow(ctx->latency && ctx->poll_end))
+            dill_histogram_add(&ctx->loop, dill_nsnow() - ctx->poll_end);
         while(1) {
             /* Compute the timeout for the subsequent poll. */
             int timeout = 0;
@@ -470,7 +600,17 @@ int dill_wait(void)  {
                 }
             }
             /* Wait for events. */
-            int fired = dill_pollset_poll(timeout);
+            ctx->polling = ctx->latency;
+            ctx->poll_time = 0;
+            int fired = 0;
+            int wait = timeout;
+            if(dill_slow(ctx->busypoll && timeout != 0))
+                fired = dill_busyspin(ctx, &wait);
+            if(!fired) {
+                DILL_TRACE1(poll_begin, wait);
+                fired = dill_pollset_poll(wait);
+                DILL_TRACE1(poll_end, fired);
+            }
             if(timeout != 0) nw = dill_now();
             if(dill_slow(fired < 0)) continue;
             /* Fire all expired timers. */
@@ -481,7 +621,9 @@ int dill_wait(void)  {
                         struct dill_tmclause, item);
                     if(tmcl->item.val > nw)
                         break;
+                    DILL_TRACE2(timer_fire, tmcl->cl.cr, tmcl->item.val);
                     dill_trigger(&tmcl->cl, ETIMEDOUT);
+                    ctx->timeouts++;
                     fired = 1;
                 }
             }
@@ -492,12 +634,25 @@ int dill_wait(void)  {
                do the poll again. It can happen if the timers were canceled
                in the meantime. */
         }
+        ctx->polling = 0;
+        if(dill_slow(ctx->latency)) ctx->poll_end = dill_nsnow();
         ctx->last_poll = nw;
     }
     /* There's a coroutine ready to be executed so jump to it. */
     struct dill_slist *it = dill_qlist_pop(&ctx->ready);
     it->next = NULL;
-    ctx->r = dill_cont(it, struct dill_cr, ready);
+    ctx->ready_count--;
+    /* Resuming the coroutine that was just suspended is not a switch. */
+    struct dill_cr *r = dill_cont(it, struct dill_cr, ready);
+    if(r != ctx->r) {
+        ctx->switches++;
+        DILL_TRACE2(cr_switch, ctx->r, r);
+    }
+    if(dill_slow(r->ready_time)) {
+        dill_histogram_add(&ctx->wakeup, dill_nsnow() - r->ready_time);
+        r->ready_time = 0;
+    }
+    ctx->r = r;
     /* dill_longjmp has to be at the end of a function body, otherwise stack
        unwinding information will be trimmed if a crash occurs in this
        function. */
@@ -520,6 +675,7 @@ static void dill_docancel(struct dill_cr *cr, int id, int err) {
 }
 
 void dill_trigger(struct dill_clause *cl, int err) {
+    DILL_TRACE3(cr_trigger, cl->cr, cl->id, err);
     dill_docancel(cl->cr, cl->id, err);
 }
 
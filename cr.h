@@ -24,6 +24,7 @@
 #define DILL_CR_INCLUDED
 
 #include <stdint.h>
+#include <stdio.h>
 
 #include "list.h"
 #include "qlist.h"
@@ -71,6 +72,10 @@ struct dill_cr {
     /* When the coroutine handle is being closed, this points to the
        coroutine that is doing the hclose() call. */
     struct dill_cr *closer;
+    /* If latency tracking is on and the coroutine was made ready by an
+       external event or a timer, this is the time (in nanoseconds) when
+       the event was detected. Zero otherwise. */
+    int64_t ready_time;
 #if defined DILL_VALGRIND
     /* Valgrind stack identifier. This way, valgrind knows which areas of
        memory are used as stacks, and so it doesn't produce spurious warnings.
@@ -104,6 +109,33 @@ struct dill_ctx_cr {
 #if defined DILL_CENSUS
     struct dill_slist census;
 #endif
+#if defined DILL_PERFMAP
+    /* Side file describing coroutine stacks. NULL if it can't be opened. */
+    FILE *perfmap;
+#endif
+    /* Statistics. See struct dill_stats for the meaning of the counters. */
+    uint64_t coroutines;
+    uint64_t spawns;
+    uint64_t switches;
+    uint64_t ready_count;
+    uint64_t timers_count;
+    uint64_t timeouts;
+    uint64_t busypolls;
+    /* Busy-poll window in microseconds. 0 if busy polling is off. */
+    int busypoll;
+    /* Set SO_BUSY_POLL on sockets created in busy-poll mode. */
+    int busypoll_sockets;
+    /* Latency tracking. See dill_latency(). */
+    int latency;
+    /* Set while external events and timers are being processed. */
+    int polling;
+    /* Time when the current batch of events was detected. Computed lazily,
+       zero if not known yet. */
+    int64_t poll_time;
+    /* Time when the last poll has finished. */
+    int64_t poll_end;
+    struct dill_histogram wakeup;
+    struct dill_histogram loop;
 };
 
 struct dill_clause {
@@ -162,6 +194,10 @@ int dill_canblock(void);
    Returns the old value of the flag */
 int dill_no_blocking(int val);
 
+/* Waits for an error condition on the fd, e.g. for a message in the socket's
+   error queue. */
+int dill_fderr(int fd, int64_t deadline);
+
 /* Cleans cached info about the fd. */
 int dill_clean(int fd);
 
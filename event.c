@@ -0,0 +1,162 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#if defined __linux__
+#include <sys/eventfd.h>
+#endif
+
+#define DILL_DISABLE_RAW_NAMES
+#include "libdillimpl.h"
+#include "utils.h"
+
+/* Event is owned by a single thread, however, it can be signaled from any
+   thread. The 'pending' flag makes sure that multiple signals are coalesced
+   into a single write to the file descriptor. On Linux eventfd is used.
+   Elsewhere, it's a pipe. */
+
+dill_unique_id(dill_event_type);
+
+static void *dill_event_hquery(struct dill_hvfs *hvfs, const void *type);
+static void dill_event_hclose(struct dill_hvfs *hvfs);
+
+struct dill_event {
+    struct dill_hvfs hvfs;
+    /* If eventfd is used both file descriptors are the same. */
+    int rfd;
+    int wfd;
+    /* Set to 1 when the event is signaled, but not yet consumed. Accessed
+       atomically. */
+    int pending;
+};
+
+DILL_CHECK_STORAGE(dill_event, dill_event_storage)
+
+int dill_event_open_mem(struct dill_event_storage *mem) {
+    int err;
+    if(dill_slow(!mem)) {err = EINVAL; goto error1;}
+    struct dill_event *self = (struct dill_event*)mem;
+    self->hvfs.query = dill_event_hquery;
+    self->hvfs.close = dill_event_hclose;
+#if defined __linux__
+    self->rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(dill_slow(self->rfd < 0)) {err = errno; goto error1;}
+    self->wfd = self->rfd;
+#else
+    int p[2];
+    int rc = pipe(p);
+    if(dill_slow(rc < 0)) {err = errno; goto error1;}
+    self->rfd = p[0];
+    self->wfd = p[1];
+    int i;
+    for(i = 0; i != 2; ++i) {
+        int opt = fcntl(p[i], F_GETFL, 0);
+        if(dill_slow(opt < 0)) {err = errno; goto error2;}
+        rc = fcntl(p[i], F_SETFL, opt | O_NONBLOCK);
+        if(dill_slow(rc < 0)) {err = errno; goto error2;}
+        opt = fcntl(p[i], F_GETFD);
+        if(dill_slow(opt < 0)) {err = errno; goto error2;}
+        rc = fcntl(p[i], F_SETFD, opt | FD_CLOEXEC);
+        if(dill_slow(rc < 0)) {err = errno; goto error2;}
+    }
+#endif
+    __atomic_store_n(&self->pending, 0, __ATOMIC_RELEASE);
+    int h = dill_hmake(&self->hvfs);
+    if(dill_slow(h < 0)) {err = errno; goto error2;}
+    return h;
+error2:
+    close(self->rfd);
+    if(self->wfd != self->rfd) close(self->wfd);
+error1:
+    errno = err;
+    return -1;
+}
+
+static void *dill_event_hquery(struct dill_hvfs *hvfs, const void *type) {
+    struct dill_event *self = (struct dill_event*)hvfs;
+    if(type == dill_event_type) return self;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+/* This function may be called from any thread. It's also async-signal-safe,
+   so it can be used from within signal handlers. */
+int dill_event_signal(struct dill_event_storage *mem) {
+    if(dill_slow(!mem)) {errno = EINVAL; return -1;}
+    struct dill_event *self = (struct dill_event*)mem;
+    /* If the event is already signaled there's nothing to do. */
+    if(__atomic_exchange_n(&self->pending, 1, __ATOMIC_ACQ_REL)) return 0;
+#if defined __linux__
+    uint64_t val = 1;
+#else
+    uint8_t val = 1;
+#endif
+    while(1) {
+        ssize_t sz = write(self->wfd, &val, sizeof(val));
+        if(dill_fast(sz == sizeof(val))) return 0;
+        dill_assert(sz < 0);
+        if(errno == EINTR) continue;
+        /* The pipe is full, meaning that the owner will wake up anyway. */
+        if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        return -1;
+    }
+}
+
+/* Reads all pending wakeups from the file descriptor. */
+static void dill_event_drain(struct dill_event *self) {
+    uint64_t buf[8];
+    while(1) {
+        ssize_t sz = read(self->rfd, buf, sizeof(buf));
+        if(sz > 0) continue;
+        if(sz < 0 && errno == EINTR) continue;
+        break;
+    }
+}
+
+int dill_event_wait(int h, int64_t deadline) {
+    struct dill_event *self = dill_hquery(h, dill_event_type);
+    if(dill_slow(!self)) return -1;
+    while(1) {
+        if(__atomic_exchange_n(&self->pending, 0, __ATOMIC_ACQ_REL)) return 0;
+        int rc = dill_fdin(self->rfd, deadline);
+        if(dill_slow(rc < 0)) return -1;
+        /* The write to the file descriptor may not correspond to the current
+           value of the flag. It may be a leftover from a signal that was
+           already consumed. Either way, get rid of it so that we don't
+           get woken up again. */
+        dill_event_drain(self);
+    }
+}
+
+static void dill_event_hclose(struct dill_hvfs *hvfs) {
+    struct dill_event *self = (struct dill_event*)hvfs;
+    int rc = dill_fdclean(self->rfd);
+    dill_assert(rc == 0);
+    close(self->rfd);
+    if(self->wfd != self->rfd) close(self->wfd);
+}
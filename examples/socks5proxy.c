@@ -42,17 +42,6 @@ int auth_fn(const char *user, const char* pass) {
     return 1;
 }
 
-// forwards input to output. signal and return on error (connection closed)
-coroutine void forward(int in_s, int out_s, int ch) {
-    while (1) {
-        uint8_t d[1];
-        if(brecv(in_s, d, 1, -1)) break;
-        if(bsend(out_s, d, 1, -1)) break;
-    }
-    chdone(ch);
-    return;
-}
-
 coroutine void do_proxy(int s) {
     if((!auth_user) || (!auth_pass)){
         if(socks5_proxy_auth(s, NULL, -1)) goto in_close;
@@ -74,37 +63,9 @@ coroutine void do_proxy(int s) {
 
     if(socks5_proxy_sendreply(s, SOCKS5_SUCCESS, &addr, -1)) goto both_close;
 
-    // channels for outboud, inbound to signal done (to close connection)
-    int och[2], ich[2];
-    if(chmake(och)) goto both_close;
-    if(chmake(ich)) goto both_close;
-
-    // start coroutines to handle inbound and outbound forwarding
-    int ob = go(forward(s, s_rem, och[1]));
-    if(ob < 0) goto both_close;
-    int ib = go(forward(s_rem, s, ich[1]));
-    if(ib < 0) goto both_close;
-
-    // wait for message in channel - one side closed, tcp_done the other
-    struct chclause cc[] = {{CHRECV, och[0], &cmd, 1},
-                            {CHRECV, ich[0], &cmd, 1}};
-    switch(choose(cc, 2, -1)) {
-        case 0:
-            if(bundle_wait(ob, -1)) break;
-            tcp_done(s_rem, -1);
-            bundle_wait(ib, -1);
-            break;
-        case 1:
-            if(bundle_wait(ib, -1)) break;
-            tcp_done(s, -1);
-            bundle_wait(ob, -1);
-            break;
-        case -1:
-            break;
-        default:
-            // unexpected answer
-            assert(0);
-    }
+    // relay the data in both directions until both sides are done
+    brelay(s, s_rem, NULL, -1);
+
 both_close:
     tcp_close(s_rem, -1);
 in_close:
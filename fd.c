@@ -22,18 +22,38 @@
 
 */
 
+#if defined __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#if defined __linux__
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "cr.h"
 #include "ctx.h"
 #include "fd.h"
 #include "iol.h"
+#include "trace.h"
 #include "utils.h"
 
+dill_unique_id(dill_fd_stream_type);
+
 #define DILL_FD_CACHESIZE 32
-#define DILL_FD_BUFSIZE 1984
+#define DILL_FD_BUFSIZE(cls) ((size_t)(2048 << (cls)) - 64)
+#define DILL_FD_BUFMAX DILL_FD_BUFSIZE(DILL_FD_RXBUFCLASSES - 1)
+/* Number of consecutive signals needed to resize a receive buffer. */
+#define DILL_FD_RESIZE 4
+#define DILL_FD_IOVCACHESIZE 8
 
 #if defined MSG_NOSIGNAL
 #define FD_NOSIGNAL MSG_NOSIGNAL
@@ -41,51 +61,214 @@
 #define FD_NOSIGNAL 0
 #endif
 
+#if defined MSG_ZEROCOPY && defined SO_ZEROCOPY && \
+    defined SO_EE_ORIGIN_ZEROCOPY
+#define DILL_FD_ZEROCOPY
+#endif
+
 int dill_ctx_fd_init(struct dill_ctx_fd *ctx) {
     ctx->count = 0;
-    dill_slist_init(&ctx->cache);
+    int i;
+    for(i = 0; i != DILL_FD_RXBUFCLASSES; ++i) {
+        ctx->counts[i] = 0;
+        dill_slist_init(&ctx->caches[i]);
+    }
+    ctx->iovcount = 0;
+    dill_slist_init(&ctx->iovcache);
+    ctx->hits = 0;
+    ctx->misses = 0;
     return 0;
 }
 
 void dill_ctx_fd_term(struct dill_ctx_fd *ctx) {
+    int i;
+    for(i = 0; i != DILL_FD_RXBUFCLASSES; ++i) {
+        while(1) {
+            struct dill_slist *it = dill_slist_pop(&ctx->caches[i]);
+            if(it == &ctx->caches[i]) break;
+            free(it);
+        }
+    }
     while(1) {
-        struct dill_slist *it = dill_slist_pop(&ctx->cache);
-        if(it == &ctx->cache) break;
+        struct dill_slist *it = dill_slist_pop(&ctx->iovcache);
+        if(it == &ctx->iovcache) break;
         free(it);
     }
 }
 
-static uint8_t *dill_fd_allocbuf(void) {
+static uint8_t *dill_fd_allocbuf(int cls) {
     struct dill_ctx_fd *ctx = &dill_getctx->fd;
-    struct dill_slist *it = dill_slist_pop(&ctx->cache);
-    if(dill_fast(it != &ctx->cache)) {
+    struct dill_slist *it = dill_slist_pop(&ctx->caches[cls]);
+    if(dill_fast(it != &ctx->caches[cls])) {
+        ctx->counts[cls]--;
         ctx->count--;
+        ctx->hits++;
         return (uint8_t*)it;
     }
-    uint8_t *p = malloc(DILL_FD_BUFSIZE);
+    ctx->misses++;
+    uint8_t *p = malloc(DILL_FD_BUFSIZE(cls));
     if(dill_slow(!p)) {errno = ENOMEM; return NULL;}
     return p;
 }
 
-static void dill_fd_freebuf(uint8_t *buf) {
+static void dill_fd_freebuf(uint8_t *buf, int cls) {
     struct dill_ctx_fd *ctx = &dill_getctx->fd;
-    if(ctx->count >= DILL_FD_CACHESIZE) {
+    /* Cache fewer buffers of the larger classes to keep the memory
+       footprint of the cache roughly the same for every class. */
+    int limit = DILL_FD_CACHESIZE >> cls;
+    if(limit < 2) limit = 2;
+    if(ctx->counts[cls] >= limit) {
         free(buf);
         return;
     }
-    dill_slist_push(&ctx->cache, (struct dill_slist*)buf);
+    dill_slist_push(&ctx->caches[cls], (struct dill_slist*)buf);
+    ctx->counts[cls]++;
     ctx->count++;
 }
 
+/* Long iolists used to be converted into variable-length arrays on the C
+   stack, which could overflow small coroutine stacks. Now they are converted
+   into arrays taken from a per-thread cache. An array is held only for
+   the duration of a single send or receive, so there's no need to keep one
+   per socket. */
+struct iovec *dill_fd_allociov(void) {
+    struct dill_ctx_fd *ctx = &dill_getctx->fd;
+    struct dill_slist *it = dill_slist_pop(&ctx->iovcache);
+    if(dill_fast(it != &ctx->iovcache)) {
+        ctx->iovcount--;
+        return (struct iovec*)it;
+    }
+    struct iovec *iov = malloc(DILL_FD_IOVMAX * sizeof(struct iovec));
+    if(dill_slow(!iov)) {errno = ENOMEM; return NULL;}
+    return iov;
+}
+
+void dill_fd_freeiov(struct iovec *iov) {
+    struct dill_ctx_fd *ctx = &dill_getctx->fd;
+    if(ctx->iovcount >= DILL_FD_IOVCACHESIZE) {
+        int err = errno;
+        free(iov);
+        errno = err;
+        return;
+    }
+    dill_slist_push(&ctx->iovcache, (struct dill_slist*)iov);
+    ctx->iovcount++;
+}
+
+/* Copying data through user space used to be done via a 16kB array on
+   the C stack, which could overflow small coroutine stacks. */
+uint8_t *dill_fd_alloccopybuf(void) {
+    return dill_fd_allocbuf(DILL_FD_COPYBUFCLS);
+}
+
+void dill_fd_freecopybuf(uint8_t *buf) {
+    int err = errno;
+    dill_fd_freebuf(buf, DILL_FD_COPYBUFCLS);
+    errno = err;
+}
+
 void dill_fd_initrxbuf(struct dill_fd_rxbuf *rxbuf) {
     dill_assert(rxbuf);
     rxbuf->len = 0;
     rxbuf->pos = 0;
     rxbuf->buf = NULL;
+    rxbuf->bufcls = 0;
+    rxbuf->cls = 0;
+    rxbuf->grow = 0;
+    rxbuf->shrink = 0;
 }
 
 void dill_fd_termrxbuf(struct dill_fd_rxbuf *rxbuf) {
-    if(rxbuf->buf) dill_fd_freebuf(rxbuf->buf);
+    if(rxbuf->buf) dill_fd_freebuf(rxbuf->buf, rxbuf->bufcls);
+}
+
+int dill_fd_rxready(struct dill_fd_rxbuf *rxbuf, struct dill_iolist *first) {
+    if(!first) return 0;
+    size_t rmn = rxbuf->len - rxbuf->pos;
+    while(first) {
+        if(first->iol_len > rmn) return 0;
+        rmn -= first->iol_len;
+        first = first->iol_next;
+    }
+    return 1;
+}
+
+int dill_fd_settxbuf(struct dill_fd_txbuf **txbuf, size_t size) {
+    if(dill_slow(*txbuf && (*txbuf)->len)) {errno = EBUSY; return -1;}
+    struct dill_fd_txbuf *tb = NULL;
+    if(size) {
+        tb = malloc(sizeof(struct dill_fd_txbuf) + size);
+        if(dill_slow(!tb)) {errno = ENOMEM; return -1;}
+        tb->len = 0;
+        tb->cap = size;
+    }
+    free(*txbuf);
+    *txbuf = tb;
+    return 0;
+}
+
+void dill_fd_termtxbuf(struct dill_fd_txbuf *txbuf) {
+    free(txbuf);
+}
+
+/* Called when the buffer was too small to be used for a read or when it was
+   filled up by a single recv(). Either way, larger buffer would save some
+   syscalls. */
+static void dill_fd_rxgrow(struct dill_fd_rxbuf *rxbuf) {
+    rxbuf->shrink = 0;
+    if(rxbuf->cls == DILL_FD_RXBUFCLASSES - 1) return;
+    if(++rxbuf->grow < DILL_FD_RESIZE) return;
+    rxbuf->cls++;
+    rxbuf->grow = 0;
+}
+
+/* Called when a recv() filled only a small part of the buffer. */
+static void dill_fd_rxshrink(struct dill_fd_rxbuf *rxbuf) {
+    rxbuf->grow = 0;
+    if(rxbuf->cls == 0) return;
+    if(++rxbuf->shrink < DILL_FD_RESIZE) return;
+    rxbuf->cls--;
+    rxbuf->shrink = 0;
+}
+
+void dill_fd_blocksigpipe(struct dill_fd_sigpipe *sp) {
+    sigset_t pipeset, pending;
+    sigemptyset(&pipeset);
+    sigaddset(&pipeset, SIGPIPE);
+    sigpending(&pending);
+    sp->pending = sigismember(&pending, SIGPIPE);
+    int rc = pthread_sigmask(SIG_BLOCK, &pipeset, &sp->oldset);
+    dill_assert(rc == 0);
+}
+
+void dill_fd_unblocksigpipe(struct dill_fd_sigpipe *sp) {
+    int err = errno;
+    if(!sp->pending) {
+        sigset_t pipeset, pending;
+        sigemptyset(&pipeset);
+        sigaddset(&pipeset, SIGPIPE);
+        sigpending(&pending);
+        /* The signal is pending so sigwait() returns straight away. */
+        int sig;
+        if(sigismember(&pending, SIGPIPE)) sigwait(&pipeset, &sig);
+    }
+    int rc = pthread_sigmask(SIG_SETMASK, &sp->oldset, NULL);
+    dill_assert(rc == 0);
+    errno = err;
+}
+
+/* In busy-poll mode, let the kernel busy-poll the device queue while
+   the socket has no data. Going above net.core.busy_read requires
+   CAP_NET_ADMIN, so the option is set on a best-effort basis. */
+static void dill_fd_busypoll(int s) {
+#if defined SO_BUSY_POLL
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    if(dill_fast(!ctx->busypoll_sockets)) return;
+    int err = errno;
+    int us = ctx->busypoll;
+    setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us));
+    errno = err;
+#endif
 }
 
 int dill_fd_unblock(int s) {
@@ -106,6 +289,7 @@ int dill_fd_unblock(int s) {
     rc = setsockopt (s, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof (opt));
     dill_assert (rc == 0 || errno == EINVAL);
 #endif
+    dill_fd_busypoll(s);
     return 0;
 }
 
@@ -127,37 +311,85 @@ int dill_fd_connect(int s, const struct sockaddr *addr, socklen_t addrlen,
     return 0;
 }
 
+int dill_fd_connectl(int s, const struct sockaddr *addr, socklen_t addrlen,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    if(!first && !last) return dill_fd_connect(s, addr, addrlen, deadline);
+    int rc;
+#if defined MSG_FASTOPEN
+    rc = dill_iolcheck(first, last, NULL, NULL);
+    if(dill_slow(rc < 0)) return -1;
+    /* SYN packet can carry at most a single segment worth of data, so
+       a short iovec array is enough. */
+    struct iovec iov[DILL_FD_IOVSTACK];
+    struct dill_iolist *it = first;
+    size_t niov = dill_ioltoiovn(&it, iov, DILL_FD_IOVSTACK);
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = (void*)addr;
+    hdr.msg_namelen = addrlen;
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = niov;
+    ssize_t sz = sendmsg(s, &hdr, MSG_FASTOPEN | FD_NOSIGNAL);
+    if(sz >= 0 || errno == EINPROGRESS) {
+        /* If there's no cookie for the server yet, the SYN carries no data.
+           Whatever is left is sent once the connection is established. */
+        struct dill_iolist trimmed;
+        rc = dill_ioltrim(first, sz < 0 ? 0 : sz, &trimmed);
+        dill_assert(rc == 0);
+        return dill_fd_send(s, &trimmed, trimmed.iol_next ? last : &trimmed,
+            deadline);
+    }
+    /* Fast open is switched off on this system. */
+    if(dill_slow(errno != EOPNOTSUPP)) return -1;
+#endif
+    rc = dill_fd_connect(s, addr, addrlen, deadline);
+    if(dill_slow(rc < 0)) return -1;
+    return dill_fd_send(s, first, last, deadline);
+}
+
+int dill_fd_tryaccept(int s, struct sockaddr *addr, socklen_t *addrlen) {
+    while(1) {
+#if defined __linux__
+        /* Accepted socket is set up in the same system call. The remaining
+           options set by dill_fd_unblock() are irrelevant on Linux. */
+        int as = accept4(s, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(dill_fast(as >= 0)) {
+            dill_fd_busypoll(as);
+            return as;
+        }
+#else
+        int as = accept(s, addr, addrlen);
+        if(dill_fast(as >= 0)) {
+            int rc = dill_fd_unblock(as);
+            dill_assert(rc == 0);
+            return as;
+        }
+#endif
+        /* If connection was aborted by the peer grab the next one. */
+        if(dill_slow(errno == ECONNABORTED)) continue;
+        if(errno == EWOULDBLOCK) errno = EAGAIN;
+        return -1;
+    }
+}
+
 int dill_fd_accept(int s, struct sockaddr *addr, socklen_t *addrlen,
       int64_t deadline) {
-    int as;
     while(1) {
         /* Try to accept new connection synchronously. */
-        as = accept(s, addr, addrlen);
-        if(dill_fast(as >= 0))
-            break;
-        /* If connection was aborted by the peer grab the next one. */
-        if(dill_slow(errno == ECONNABORTED)) continue;
+        int as = dill_fd_tryaccept(s, addr, addrlen);
+        if(dill_fast(as >= 0)) return as;
         /* Propagate other errors to the caller. */
-        if(dill_slow(errno != EAGAIN && errno != EWOULDBLOCK)) return -1;
+        if(dill_slow(errno != EAGAIN)) return -1;
         /* Operation is in progress. Wait till new connection is available. */
         int rc = dill_fdin(s, deadline);
         if(dill_slow(rc < 0)) return -1;
     }
-    int rc = dill_fd_unblock(as);
-    dill_assert(rc == 0);
-    return as;
 }
 
-int dill_fd_send(int s, struct dill_iolist *first, struct dill_iolist *last,
-      int64_t deadline) {
-    /* Make a local iovec array. */
-    /* TODO: This is dangerous, it may cause stack overflow.
-       There should probably be a on-heap per-socket buffer for that. */
-    size_t niov;
-    int rc = dill_iolcheck(first, last, &niov, NULL);
-    if(dill_slow(rc < 0)) return -1;
-    struct iovec iov[niov];
-    dill_ioltoiov(first, iov);
+/* Sends the whole iovec array. If 'nsends' is not NULL, it is incremented
+   by the number of sendmsg() calls that managed to send some data. */
+static int dill_fd_sendiov(int s, struct iovec *iov, size_t niov, int flags,
+      uint32_t *nsends, int64_t deadline) {
     /* Message header will act as an iterator in the following loop. */
     struct msghdr hdr;
     memset(&hdr, 0, sizeof(hdr));
@@ -172,7 +404,8 @@ int dill_fd_send(int s, struct dill_iolist *first, struct dill_iolist *last,
             hdr.msg_iovlen--;
         }
         if(!hdr.msg_iovlen) return 0;
-        ssize_t sz = sendmsg(s, &hdr, FD_NOSIGNAL);
+        ssize_t sz = sendmsg(s, &hdr, FD_NOSIGNAL | flags);
+        DILL_TRACE2(fd_send, s, sz);
         dill_assert(sz != 0);
         if(sz < 0) {
             if(dill_slow(errno != EWOULDBLOCK && errno != EAGAIN)) {
@@ -181,19 +414,21 @@ int dill_fd_send(int s, struct dill_iolist *first, struct dill_iolist *last,
             }
             sz = 0;
         }
+        else if(nsends) {
+            ++*nsends;
+        }
         /* Adjust the iovec array so that it doesn't contain data
-           that was already sent. */
-        while(sz) {
-            struct iovec *head = &hdr.msg_iov[0];
-            if(head->iov_len > sz) {
-                head->iov_base += sz;
-                head->iov_len -= sz;
-                break;
-            }
-            sz -= head->iov_len;
+           that was already sent. Empty buffers at the end must not make
+           us wait for the socket to become writable. */
+        while(hdr.msg_iovlen && hdr.msg_iov[0].iov_len <= sz) {
+            sz -= hdr.msg_iov[0].iov_len;
             hdr.msg_iov++;
             hdr.msg_iovlen--;
-            if(!hdr.msg_iovlen) return 0;
+        }
+        if(!hdr.msg_iovlen) return 0;
+        if(sz) {
+            hdr.msg_iov[0].iov_base += sz;
+            hdr.msg_iov[0].iov_len -= sz;
         }
         /* Wait till more data can be sent. */
         int rc = dill_fdout(s, deadline);
@@ -201,17 +436,161 @@ int dill_fd_send(int s, struct dill_iolist *first, struct dill_iolist *last,
     }
 }
 
-/* Same as dill_fd_recv() but with no rx buffering. */
-static int dill_fd_recv_(int s, struct dill_iolist *first,
-      struct dill_iolist *last, int64_t deadline) {
-    /* Make a local iovec array. */
-    /* TODO: This is dangerous, it may cause stack overflow.
-       There should probably be a on-heap per-socket buffer for that. */
+static int dill_fd_sendflags(int s, struct dill_iolist *first,
+      struct dill_iolist *last, int flags, uint32_t *nsends,
+      int64_t deadline) {
     size_t niov;
     int rc = dill_iolcheck(first, last, &niov, NULL);
     if(dill_slow(rc < 0)) return -1;
-    struct iovec iov[niov];
-    dill_ioltoiov(first, iov);
+    /* Short iolists are converted into an iovec array on the stack. Long ones
+       use a cached array and are sent in chunks of DILL_FD_IOVMAX buffers.
+       If the array can't be allocated, fall back to small chunks. */
+    struct iovec siov[DILL_FD_IOVSTACK];
+    struct iovec *iov = siov;
+    size_t cap = DILL_FD_IOVSTACK;
+    if(niov > DILL_FD_IOVSTACK) {
+        struct iovec *p = dill_fd_allociov();
+        if(dill_fast(p)) {iov = p; cap = DILL_FD_IOVMAX;}
+    }
+    struct dill_iolist *it = first;
+    while(it) {
+        size_t n = dill_ioltoiovn(&it, iov, cap);
+        rc = dill_fd_sendiov(s, iov, n, flags, nsends, deadline);
+        if(dill_slow(rc < 0)) break;
+    }
+    if(iov != siov) dill_fd_freeiov(iov);
+    return rc;
+}
+
+int dill_fd_send(int s, struct dill_iolist *first, struct dill_iolist *last,
+      int64_t deadline) {
+    return dill_fd_sendflags(s, first, last, 0, NULL, deadline);
+}
+
+int dill_fd_sendbuf(int s, struct dill_fd_txbuf *txbuf,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    if(!txbuf) return dill_fd_send(s, first, last, deadline);
+    size_t len;
+    int rc = dill_iolcheck(first, last, NULL, &len);
+    if(dill_slow(rc < 0)) return -1;
+    /* If the data fit into the buffer, just copy them there. */
+    if(len <= txbuf->cap - txbuf->len) {
+        rc = dill_iolfrom(txbuf->data + txbuf->len, len, first);
+        dill_assert(rc == 0);
+        txbuf->len += len;
+        return 0;
+    }
+    /* Otherwise send the buffered data and the new data in one go. */
+    struct dill_iolist head = {txbuf->data, txbuf->len, first, 0};
+    rc = dill_fd_send(s, &head, last, deadline);
+    txbuf->len = 0;
+    return rc;
+}
+
+int dill_fd_flush(int s, struct dill_fd_txbuf *txbuf, int64_t deadline) {
+    if(!txbuf || !txbuf->len) return 0;
+    struct dill_iolist iol = {txbuf->data, txbuf->len, NULL, 0};
+    int rc = dill_fd_send(s, &iol, &iol, deadline);
+    txbuf->len = 0;
+    return rc;
+}
+
+int dill_fd_waitnotsent(int s, size_t lowat, int64_t deadline) {
+#if defined SIOCOUTQNSD
+    /* Checking the queue is cheaper than a round trip through the pollset,
+       and most of the time there's nothing to wait for. */
+    int notsent;
+    int rc = ioctl(s, SIOCOUTQNSD, &notsent);
+    if(dill_fast(rc == 0 && (size_t)notsent <= lowat)) return 0;
+#endif
+    /* With TCP_NOTSENT_LOWAT set, the socket becomes writable only once
+       the amount of unsent data drops below the watermark. */
+    return dill_fdout(s, deadline);
+}
+
+int dill_fd_setzerocopy(int s, struct dill_fd_zerocopy *zc,
+      size_t threshold) {
+#if defined DILL_FD_ZEROCOPY
+    int val = threshold ? 1 : 0;
+    int rc = setsockopt(s, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val));
+    if(dill_slow(rc < 0)) {
+        if(errno == ENOPROTOOPT || errno == EOPNOTSUPP) errno = ENOTSUP;
+        return -1;
+    }
+    zc->threshold = threshold;
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+#if defined DILL_FD_ZEROCOPY
+
+/* Waits till kernel reports that all zero-copy sends were completed, i.e.
+   that it doesn't need the user's buffers any more. */
+static int dill_fd_zcwait(int s, struct dill_fd_zerocopy *zc,
+      int64_t deadline) {
+    while(zc->completed != zc->issued) {
+        uint8_t ctrl[CMSG_SPACE(sizeof(struct sock_extended_err) +
+            sizeof(struct sockaddr_in6))];
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_control = ctrl;
+        hdr.msg_controllen = sizeof(ctrl);
+        ssize_t sz = recvmsg(s, &hdr, MSG_ERRQUEUE);
+        if(sz < 0) {
+            if(dill_slow(errno != EWOULDBLOCK && errno != EAGAIN)) return -1;
+            int rc = dill_fderr(s, deadline);
+            if(dill_slow(rc < 0)) return -1;
+            continue;
+        }
+        struct cmsghdr *cmsg;
+        for(cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+            if(!(cmsg->cmsg_level == IPPROTO_IP &&
+                  cmsg->cmsg_type == IP_RECVERR) &&
+               !(cmsg->cmsg_level == IPPROTO_IPV6 &&
+                  cmsg->cmsg_type == IPV6_RECVERR)) continue;
+            struct sock_extended_err *ee =
+                (struct sock_extended_err*)CMSG_DATA(cmsg);
+            if(ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            /* The notification covers a range of sends. */
+            zc->completed += ee->ee_data - ee->ee_info + 1;
+        }
+    }
+    return 0;
+}
+
+#endif
+
+int dill_fd_sendzc(int s, struct dill_fd_zerocopy *zc,
+      struct dill_fd_txbuf *txbuf, struct dill_iolist *first,
+      struct dill_iolist *last, int64_t deadline) {
+#if defined DILL_FD_ZEROCOPY
+    size_t len;
+    int rc = dill_iolcheck(first, last, NULL, &len);
+    if(dill_slow(rc < 0)) return -1;
+    /* Pinning the pages and processing the notification costs more than
+       copying small amounts of data. */
+    if(!zc->threshold || len < zc->threshold)
+        return dill_fd_sendbuf(s, txbuf, first, last, deadline);
+    rc = dill_fd_flush(s, txbuf, deadline);
+    if(dill_slow(rc < 0)) return -1;
+    rc = dill_fd_sendflags(s, first, last, MSG_ZEROCOPY, &zc->issued,
+        deadline);
+    /* Even if sending failed, the kernel may still be using the buffers. */
+    int err = errno;
+    int rc2 = dill_fd_zcwait(s, zc, deadline);
+    if(dill_slow(rc < 0)) {errno = err; return -1;}
+    return rc2;
+#else
+    return dill_fd_sendbuf(s, txbuf, first, last, deadline);
+#endif
+}
+
+/* Fills in the whole iovec array. */
+static int dill_fd_recviov(int s, struct iovec *iov, size_t niov,
+      int64_t deadline) {
     /* Message header will act as an iterator in the following loop. */
     struct msghdr hdr;
     memset(&hdr, 0, sizeof(hdr));
@@ -219,6 +598,7 @@ static int dill_fd_recv_(int s, struct dill_iolist *first,
     hdr.msg_iovlen = niov;
     while(1) {
         ssize_t sz = recvmsg(s, &hdr, 0);
+        DILL_TRACE2(fd_recv, s, sz);
         if(dill_slow(sz == 0)) {errno = EPIPE; return -1;}
         if(sz < 0) {
             if(dill_slow(errno != EWOULDBLOCK && errno != EAGAIN)) {
@@ -229,17 +609,15 @@ static int dill_fd_recv_(int s, struct dill_iolist *first,
         }
         /* Adjust the iovec array so that it doesn't contain buffers
            that ware already filled in. */
-        while(sz) {
-            struct iovec *head = &hdr.msg_iov[0];
-            if(head->iov_len > sz) {
-                head->iov_base += sz;
-                head->iov_len -= sz;
-                break;
-            }
-            sz -= head->iov_len;
+        while(hdr.msg_iovlen && hdr.msg_iov[0].iov_len <= sz) {
+            sz -= hdr.msg_iov[0].iov_len;
             hdr.msg_iov++;
             hdr.msg_iovlen--;
-            if(!hdr.msg_iovlen) return 0;
+        }
+        if(!hdr.msg_iovlen) return 0;
+        if(sz) {
+            hdr.msg_iov[0].iov_base += sz;
+            hdr.msg_iov[0].iov_len -= sz;
         }
         /* Wait for more data. */
         int rc = dill_fdin(s, deadline);
@@ -247,6 +625,30 @@ static int dill_fd_recv_(int s, struct dill_iolist *first,
     }
 }
 
+/* Same as dill_fd_recv() but with no rx buffering. */
+static int dill_fd_recv_(int s, struct dill_iolist *first,
+      struct dill_iolist *last, int64_t deadline) {
+    size_t niov;
+    int rc = dill_iolcheck(first, last, &niov, NULL);
+    if(dill_slow(rc < 0)) return -1;
+    /* Same chunking as in dill_fd_send(). */
+    struct iovec siov[DILL_FD_IOVSTACK];
+    struct iovec *iov = siov;
+    size_t cap = DILL_FD_IOVSTACK;
+    if(niov > DILL_FD_IOVSTACK) {
+        struct iovec *p = dill_fd_allociov();
+        if(dill_fast(p)) {iov = p; cap = DILL_FD_IOVMAX;}
+    }
+    struct dill_iolist *it = first;
+    while(it) {
+        size_t n = dill_ioltoiovn(&it, iov, cap);
+        rc = dill_fd_recviov(s, iov, n, deadline);
+        if(dill_slow(rc < 0)) break;
+    }
+    if(iov != siov) dill_fd_freeiov(iov);
+    return rc;
+}
+
 /* Skip len bytes. If len is negative skip until error occurs. */
 static int dill_fd_skip(int s, ssize_t len, int64_t deadline) {
     uint8_t buf[512];
@@ -256,6 +658,10 @@ static int dill_fd_skip(int s, ssize_t len, int64_t deadline) {
         int rc = dill_fd_recv_(s, &iol, &iol, deadline);
         if(dill_slow(rc < 0)) return -1;
         if(len >= 0) len -= to_recv;
+        /* If the peer keeps sending, the fd is readable every time it is
+           polled and the deadline would never get a chance to expire. */
+        else if(dill_slow(deadline >= 0 && dill_now() > deadline)) {
+            errno = ETIMEDOUT; return -1;}
     }
     return 0;
 }
@@ -271,7 +677,7 @@ static size_t dill_fd_copy(struct dill_fd_rxbuf *rxbuf,
             memcpy(iol->iol_base, rxbuf->buf + rxbuf->pos, rmn);
         rxbuf->len = 0;
         rxbuf->pos = 0;
-        dill_fd_freebuf(rxbuf->buf);
+        dill_fd_freebuf(rxbuf->buf, rxbuf->bufcls);
         rxbuf->buf = NULL;
         return rmn;
     }
@@ -281,6 +687,38 @@ static size_t dill_fd_copy(struct dill_fd_rxbuf *rxbuf,
     return iol->iol_len;
 }
 
+/* Reads as much data as is available into an empty rxbuf. Returns the number
+   of bytes read, zero if there was no data available. */
+static ssize_t dill_fd_refill(int s, struct dill_fd_rxbuf *rxbuf) {
+    if(rxbuf->buf && rxbuf->bufcls != rxbuf->cls) {
+        /* The buffer is empty at this point. Replace it by one of
+           the right size. */
+        dill_fd_freebuf(rxbuf->buf, rxbuf->bufcls);
+        rxbuf->buf = NULL;
+    }
+    if(!rxbuf->buf) {
+        rxbuf->buf = dill_fd_allocbuf(rxbuf->cls);
+        if(dill_slow(!rxbuf->buf)) return -1;
+        rxbuf->bufcls = rxbuf->cls;
+    }
+    size_t bufsz = DILL_FD_BUFSIZE(rxbuf->bufcls);
+    ssize_t sz = recv(s, rxbuf->buf, bufsz, 0);
+    DILL_TRACE2(fd_recv, s, sz);
+    if(dill_slow(sz == 0)) {errno = EPIPE; return -1;}
+    if(sz < 0) {
+        if(dill_slow(errno != EWOULDBLOCK && errno != EAGAIN)) {
+            if(errno == EPIPE) errno = ECONNRESET;
+            return -1;
+        }
+        sz = 0;
+    }
+    if(sz == bufsz) dill_fd_rxgrow(rxbuf);
+    else if(sz > 0 && sz < bufsz / 4) dill_fd_rxshrink(rxbuf);
+    rxbuf->len = sz;
+    rxbuf->pos = 0;
+    return sz;
+}
+
 int dill_fd_recv(int s, struct dill_fd_rxbuf *rxbuf, struct dill_iolist *first,
       struct dill_iolist *last, int64_t deadline) {
     /* Skip all data until error occurs. */
@@ -310,8 +748,13 @@ int dill_fd_recv(int s, struct dill_fd_rxbuf *rxbuf, struct dill_iolist *first,
         it = it->iol_next;
     }
     /* If requested amount of data is larger than rx buffer avoid the copy
-       and read it directly into user's buffer. */
-    if(!rxbuf || miss > DILL_FD_BUFSIZE) {
+       and read it directly into user's buffer. If the read is not too large,
+       though, make the buffer grow so that subsequent reads of similar size
+       can be batched. */
+    if(rxbuf && miss > DILL_FD_BUFSIZE(rxbuf->cls) &&
+          miss <= DILL_FD_BUFMAX / 4)
+        dill_fd_rxgrow(rxbuf);
+    if(!rxbuf || miss > DILL_FD_BUFSIZE(rxbuf->cls)) {
         // There may be NULL bufers in the list. These can't be passed to
         // recv_(). We have to split the list and call recv_() and skip()
         // respectively.
@@ -353,21 +796,8 @@ next:
         /* Read as much data as possible to the buffer to avoid extra
            syscalls. Do the speculative recv() first to avoid extra
            polling. Do fdin() only after recv() fails to get data. */
-        if(!rxbuf->buf) {
-            rxbuf->buf = dill_fd_allocbuf();
-            if(dill_slow(!rxbuf->buf)) return -1;
-        }
-        ssize_t sz = recv(s, rxbuf->buf, DILL_FD_BUFSIZE, 0);
-        if(dill_slow(sz == 0)) {errno = EPIPE; return -1;}
-        if(sz < 0) {
-            if(dill_slow(errno != EWOULDBLOCK && errno != EAGAIN)) {
-                if(errno == EPIPE) errno = ECONNRESET;
-                return -1;
-            }
-            sz = 0;
-        }
-        rxbuf->len = sz;
-        rxbuf->pos = 0;
+        ssize_t sz = dill_fd_refill(s, rxbuf);
+        if(dill_slow(sz < 0)) return -1;
         /* Copy the data from rxbuffer to the iolist. */
         while(1) {
             sz = dill_fd_copy(rxbuf, &curr);
@@ -383,6 +813,64 @@ next:
     }
 }
 
+ssize_t dill_fd_recvsome(int s, struct dill_fd_rxbuf *rxbuf,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    size_t niov, len;
+    int rc = dill_iolcheck(first, last, &niov, &len);
+    if(dill_slow(rc < 0)) return -1;
+    if(dill_slow(!len)) return 0;
+    struct dill_iolist *it;
+    /* Small reads go through the rx buffer so that the data that are
+       available beyond the requested amount can be returned without
+       further syscalls. */
+    while(rxbuf && (rxbuf->len > rxbuf->pos ||
+          len <= DILL_FD_BUFSIZE(rxbuf->cls))) {
+        if(rxbuf->len > rxbuf->pos) {
+            size_t sz = 0;
+            for(it = first; it; it = it->iol_next) {
+                size_t n = dill_fd_copy(rxbuf, it);
+                sz += n;
+                if(n < it->iol_len) break;
+            }
+            return sz;
+        }
+        ssize_t sz = dill_fd_refill(s, rxbuf);
+        if(dill_slow(sz < 0)) return -1;
+        if(sz > 0) continue;
+        rc = dill_fdin(s, deadline);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    /* Big reads are done directly into the user's buffers. Only as many
+       buffers as fit into an iovec array are filled in. */
+    struct iovec siov[DILL_FD_IOVSTACK];
+    struct iovec *iov = siov;
+    size_t cap = DILL_FD_IOVSTACK;
+    if(niov > DILL_FD_IOVSTACK) {
+        struct iovec *p = dill_fd_allociov();
+        if(dill_fast(p)) {iov = p; cap = DILL_FD_IOVMAX;}
+    }
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    it = first;
+    hdr.msg_iovlen = dill_ioltoiovn(&it, iov, cap);
+    ssize_t sz;
+    while(1) {
+        sz = recvmsg(s, &hdr, 0);
+        DILL_TRACE2(fd_recv, s, sz);
+        if(dill_fast(sz > 0)) break;
+        if(dill_slow(sz == 0)) {errno = EPIPE; sz = -1; break;}
+        if(dill_slow(errno != EWOULDBLOCK && errno != EAGAIN)) {
+            if(errno == EPIPE) errno = ECONNRESET;
+            break;
+        }
+        rc = dill_fdin(s, deadline);
+        if(dill_slow(rc < 0)) break;
+    }
+    if(iov != siov) dill_fd_freeiov(iov);
+    return sz;
+}
+
 void dill_fd_close(int s) {
     int rc = dill_fdclean(s);
     dill_assert(rc == 0);
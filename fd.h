@@ -25,32 +25,149 @@
 #ifndef DILL_FD_INCLUDED
 #define DILL_FD_INCLUDED
 
+#include <limits.h>
+#include <signal.h>
 #include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #define DILL_DISABLE_RAW_NAMES
 #include "libdill.h"
 #include "slist.h"
 
+/* Iolists up to this number of buffers are converted into iovec arrays
+   on the C stack. */
+#define DILL_FD_IOVSTACK 8
+
+/* Size of the iovec arrays used for longer iolists. */
+#if defined IOV_MAX
+#define DILL_FD_IOVMAX IOV_MAX
+#else
+#define DILL_FD_IOVMAX 1024
+#endif
+
+/* Receive buffers come in size classes. Class i buffer has (2048 << i) - 64
+   bytes, i.e. class 0 buffer is 1984 bytes and, by default, the largest one
+   is just below 64kB. The 64 bytes are left for malloc's bookkeeping. */
+#if !defined DILL_FD_RXBUFCLASSES
+#define DILL_FD_RXBUFCLASSES 6
+#endif
+
+/* Buffers used to move data through user space, e.g. by brelay(), are taken
+   from the same cache as the receive buffers. It's the largest class up to
+   16kB. */
+#define DILL_FD_COPYBUFCLS \
+    (DILL_FD_RXBUFCLASSES > 3 ? 3 : DILL_FD_RXBUFCLASSES - 1)
+#define DILL_FD_COPYBUFSIZE ((size_t)(2048 << DILL_FD_COPYBUFCLS) - 64)
+
 struct dill_ctx_fd {
+    /* Unused receive buffers, one cache per size class. */
     int count;
-    struct dill_slist cache;
+    int counts[DILL_FD_RXBUFCLASSES];
+    struct dill_slist caches[DILL_FD_RXBUFCLASSES];
+    /* Unused iovec arrays. */
+    int iovcount;
+    struct dill_slist iovcache;
+    /* Statistics. */
+    uint64_t hits;
+    uint64_t misses;
 };
 
 int dill_ctx_fd_init(struct dill_ctx_fd *ctx);
 void dill_ctx_fd_term(struct dill_ctx_fd *ctx);
 
 struct dill_fd_rxbuf {
-    size_t len;
-    size_t pos;
+    uint32_t len;
+    uint32_t pos;
     uint8_t *buf;
+    /* Size class of 'buf'. */
+    uint8_t bufcls;
+    /* Size class to use for the next allocation. It grows while reads are
+       too big for the buffer or keep filling it up and it shrinks while
+       the reads only fill a small part of the buffer. */
+    uint8_t cls;
+    uint8_t grow;
+    uint8_t shrink;
+};
+
+/* Optional transmit buffer. Writes are accumulated in the buffer and handed
+   to the kernel in a single system call when the buffer fills up or when
+   it is flushed explicitly. */
+struct dill_fd_txbuf {
+    size_t len;
+    size_t cap;
+    uint8_t data[];
+};
+
+/* State of zero-copy sending. Sends of at least 'threshold' bytes are done
+   using MSG_ZEROCOPY. The kernel numbers such sends and reports, via
+   the socket's error queue, when it stops using their buffers. */
+struct dill_fd_zerocopy {
+    size_t threshold;
+    uint32_t issued;
+    uint32_t completed;
+};
+
+/* State of a bytestream socket backed by a single file descriptor. Such
+   sockets return a pointer to it when queried for dill_fd_stream_type.
+   That way, data can be moved between them without going through their
+   bytestream interface, e.g. using splice(). */
+struct dill_fd_stream {
+    struct dill_fd_rxbuf rxbuf;
+    struct dill_fd_txbuf *txbuf;
+    int fd;
+    unsigned int rbusy : 1;
+    unsigned int sbusy : 1;
+    unsigned int indone : 1;
+    unsigned int outdone : 1;
+    unsigned int inerr : 1;
+    unsigned int outerr : 1;
+};
+
+extern const void *dill_fd_stream_type;
+
+/* Unlike send(), splice() and sendfile() have no way to suppress SIGPIPE.
+   Writes done by them have to be enclosed between dill_fd_blocksigpipe()
+   and dill_fd_unblocksigpipe(). SIGPIPE raised in between is discarded,
+   unless it was already pending beforehand. */
+struct dill_fd_sigpipe {
+    sigset_t oldset;
+    int pending;
 };
 
+/* Gets an array of DILL_FD_IOVMAX iovecs. Returns NULL if out of memory. */
+struct iovec *dill_fd_allociov(void);
+/* Returns the array to the cache. Doesn't modify errno. */
+void dill_fd_freeiov(
+    struct iovec *iov);
+/* Gets a buffer of DILL_FD_COPYBUFSIZE bytes. Returns NULL if out of
+   memory. */
+uint8_t *dill_fd_alloccopybuf(void);
+/* Returns the buffer to the cache. Doesn't modify errno. */
+void dill_fd_freecopybuf(
+    uint8_t *buf);
 void dill_fd_initrxbuf(
     struct dill_fd_rxbuf *rxbuf);
 void dill_fd_termrxbuf(
     struct dill_fd_rxbuf *rxbuf);
+/* Replaces the transmit buffer by one of the specified size. Zero size means
+   no buffering. Fails with EBUSY if there's unflushed data in the buffer. */
+int dill_fd_settxbuf(
+    struct dill_fd_txbuf **txbuf,
+    size_t size);
+void dill_fd_termtxbuf(
+    struct dill_fd_txbuf *txbuf);
+/* Returns 1 if the read can be satisfied from the receive buffer without
+   touching the socket. */
+int dill_fd_rxready(
+    struct dill_fd_rxbuf *rxbuf,
+    struct dill_iolist *first);
+void dill_fd_blocksigpipe(
+    struct dill_fd_sigpipe *sp);
+/* Doesn't modify errno. */
+void dill_fd_unblocksigpipe(
+    struct dill_fd_sigpipe *sp);
 int dill_fd_unblock(
     int s);
 int dill_fd_connect(
@@ -58,6 +175,22 @@ int dill_fd_connect(
     const struct sockaddr *addr,
     socklen_t addrlen,
     int64_t deadline);
+/* Connects and sends the data. Where possible, the data are carried by
+   the SYN packet (TCP Fast Open), in which case the function may return
+   before the connection is established. */
+int dill_fd_connectl(
+    int s,
+    const struct sockaddr *addr,
+    socklen_t addrlen,
+    struct dill_iolist *first,
+    struct dill_iolist *last,
+    int64_t deadline);
+/* Same as dill_fd_accept() except that it fails with EAGAIN instead of
+   waiting for a connection. */
+int dill_fd_tryaccept(
+    int s,
+    struct sockaddr *addr,
+    socklen_t *addrlen);
 int dill_fd_accept(
     int s,
     struct sockaddr *addr,
@@ -68,12 +201,54 @@ int dill_fd_send(
     struct dill_iolist *first,
     struct dill_iolist *last,
     int64_t deadline);
+/* Same as dill_fd_send() except that the data may be stored in the transmit
+   buffer instead of being sent straight away. */
+int dill_fd_sendbuf(
+    int s,
+    struct dill_fd_txbuf *txbuf,
+    struct dill_iolist *first,
+    struct dill_iolist *last,
+    int64_t deadline);
+int dill_fd_flush(
+    int s,
+    struct dill_fd_txbuf *txbuf,
+    int64_t deadline);
+/* Waits till the amount of data queued in the kernel but not yet sent
+   drops to 'lowat' or below. The socket must have TCP_NOTSENT_LOWAT set
+   to the same value. */
+int dill_fd_waitnotsent(
+    int s,
+    size_t lowat,
+    int64_t deadline);
+/* Zero threshold switches zero-copy sending off. Fails with ENOTSUP if
+   the system doesn't support it. */
+int dill_fd_setzerocopy(
+    int s,
+    struct dill_fd_zerocopy *zc,
+    size_t threshold);
+/* Same as dill_fd_sendbuf() except that large sends are done without
+   copying the data. Returns only after the kernel is done with the data. */
+int dill_fd_sendzc(
+    int s,
+    struct dill_fd_zerocopy *zc,
+    struct dill_fd_txbuf *txbuf,
+    struct dill_iolist *first,
+    struct dill_iolist *last,
+    int64_t deadline);
 int dill_fd_recv(
     int s,
     struct dill_fd_rxbuf *rxbuf,
     struct dill_iolist *first,
     struct dill_iolist *last,
     int64_t deadline);
+/* Receives at least one byte and at most the size of the iolist. Returns
+   the number of bytes received. */
+ssize_t dill_fd_recvsome(
+    int s,
+    struct dill_fd_rxbuf *rxbuf,
+    struct dill_iolist *first,
+    struct dill_iolist *last,
+    int64_t deadline);
 void dill_fd_close(
     int s);
 int dill_fd_own(
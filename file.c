@@ -0,0 +1,611 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DILL_DISABLE_RAW_NAMES
+#include "libdillimpl.h"
+#include "cr.h"
+#include "iol.h"
+#include "list.h"
+#include "utils.h"
+
+/* Regular files are always reported as readable and writable by poll() and
+   friends, yet reading from or writing to them may block for a long time.
+   Therefore, the actual I/O is done by a pool of helper threads. Once
+   the operation is finished the helper thread notifies the waiting coroutine
+   via a pipe. If threads are disabled the operations are performed in
+   a blocking manner. */
+
+dill_unique_id(dill_file_type);
+
+#define DILL_FILE_OPEN 1
+#define DILL_FILE_READ 2
+#define DILL_FILE_WRITE 3
+#define DILL_FILE_SYNC 4
+
+#define DILL_FILE_QUEUED 1
+#define DILL_FILE_RUNNING 2
+#define DILL_FILE_DONE 3
+
+struct dill_file_op {
+    struct dill_list item;
+    int type;
+    int state;
+    /* Write end of the notification pipe. */
+    int notify;
+    int fd;
+    union {
+        struct {
+            const char *path;
+            int flags;
+            mode_t mode;
+        } open;
+        struct {
+            struct dill_iolist *first;
+            int64_t offset;
+        } rw;
+    } args;
+    /* Number of bytes read or written or the newly opened file descriptor. */
+    ssize_t result;
+    int err;
+};
+
+static void dill_file_execute(struct dill_file_op *op) {
+    op->result = 0;
+    op->err = 0;
+    switch(op->type) {
+    case DILL_FILE_OPEN:
+        while(1) {
+            op->result = open(op->args.open.path, op->args.open.flags,
+                op->args.open.mode);
+            if(dill_fast(op->result >= 0)) return;
+            if(errno != EINTR) break;
+        }
+        op->err = errno;
+        return;
+    case DILL_FILE_READ:
+    case DILL_FILE_WRITE:;
+        struct dill_iolist *it = op->args.rw.first;
+        int64_t offset = op->args.rw.offset;
+        size_t pos = 0;
+        while(it) {
+            if(pos >= it->iol_len) {it = it->iol_next; pos = 0; continue;}
+            size_t len = it->iol_len - pos;
+            ssize_t sz;
+            if(op->type == DILL_FILE_READ) {
+                /* Buffers with no base are simply skipped. */
+                if(!it->iol_base) sz = len;
+                else sz = pread(op->fd, (uint8_t*)it->iol_base + pos,
+                    len, offset);
+                /* End of file. */
+                if(sz == 0) return;
+            }
+            else {
+                sz = pwrite(op->fd, (uint8_t*)it->iol_base + pos, len, offset);
+            }
+            if(dill_slow(sz < 0)) {
+                if(errno == EINTR) continue;
+                op->err = errno;
+                return;
+            }
+            pos += sz;
+            offset += sz;
+            op->result += sz;
+        }
+        return;
+    case DILL_FILE_SYNC:
+        if(dill_slow(fsync(op->fd) < 0)) op->err = errno;
+        return;
+    default:
+        dill_assert(0);
+    }
+}
+
+#if defined DILL_THREADS
+
+#include <pthread.h>
+#include <signal.h>
+
+/* Maximum number of helper threads. New threads are launched only when there
+   is no idle thread to pick up the operation. */
+#define DILL_FILE_MAXWORKERS 8
+
+static pthread_mutex_t dill_file_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dill_file_cond = PTHREAD_COND_INITIALIZER;
+static struct dill_list dill_file_queue = {&dill_file_queue, &dill_file_queue};
+static int dill_file_workers = 0;
+static int dill_file_idle = 0;
+
+static void *dill_file_worker(void *arg) {
+    /* Helper threads should not steal signals from the user's threads. */
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    int rc = pthread_mutex_lock(&dill_file_lock);
+    dill_assert(rc == 0);
+    while(1) {
+        while(dill_list_empty(&dill_file_queue)) {
+            dill_file_idle++;
+            rc = pthread_cond_wait(&dill_file_cond, &dill_file_lock);
+            dill_assert(rc == 0);
+            dill_file_idle--;
+        }
+        struct dill_file_op *op = dill_cont(dill_list_next(&dill_file_queue),
+            struct dill_file_op, item);
+        dill_list_erase(&op->item);
+        op->state = DILL_FILE_RUNNING;
+        rc = pthread_mutex_unlock(&dill_file_lock);
+        dill_assert(rc == 0);
+        dill_file_execute(op);
+        rc = pthread_mutex_lock(&dill_file_lock);
+        dill_assert(rc == 0);
+        op->state = DILL_FILE_DONE;
+        /* Once the notification is sent the op may be deallocated so we
+           can't touch it afterwards. */
+        int notify = op->notify;
+        rc = pthread_mutex_unlock(&dill_file_lock);
+        dill_assert(rc == 0);
+        char c = 0;
+        ssize_t sz;
+        do sz = write(notify, &c, 1); while(sz < 0 && errno == EINTR);
+        dill_assert(sz == 1);
+        rc = pthread_mutex_lock(&dill_file_lock);
+        dill_assert(rc == 0);
+    }
+    return NULL;
+}
+
+static int dill_file_submit(struct dill_file_op *op) {
+    int err;
+    int rc = pthread_mutex_lock(&dill_file_lock);
+    dill_assert(rc == 0);
+    op->state = DILL_FILE_QUEUED;
+    dill_list_insert(&op->item, &dill_file_queue);
+    if(dill_file_idle || dill_file_workers >= DILL_FILE_MAXWORKERS) {
+        rc = pthread_cond_signal(&dill_file_cond);
+        dill_assert(rc == 0);
+    }
+    else {
+        pthread_attr_t attr;
+        rc = pthread_attr_init(&attr);
+        dill_assert(rc == 0);
+        rc = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        dill_assert(rc == 0);
+        pthread_t thread;
+        rc = pthread_create(&thread, &attr, dill_file_worker, NULL);
+        pthread_attr_destroy(&attr);
+        if(dill_fast(rc == 0)) dill_file_workers++;
+        /* If there's at least one worker the op will be processed eventually
+           even if we've failed to launch a new one. */
+        else if(!dill_file_workers) {
+            dill_list_erase(&op->item);
+            err = rc;
+            goto error;
+        }
+    }
+    rc = pthread_mutex_unlock(&dill_file_lock);
+    dill_assert(rc == 0);
+    return 0;
+error:
+    rc = pthread_mutex_unlock(&dill_file_lock);
+    dill_assert(rc == 0);
+    errno = err;
+    return -1;
+}
+
+/* Withdraws the operation if it wasn't picked up by a helper thread yet.
+   Returns 1 if the operation was withdrawn, 0 otherwise. */
+static int dill_file_withdraw(struct dill_file_op *op) {
+    int rc = pthread_mutex_lock(&dill_file_lock);
+    dill_assert(rc == 0);
+    int queued = op->state == DILL_FILE_QUEUED;
+    if(queued) dill_list_erase(&op->item);
+    rc = pthread_mutex_unlock(&dill_file_lock);
+    dill_assert(rc == 0);
+    return queued;
+}
+
+/* Reads the completion notification from the pipe. Returns -1 if there's
+   no notification available yet. */
+static int dill_file_consume(int fd) {
+    char c;
+    while(1) {
+        ssize_t sz = read(fd, &c, 1);
+        if(dill_fast(sz == 1)) return 0;
+        dill_assert(sz < 0);
+        if(errno == EINTR) continue;
+        dill_assert(errno == EAGAIN || errno == EWOULDBLOCK);
+        return -1;
+    }
+}
+
+/* Waits for the completion of an in-flight operation by blocking the whole
+   thread. Used when the coroutine can't be suspended, e.g. if it is being
+   canceled. */
+static void dill_file_block(int fd) {
+    while(dill_file_consume(fd) < 0) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int rc = poll(&pfd, 1, -1);
+        dill_assert(rc >= 0 || errno == EINTR);
+    }
+}
+
+/* Executes the operation in a helper thread and waits for its completion.
+   Deadline only applies to the time the operation spends in the queue. Once
+   the operation is being executed it can't be interrupted. If the function
+   fails with ECANCELED, the operation may have been executed anyway. In that
+   case op->state is DILL_FILE_DONE and the caller is responsible for
+   releasing any resources it has produced. */
+static int dill_file_run(int pipe, struct dill_file_op *op,
+      int64_t deadline) {
+    int rc = dill_file_submit(op);
+    if(dill_slow(rc < 0)) return -1;
+    while(1) {
+        rc = dill_fdin(pipe, deadline);
+        if(dill_slow(rc < 0)) {
+            int err = errno;
+            if(dill_file_withdraw(op)) {errno = err; return -1;}
+            /* The operation is being executed. If the coroutine is being
+               canceled we have no option but to block. Otherwise, wait for
+               the operation to finish. */
+            if(err == ECANCELED) {
+                dill_file_block(pipe);
+                errno = ECANCELED;
+                return -1;
+            }
+            deadline = -1;
+            continue;
+        }
+        if(dill_fast(dill_file_consume(pipe) == 0)) break;
+    }
+    return 0;
+}
+
+#else
+
+static int dill_file_run(int pipe, struct dill_file_op *op,
+      int64_t deadline) {
+    op->state = DILL_FILE_QUEUED;
+    int rc = dill_canblock();
+    if(dill_slow(rc < 0)) return -1;
+    dill_file_execute(op);
+    op->state = DILL_FILE_DONE;
+    return 0;
+}
+
+#endif
+
+/******************************************************************************/
+/*  File handle                                                               */
+/******************************************************************************/
+
+static void *dill_file_hquery(struct dill_hvfs *hvfs, const void *type);
+static void dill_file_hclose(struct dill_hvfs *hvfs);
+static int dill_file_bsendl(struct dill_bsock_vfs *bvfs,
+    struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
+static int dill_file_brecvl(struct dill_bsock_vfs *bvfs,
+    struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
+static int dill_file_bflush(struct dill_bsock_vfs *bvfs, int64_t deadline);
+static ssize_t dill_file_brecvsomel(struct dill_bsock_vfs *bvfs,
+    struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
+
+struct dill_file {
+    struct dill_hvfs hvfs;
+    struct dill_bsock_vfs bvfs;
+    int fd;
+    /* Pipe used by helper threads to signal completion of operations. */
+    int pipe[2];
+    /* Current position in the file, used by bytestream operations. */
+    int64_t pos;
+    struct dill_file_op op;
+    unsigned int busy : 1;
+    unsigned int mem : 1;
+};
+
+DILL_CHECK_STORAGE(dill_file, dill_file_storage)
+
+static void *dill_file_hquery(struct dill_hvfs *hvfs, const void *type) {
+    struct dill_file *self = (struct dill_file*)hvfs;
+    if(type == dill_bsock_type) return &self->bvfs;
+    if(type == dill_file_type) return self;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static int dill_file_cloexec(int fd) {
+    int opt = fcntl(fd, F_GETFD);
+    if(dill_slow(opt < 0)) return -1;
+    int rc = fcntl(fd, F_SETFD, opt | FD_CLOEXEC);
+    if(dill_slow(rc < 0)) return -1;
+    return 0;
+}
+
+/* Initializes the object, except for the underlying file descriptor. */
+static int dill_file_init(struct dill_file *self) {
+    int err;
+    int rc = pipe(self->pipe);
+    if(dill_slow(rc < 0)) {err = errno; goto error1;}
+    rc = dill_file_cloexec(self->pipe[0]);
+    if(dill_slow(rc < 0)) {err = errno; goto error2;}
+    rc = dill_file_cloexec(self->pipe[1]);
+    if(dill_slow(rc < 0)) {err = errno; goto error2;}
+    /* Coroutine side of the pipe must be non-blocking. */
+    int opt = fcntl(self->pipe[0], F_GETFL, 0);
+    if(dill_slow(opt < 0)) {err = errno; goto error2;}
+    rc = fcntl(self->pipe[0], F_SETFL, opt | O_NONBLOCK);
+    if(dill_slow(rc < 0)) {err = errno; goto error2;}
+    self->hvfs.query = dill_file_hquery;
+    self->hvfs.close = dill_file_hclose;
+    self->bvfs.bsendl = dill_file_bsendl;
+    self->bvfs.brecvl = dill_file_brecvl;
+    self->bvfs.bflush = dill_file_bflush;
+    self->bvfs.brecvsomel = dill_file_brecvsomel;
+    self->fd = -1;
+    self->pos = 0;
+    self->op.notify = self->pipe[1];
+    self->busy = 0;
+    self->mem = 1;
+    return 0;
+error2:
+    close(self->pipe[0]);
+    close(self->pipe[1]);
+error1:
+    errno = err;
+    return -1;
+}
+
+static void dill_file_term(struct dill_file *self) {
+    int rc = dill_fdclean(self->pipe[0]);
+    dill_assert(rc == 0);
+    close(self->pipe[0]);
+    close(self->pipe[1]);
+}
+
+int dill_file_open_mem(const char *path, int flags, mode_t mode,
+      struct dill_file_storage *mem, int64_t deadline) {
+    int err;
+    if(dill_slow(!mem || !path)) {err = EINVAL; goto error1;}
+    struct dill_file *self = (struct dill_file*)mem;
+    int rc = dill_file_init(self);
+    if(dill_slow(rc < 0)) {err = errno; goto error1;}
+    /* Even opening a file can block, e.g. on a network filesystem. */
+    self->op.type = DILL_FILE_OPEN;
+    self->op.args.open.path = path;
+    self->op.args.open.flags = flags;
+    self->op.args.open.mode = mode;
+    rc = dill_file_run(self->pipe[0], &self->op, deadline);
+    if(dill_slow(rc < 0)) {
+        err = errno;
+        /* The file may have been opened even though we were canceled. */
+        if(self->op.state == DILL_FILE_DONE && !self->op.err)
+            close(self->op.result);
+        goto error2;
+    }
+    if(dill_slow(self->op.err)) {err = self->op.err; goto error2;}
+    self->fd = self->op.result;
+    rc = dill_file_cloexec(self->fd);
+    if(dill_slow(rc < 0)) {err = errno; goto error3;}
+    if(flags & O_APPEND) {
+        struct stat st;
+        rc = fstat(self->fd, &st);
+        if(dill_slow(rc < 0)) {err = errno; goto error3;}
+        self->pos = st.st_size;
+    }
+    int h = dill_hmake(&self->hvfs);
+    if(dill_slow(h < 0)) {err = errno; goto error3;}
+    return h;
+error3:
+    close(self->fd);
+error2:
+    dill_file_term(self);
+error1:
+    errno = err;
+    return -1;
+}
+
+int dill_file_open(const char *path, int flags, mode_t mode,
+      int64_t deadline) {
+    int err;
+    struct dill_file *obj = malloc(sizeof(struct dill_file));
+    if(dill_slow(!obj)) {err = ENOMEM; goto error1;}
+    int s = dill_file_open_mem(path, flags, mode,
+        (struct dill_file_storage*)obj, deadline);
+    if(dill_slow(s < 0)) {err = errno; goto error2;}
+    obj->mem = 0;
+    return s;
+error2:
+    free(obj);
+error1:
+    errno = err;
+    return -1;
+}
+
+int dill_file_fromfd_mem(int fd, struct dill_file_storage *mem) {
+    int err;
+    if(dill_slow(!mem || fd < 0)) {err = EINVAL; goto error1;}
+    struct dill_file *self = (struct dill_file*)mem;
+    int rc = dill_file_init(self);
+    if(dill_slow(rc < 0)) {err = errno; goto error1;}
+    /* Take ownership of the file descriptor. */
+    self->fd = dup(fd);
+    if(dill_slow(self->fd < 0)) {err = errno; goto error2;}
+    rc = dill_file_cloexec(self->fd);
+    if(dill_slow(rc < 0)) {err = errno; goto error3;}
+    /* Bytestream operations continue from the current position. */
+    off_t pos = lseek(self->fd, 0, SEEK_CUR);
+    if(pos > 0) self->pos = pos;
+    int h = dill_hmake(&self->hvfs);
+    if(dill_slow(h < 0)) {err = errno; goto error3;}
+    close(fd);
+    return h;
+error3:
+    close(self->fd);
+error2:
+    dill_file_term(self);
+error1:
+    errno = err;
+    return -1;
+}
+
+int dill_file_fromfd(int fd) {
+    int err;
+    struct dill_file *obj = malloc(sizeof(struct dill_file));
+    if(dill_slow(!obj)) {err = ENOMEM; goto error1;}
+    int s = dill_file_fromfd_mem(fd, (struct dill_file_storage*)obj);
+    if(dill_slow(s < 0)) {err = errno; goto error2;}
+    obj->mem = 0;
+    return s;
+error2:
+    free(obj);
+error1:
+    errno = err;
+    return -1;
+}
+
+/* Reads or writes the iolist at the specified offset. Returns number of bytes
+   transferred. */
+static ssize_t dill_file_rw(struct dill_file *self, int type,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t offset,
+      int64_t deadline) {
+    if(dill_slow(self->busy)) {errno = EBUSY; return -1;}
+    if(dill_slow(offset < 0)) {errno = EINVAL; return -1;}
+    int rc = dill_iolcheck(first, last, NULL, NULL);
+    if(dill_slow(rc < 0)) return -1;
+    self->busy = 1;
+    self->op.type = type;
+    self->op.fd = self->fd;
+    self->op.args.rw.first = first;
+    self->op.args.rw.offset = offset;
+    rc = dill_file_run(self->pipe[0], &self->op, deadline);
+    self->busy = 0;
+    if(dill_slow(rc < 0)) return -1;
+    if(dill_slow(self->op.err)) {errno = self->op.err; return -1;}
+    return self->op.result;
+}
+
+static int dill_file_bsendl(struct dill_bsock_vfs *bvfs,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    struct dill_file *self = dill_cont(bvfs, struct dill_file, bvfs);
+    ssize_t sz = dill_file_rw(self, DILL_FILE_WRITE, first, last, self->pos,
+        deadline);
+    if(dill_slow(sz < 0)) return -1;
+    self->pos += sz;
+    return 0;
+}
+
+/* A single read is done. It returns less data than requested only at
+   the end of the file. */
+static ssize_t dill_file_brecvsomel(struct dill_bsock_vfs *bvfs,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    struct dill_file *self = dill_cont(bvfs, struct dill_file, bvfs);
+    size_t len;
+    int rc = dill_iolcheck(first, last, NULL, &len);
+    if(dill_slow(rc < 0)) return -1;
+    if(dill_slow(!len)) return 0;
+    ssize_t sz = dill_file_rw(self, DILL_FILE_READ, first, last, self->pos,
+        deadline);
+    if(dill_slow(sz < 0)) return -1;
+    if(dill_slow(sz == 0)) {errno = EPIPE; return -1;}
+    self->pos += sz;
+    return sz;
+}
+
+/* Writes are not buffered in user space. */
+static int dill_file_bflush(struct dill_bsock_vfs *bvfs, int64_t deadline) {
+    return 0;
+}
+
+static int dill_file_brecvl(struct dill_bsock_vfs *bvfs,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    struct dill_file *self = dill_cont(bvfs, struct dill_file, bvfs);
+    /* Skip to the end of the file. */
+    if(!first && !last) {
+        if(dill_slow(self->busy)) {errno = EBUSY; return -1;}
+        struct stat st;
+        int rc = fstat(self->fd, &st);
+        if(dill_slow(rc < 0)) return -1;
+        if(st.st_size > self->pos) self->pos = st.st_size;
+        errno = EPIPE;
+        return -1;
+    }
+    size_t len;
+    int rc = dill_iolcheck(first, last, NULL, &len);
+    if(dill_slow(rc < 0)) return -1;
+    ssize_t sz = dill_file_rw(self, DILL_FILE_READ, first, last, self->pos,
+        deadline);
+    if(dill_slow(sz < 0)) return -1;
+    self->pos += sz;
+    if(dill_slow(sz < len)) {errno = EPIPE; return -1;}
+    return 0;
+}
+
+ssize_t dill_file_pread(int s, void *buf, size_t len, int64_t offset,
+      int64_t deadline) {
+    struct dill_file *self = dill_hquery(s, dill_file_type);
+    if(dill_slow(!self)) return -1;
+    struct dill_iolist iol = {buf, len, NULL, 0};
+    return dill_file_rw(self, DILL_FILE_READ, &iol, &iol, offset, deadline);
+}
+
+int dill_file_pwrite(int s, const void *buf, size_t len, int64_t offset,
+      int64_t deadline) {
+    struct dill_file *self = dill_hquery(s, dill_file_type);
+    if(dill_slow(!self)) return -1;
+    struct dill_iolist iol = {(void*)buf, len, NULL, 0};
+    ssize_t sz = dill_file_rw(self, DILL_FILE_WRITE, &iol, &iol, offset,
+        deadline);
+    if(dill_slow(sz < 0)) return -1;
+    return 0;
+}
+
+int dill_file_sync(int s, int64_t deadline) {
+    struct dill_file *self = dill_hquery(s, dill_file_type);
+    if(dill_slow(!self)) return -1;
+    if(dill_slow(self->busy)) {errno = EBUSY; return -1;}
+    self->busy = 1;
+    self->op.type = DILL_FILE_SYNC;
+    self->op.fd = self->fd;
+    int rc = dill_file_run(self->pipe[0], &self->op, deadline);
+    self->busy = 0;
+    if(dill_slow(rc < 0)) return -1;
+    if(dill_slow(self->op.err)) {errno = self->op.err; return -1;}
+    return 0;
+}
+
+static void dill_file_hclose(struct dill_hvfs *hvfs) {
+    struct dill_file *self = (struct dill_file*)hvfs;
+    /* The handle must not be closed while a different coroutine is waiting
+       for an operation to finish. Canceling that coroutine first makes sure
+       that no helper thread accesses the object after it's deallocated. */
+    dill_assert(!self->busy);
+    close(self->fd);
+    dill_file_term(self);
+    if(!self->mem) free(self);
+}
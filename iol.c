@@ -65,6 +65,17 @@ void dill_ioltoiov(struct iolist *first, struct iovec *iov) {
     }
 }
 
+size_t dill_ioltoiovn(struct iolist **first, struct iovec *iov, size_t n) {
+    struct iolist *it = *first;
+    size_t i;
+    for(i = 0; i != n && it; ++i, it = it->iol_next) {
+        iov[i].iov_base = it->iol_base;
+        iov[i].iov_len = it->iol_len;
+    }
+    *first = it;
+    return i;
+}
+
 int dill_ioltrim(struct iolist *first, size_t n, struct iolist *result) {
     while(n) {
         if(!first) return -1;
@@ -40,6 +40,11 @@ int dill_iolcheck(struct dill_iolist *first, struct dill_iolist *last,
    as such are not affected by this operation .*/
 void dill_ioltoiov(struct dill_iolist *first, struct iovec *iov);
 
+/* Same as above, but copies at most n buffers. Returns number of buffers
+   copied and sets *first to the next buffer to copy or to NULL if the whole
+   iolist was copied. */
+size_t dill_ioltoiovn(struct dill_iolist **first, struct iovec *iov, size_t n);
+
 /* Trims first n bytes from the iolist. Returns the trimmed iolist. Keeps the
    original iolist unchanged. Returns 0 in the case of success, -1 is there
    are less than N bytes in the original iolist. */
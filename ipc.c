@@ -48,19 +48,15 @@ static int dill_ipc_bsendl(struct dill_bsock_vfs *bvfs,
     struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
 static int dill_ipc_brecvl(struct dill_bsock_vfs *bvfs,
     struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
+static int dill_ipc_bflush(struct dill_bsock_vfs *bvfs, int64_t deadline);
+static ssize_t dill_ipc_brecvsomel(struct dill_bsock_vfs *bvfs,
+    struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
 
 struct dill_ipc_conn {
     struct dill_hvfs hvfs;
     struct dill_bsock_vfs bvfs;
-    int fd;
-    struct dill_fd_rxbuf rxbuf;
+    struct dill_fd_stream st;
     unsigned int scm_rights : 1;
-    unsigned int rbusy : 1;
-    unsigned int sbusy : 1;
-    unsigned int indone : 1;
-    unsigned int outdone : 1;
-    unsigned int inerr : 1;
-    unsigned int outerr : 1;
     unsigned int mem : 1;
 };
 
@@ -73,15 +69,18 @@ static int dill_ipc_makeconn(int fd, void *mem) {
     self->hvfs.close = dill_ipc_hclose;
     self->bvfs.bsendl = dill_ipc_bsendl;
     self->bvfs.brecvl = dill_ipc_brecvl;
-    self->fd = fd;
-    dill_fd_initrxbuf(&self->rxbuf);
+    self->bvfs.bflush = dill_ipc_bflush;
+    self->bvfs.brecvsomel = dill_ipc_brecvsomel;
+    self->st.fd = fd;
+    dill_fd_initrxbuf(&self->st.rxbuf);
+    self->st.txbuf = NULL;
     self->scm_rights = 1;
-    self->rbusy = 0;
-    self->sbusy = 0;
-    self->indone = 0;
-    self->outdone = 0;
-    self->inerr = 0;
-    self->outerr = 0;
+    self->st.rbusy = 0;
+    self->st.sbusy = 0;
+    self->st.indone = 0;
+    self->st.outdone = 0;
+    self->st.inerr = 0;
+    self->st.outerr = 0;
     self->mem = 1;
     /* Create the handle. */
     return dill_hmake(&self->hvfs);
@@ -91,6 +90,7 @@ static void *dill_ipc_hquery(struct dill_hvfs *hvfs, const void *type) {
     struct dill_ipc_conn *self = (struct dill_ipc_conn*)hvfs;
     if(type == dill_bsock_type) return &self->bvfs;
     if(type == dill_ipc_type) return self;
+    if(type == dill_fd_stream_type) return &self->st;
     errno = ENOTSUP;
     return NULL;
 }
@@ -178,31 +178,53 @@ error1:
 static int dill_ipc_bsendl(struct dill_bsock_vfs *bvfs,
       struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
     struct dill_ipc_conn *self = dill_cont(bvfs, struct dill_ipc_conn, bvfs);
-    if(dill_slow(self->sbusy)) {errno = EBUSY; return -1;}
-    if(dill_slow(self->outdone)) {errno = EPIPE; return -1;}
-    if(dill_slow(self->outerr)) {errno = ECONNRESET; return -1;}
-    self->sbusy = 1;
-    ssize_t sz = dill_fd_send(self->fd, first, last, deadline);
-    self->sbusy = 0;
+    if(dill_slow(self->st.sbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.outdone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.outerr)) {errno = ECONNRESET; return -1;}
+    self->st.sbusy = 1;
+    ssize_t sz = dill_fd_sendbuf(self->st.fd, self->st.txbuf, first, last,
+        deadline);
+    self->st.sbusy = 0;
     if(dill_fast(sz >= 0)) return sz;
-    self->outerr = 1;
+    self->st.outerr = 1;
+    return -1;
+}
+
+static int dill_ipc_bflush(struct dill_bsock_vfs *bvfs, int64_t deadline) {
+    struct dill_ipc_conn *self = dill_cont(bvfs, struct dill_ipc_conn, bvfs);
+    if(dill_slow(self->st.sbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.outdone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.outerr)) {errno = ECONNRESET; return -1;}
+    self->st.sbusy = 1;
+    int rc = dill_fd_flush(self->st.fd, self->st.txbuf, deadline);
+    self->st.sbusy = 0;
+    if(dill_fast(rc == 0)) return 0;
+    self->st.outerr = 1;
     return -1;
 }
 
 static int dill_ipc_brecvl(struct dill_bsock_vfs *bvfs,
       struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
     struct dill_ipc_conn *self = dill_cont(bvfs, struct dill_ipc_conn, bvfs);
-    if(dill_slow(self->rbusy)) {errno = EBUSY; return -1;}
-    if(dill_slow(self->indone)) {errno = EPIPE; return -1;}
-    if(dill_slow(self->inerr)) {errno = ECONNRESET; return -1;}
-    self->rbusy = 1;
+    if(dill_slow(self->st.rbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.indone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.inerr)) {errno = ECONNRESET; return -1;}
+    /* If the read is going to block, the peer may be waiting for the data
+       sitting in the transmit buffer. Send them first. If there's a send
+       in progress, the buffered data are being sent as a part of it. */
+    if(self->st.txbuf && self->st.txbuf->len && !self->st.sbusy &&
+          !self->st.outerr && !dill_fd_rxready(&self->st.rxbuf, first)) {
+        int rc = dill_ipc_bflush(&self->bvfs, deadline);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    self->st.rbusy = 1;
     /* If we want to use SCM_RIGHTS we can't do rx buffering. */
-    int rc = dill_fd_recv(self->fd, self->scm_rights ? NULL : &self->rxbuf,
-        first, last, deadline);
-    self->rbusy = 0;
+    int rc = dill_fd_recv(self->st.fd,
+        self->scm_rights ? NULL : &self->st.rxbuf, first, last, deadline);
+    self->st.rbusy = 0;
     if(dill_fast(rc == 0)) return 0;
-    if(errno == EPIPE) self->indone = 1;
-    else self->inerr = 1;
+    if(errno == EPIPE) self->st.indone = 1;
+    else self->st.inerr = 1;
     return -1;
 }
 
@@ -211,9 +233,9 @@ int dill_ipc_sendfd(int s, int fd, int64_t deadline) {
     if(dill_slow(!self)) return -1;
     if(dill_slow(!self->scm_rights)) {errno = ENOTSUP; return -1;}
     if(dill_slow(fd < 0)) {errno = EINVAL; return -1;}
-    if(dill_slow(self->sbusy)) {errno = EBUSY; return -1;}
-    if(dill_slow(self->outdone)) {errno = EPIPE; return -1;}
-    if(dill_slow(self->outerr)) {errno = ECONNRESET; return -1;}
+    if(dill_slow(self->st.sbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.outdone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.outerr)) {errno = ECONNRESET; return -1;}
     struct iovec iov;
     unsigned char buf[] = {0xcc};
     iov.iov_base = buf;
@@ -232,12 +254,15 @@ int dill_ipc_sendfd(int s, int fd, int64_t deadline) {
     cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
     *((int*)CMSG_DATA(cmsg)) = fd;
     msg.msg_controllen = cmsg->cmsg_len;
-    int rc = dill_fdout(self->fd, deadline);
+    /* The file descriptor must not overtake the buffered data. */
+    int rc = dill_ipc_bflush(&self->bvfs, deadline);
     if(dill_slow(rc < 0)) return -1;
-    ssize_t sz = sendmsg(self->fd, &msg, 0);
-    if(dill_slow(sz == 0)) {self->outdone = 1; errno = EPIPE; return -1;}
+    rc = dill_fdout(self->st.fd, deadline);
+    if(dill_slow(rc < 0)) return -1;
+    ssize_t sz = sendmsg(self->st.fd, &msg, 0);
+    if(dill_slow(sz == 0)) {self->st.outdone = 1; errno = EPIPE; return -1;}
     if(dill_slow(sz < 0)) {
-       if(errno == ECONNRESET) {self->outerr = 1; return -1;}
+       if(errno == ECONNRESET) {self->st.outerr = 1; return -1;}
        dill_assert(0);
     }
     return 0;
@@ -247,9 +272,9 @@ int dill_ipc_recvfd(int s, int64_t deadline) {
     struct dill_ipc_conn *self = dill_hquery(s, dill_ipc_type);
     if(dill_slow(!self)) return -1;
     if(dill_slow(!self->scm_rights)) {errno = ENOTSUP; return -1;}
-    if(dill_slow(self->rbusy)) {errno = EBUSY; return -1;}
-    if(dill_slow(self->indone)) {errno = EPIPE; return -1;}
-    if(dill_slow(self->inerr)) {errno = ECONNRESET; return -1;}
+    if(dill_slow(self->st.rbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.indone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.inerr)) {errno = ECONNRESET; return -1;}
     char buf[1];
     struct iovec iov;
     iov.iov_base = buf;
@@ -261,12 +286,12 @@ int dill_ipc_recvfd(int s, int64_t deadline) {
     unsigned char control[1024];
     msg.msg_control = control;
     msg.msg_controllen = sizeof(control);
-    int rc = dill_fdin(self->fd, deadline);
+    int rc = dill_fdin(self->st.fd, deadline);
     if(dill_slow(rc < 0)) return -1;
-    ssize_t sz = recvmsg(self->fd, &msg, 0);
-    if(dill_slow(sz == 0)) {self->indone = 1; errno = EPIPE; return -1;}
+    ssize_t sz = recvmsg(self->st.fd, &msg, 0);
+    if(dill_slow(sz == 0)) {self->st.indone = 1; errno = EPIPE; return -1;}
     if(dill_slow(sz < 0)) {
-       if(errno == ECONNRESET) {self->outerr = 1; return -1;}
+       if(errno == ECONNRESET) {self->st.outerr = 1; return -1;}
        dill_assert(0);
     }
     /* Loop over the auxiliary data to find the embedded file descriptor. */
@@ -279,24 +304,59 @@ int dill_ipc_recvfd(int s, int64_t deadline) {
         }
         cmsg = CMSG_NXTHDR(&msg, cmsg);
     }
-    if(dill_slow(fd < 0)) {self->inerr = 1; errno = EPROTO; return -1;}
+    if(dill_slow(fd < 0)) {self->st.inerr = 1; errno = EPROTO; return -1;}
     return fd;
 }
 
+static ssize_t dill_ipc_brecvsomel(struct dill_bsock_vfs *bvfs,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    struct dill_ipc_conn *self = dill_cont(bvfs, struct dill_ipc_conn, bvfs);
+    if(dill_slow(self->st.rbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.indone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.inerr)) {errno = ECONNRESET; return -1;}
+    /* See dill_ipc_brecvl(). Any buffered data will do here. */
+    if(self->st.txbuf && self->st.txbuf->len && !self->st.sbusy &&
+          !self->st.outerr && self->st.rxbuf.len == self->st.rxbuf.pos) {
+        int rc = dill_ipc_bflush(&self->bvfs, deadline);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    self->st.rbusy = 1;
+    ssize_t sz = dill_fd_recvsome(self->st.fd,
+        self->scm_rights ? NULL : &self->st.rxbuf, first, last, deadline);
+    self->st.rbusy = 0;
+    if(dill_fast(sz >= 0)) return sz;
+    if(errno == EPIPE) self->st.indone = 1;
+    else self->st.inerr = 1;
+    return -1;
+}
+
+int dill_ipc_cork(int s, size_t size) {
+    struct dill_ipc_conn *self = dill_hquery(s, dill_ipc_type);
+    if(dill_slow(!self)) return -1;
+    if(dill_slow(self->st.sbusy)) {errno = EBUSY; return -1;}
+    return dill_fd_settxbuf(&self->st.txbuf, size);
+}
+
 int dill_ipc_done(int s, int64_t deadline) {
     struct dill_ipc_conn *self = dill_hquery(s, dill_ipc_type);
     if(dill_slow(!self)) return -1;
-    if(dill_slow(self->outdone)) {errno = EPIPE; return -1;}
-    if(dill_slow(self->outerr)) {errno = ECONNRESET; return -1;}
-    /* Shutdown is done asynchronously on kernel level.
-       No need to use the deadline. */
-    int rc = shutdown(self->fd, SHUT_WR);
+    if(dill_slow(self->st.outdone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.outerr)) {errno = ECONNRESET; return -1;}
+    /* Hand the buffered data to the kernel. */
+    int rc = dill_ipc_bflush(&self->bvfs, deadline);
+    if(dill_slow(rc < 0)) return -1;
+    /* Shutdown is done asynchronously on kernel level. */
+    rc = shutdown(self->st.fd, SHUT_WR);
     if(dill_slow(rc < 0)) {
-        if(errno == ENOTCONN) {self->outerr = 1; errno = ECONNRESET; return -1;}
-        if(errno == ENOBUFS) {self->outerr = 1; errno = ENOMEM; return -1;}
+        if(errno == ENOTCONN) {
+            self->st.outerr = 1;
+            errno = ECONNRESET;
+            return -1;
+        }
+        if(errno == ENOBUFS) {self->st.outerr = 1; errno = ENOMEM; return -1;}
         dill_assert(0);
     }
-    self->outdone = 1;
+    self->st.outdone = 1;
     return 0;
 }
 
@@ -308,10 +368,13 @@ int dill_ipc_close(int s, int64_t deadline) {
     }
     struct dill_ipc_conn *self = dill_hquery(s, dill_ipc_type);
     if(dill_slow(!self)) return -1;
-    if(dill_slow(self->inerr || self->outerr)) {err = ECONNRESET; goto error;}
+    if(dill_slow(self->st.inerr || self->st.outerr)) {
+        err = ECONNRESET;
+        goto error;
+    }
     /* If not done already, flush the outbound data and start the terminal
        handshake. */
-    if(!self->outdone) {
+    if(!self->st.outdone) {
         int rc = dill_ipc_done(s, deadline);
         if(dill_slow(rc < 0)) {err = errno; goto error;}
     }
@@ -331,8 +394,9 @@ error:
 
 static void dill_ipc_hclose(struct dill_hvfs *hvfs) {
     struct dill_ipc_conn *self = (struct dill_ipc_conn*)hvfs;
-    dill_fd_close(self->fd);
-    dill_fd_termrxbuf(&self->rxbuf);
+    dill_fd_close(self->st.fd);
+    dill_fd_termrxbuf(&self->st.rxbuf);
+    dill_fd_termtxbuf(self->st.txbuf);
     if(!self->mem) free(self);
 }
 
@@ -463,9 +527,6 @@ int dill_ipc_accept_mem(int s, struct dill_ipc_storage *mem, int64_t deadline) {
     /* Try to get new connection in a non-blocking way. */
     int as = dill_fd_accept(lst->fd, NULL, NULL, deadline);
     if(dill_slow(as < 0)) {err = errno; goto error1;}
-    /* Set it to non-blocking mode. */
-    int rc = dill_fd_unblock(as);
-    if(dill_slow(rc < 0)) {err = errno; goto error2;}
     /* Create the handle. */
     int h = dill_ipc_makeconn(as, (struct dill_ipc_conn*)mem);
     if(dill_slow(h < 0)) {err = errno; goto error2;}
@@ -77,6 +77,24 @@ int dill_fdout(int fd, int64_t deadline) {
     return 0;
 }
 
+int dill_fderr(int fd, int64_t deadline) {
+    /* Return ECANCELED if shutting down. */
+    int rc = dill_canblock();
+    if(dill_slow(rc < 0)) return -1;
+    /* Start waiting for the fd. */
+    struct dill_fdclause fdcl;
+    rc = dill_pollset_err(&fdcl, 1, fd);
+    if(dill_slow(rc < 0)) return -1;
+    /* Optionally, start waiting for a timer. */
+    struct dill_tmclause tmcl;
+    dill_timer(&tmcl, 2, deadline);
+    /* Block. */
+    int id = dill_wait();
+    if(dill_slow(id < 0)) return -1;
+    if(dill_slow(id == 2)) {errno = ETIMEDOUT; return -1;}
+    return 0;
+}
+
 int dill_fdclean(int fd) {
     return dill_pollset_clean(fd);
 }
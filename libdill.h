@@ -27,9 +27,11 @@
 
 #include <errno.h>
 #include <setjmp.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 #if defined __linux__
@@ -332,6 +334,144 @@ DILL_EXPORT int dill_choose(
 #define choose dill_choose
 #endif
 
+/******************************************************************************/
+/*  Signals                                                                   */
+/******************************************************************************/
+
+struct dill_signal_storage {char _[288];} DILL_ALIGN;
+
+DILL_EXPORT int dill_signal_open(
+    const sigset_t *set);
+DILL_EXPORT int dill_signal_open_mem(
+    const sigset_t *set,
+    struct dill_signal_storage *mem);
+DILL_EXPORT int dill_signal_wait(
+    int s,
+    int64_t deadline);
+
+#if !defined DILL_DISABLE_RAW_NAMES
+#define signal_storage dill_signal_storage
+#define signal_open dill_signal_open
+#define signal_open_mem dill_signal_open_mem
+#define signal_wait dill_signal_wait
+#endif
+
+/******************************************************************************/
+/*  Events                                                                    */
+/*  Can be signaled from any thread, awaited in the thread that created them. */
+/******************************************************************************/
+
+struct dill_event_storage {char _[32];} DILL_ALIGN;
+
+DILL_EXPORT int dill_event_open_mem(
+    struct dill_event_storage *mem);
+DILL_EXPORT int dill_event_signal(
+    struct dill_event_storage *mem);
+DILL_EXPORT int dill_event_wait(
+    int h,
+    int64_t deadline);
+
+#if !defined DILL_DISABLE_RAW_NAMES
+#define event_storage dill_event_storage
+#define event_open_mem dill_event_open_mem
+#define event_signal dill_event_signal
+#define event_wait dill_event_wait
+#endif
+
+/******************************************************************************/
+/*  Busy polling                                                              */
+/*  Trades CPU time for latency. Applies to the calling thread only.          */
+/******************************************************************************/
+
+#define DILL_BUSYPOLL_SOCKETS 1
+
+DILL_EXPORT int dill_busypoll(
+    int us,
+    int flags);
+
+#if !defined DILL_DISABLE_RAW_NAMES
+#define BUSYPOLL_SOCKETS DILL_BUSYPOLL_SOCKETS
+#define busypoll dill_busypoll
+#endif
+
+/******************************************************************************/
+/*  Statistics                                                                */
+/*  Counters are maintained per thread. Gauges reflect the current state,     */
+/*  other counters are monotonically increasing.                              */
+/******************************************************************************/
+
+struct dill_stats {
+    /* Coroutines that were not deallocated yet (gauge). */
+    uint64_t coroutines;
+    /* Coroutines launched. */
+    uint64_t spawns;
+    /* Switches from one coroutine to another. */
+    uint64_t switches;
+    /* Coroutines ready to be executed (gauge). */
+    uint64_t ready;
+    /* Armed timers (gauge). */
+    uint64_t timers;
+    /* Timers that have expired. */
+    uint64_t timeouts;
+    /* Calls to epoll_wait(), kevent() or poll(). */
+    uint64_t polls;
+    /* File descriptor events reported by the above. */
+    uint64_t pollevents;
+    /* Changes made to the pollset, e.g. calls to epoll_ctl(). */
+    uint64_t pollchanges;
+    /* Waits satisfied by busy polling, i.e. without going to sleep. */
+    uint64_t busypolls;
+    /* Stack allocations served from the cache or from the heap. */
+    uint64_t stackhits;
+    uint64_t stackmisses;
+    /* Unused stacks in the cache (gauge). */
+    uint64_t stackcached;
+    /* Socket receive buffer allocations served from the cache or from
+       the heap. */
+    uint64_t rxbufhits;
+    uint64_t rxbufmisses;
+    /* Unused receive buffers in the cache (gauge). */
+    uint64_t rxbufcached;
+};
+
+DILL_EXPORT int dill_stats(
+    struct dill_stats *stats);
+
+/* Latency histograms. Values are in nanoseconds. Bucket 0 counts values
+   below 1024ns, bucket i values in range [2^(i+9), 2^(i+10)) and the last
+   bucket everything above that. */
+#define DILL_HISTOGRAM_BUCKETS 32
+
+struct dill_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[DILL_HISTOGRAM_BUCKETS];
+};
+
+struct dill_latency {
+    /* Time from detecting an external event or an expired timer to resuming
+       the coroutine that was waiting for it. */
+    struct dill_histogram wakeup;
+    /* Time spent running coroutines between two polls. Long times mean that
+       some coroutine is hogging the CPU. */
+    struct dill_histogram loop;
+};
+
+DILL_EXPORT int dill_latency_enable(
+    int enable);
+DILL_EXPORT int dill_latency(
+    struct dill_latency *latency,
+    int reset);
+
+#if !defined DILL_DISABLE_RAW_NAMES
+#define stats dill_stats
+#define HISTOGRAM_BUCKETS DILL_HISTOGRAM_BUCKETS
+#define histogram dill_histogram
+#define latency dill_latency
+#define latency_enable dill_latency_enable
+#endif
+
 #if !defined DILL_DISABLE_SOCKETS
 
 /******************************************************************************/
@@ -373,12 +513,41 @@ DILL_EXPORT int dill_brecvl(
     struct dill_iolist *first,
     struct dill_iolist *last,
     int64_t deadline);
+DILL_EXPORT int dill_bflush(
+    int s,
+    int64_t deadline);
+DILL_EXPORT ssize_t dill_brecvsome(
+    int s,
+    void *buf,
+    size_t len,
+    int64_t deadline);
+DILL_EXPORT ssize_t dill_brecvsomel(
+    int s,
+    struct dill_iolist *first,
+    struct dill_iolist *last,
+    int64_t deadline);
+DILL_EXPORT int dill_brelay(
+    int s1,
+    int s2,
+    uint64_t *nbytes,
+    int64_t deadline);
+DILL_EXPORT int dill_bsendfile(
+    int s,
+    int fd,
+    off_t offset,
+    size_t len,
+    int64_t deadline);
 
 #if !defined DILL_DISABLE_RAW_NAMES
 #define bsend dill_bsend
 #define brecv dill_brecv
 #define bsendl dill_bsendl
 #define brecvl dill_brecvl
+#define bflush dill_bflush
+#define brecvsome dill_brecvsome
+#define brecvsomel dill_brecvsomel
+#define brelay dill_brelay
+#define bsendfile dill_bsendfile
 #endif
 
 /******************************************************************************/
@@ -487,9 +656,24 @@ DILL_EXPORT int dill_ipaddr_equal(
 /*  TCP protocol.                                                             */
 /******************************************************************************/
 
-struct dill_tcp_listener_storage {char _[56];} DILL_ALIGN;
-
-struct dill_tcp_storage {char _[72];} DILL_ALIGN;
+struct dill_tcp_listener_storage {char _[64];} DILL_ALIGN;
+
+struct dill_tcp_storage {char _[112];} DILL_ALIGN;
+
+/* Socket options. Fields set to -1 are left unchanged. */
+struct dill_tcp_opts {
+    int nodelay;
+    int quickack;
+    int sndbuf;
+    int rcvbuf;
+    /* Seconds of inactivity before the first keepalive probe is sent.
+       Zero switches keepalives off. */
+    int keepidle;
+    int keepintvl;
+    int keepcnt;
+    /* Zero switches the watermark off. */
+    int notsent_lowat;
+};
 
 DILL_EXPORT int dill_tcp_listen(
     struct dill_ipaddr *addr,
@@ -498,6 +682,18 @@ DILL_EXPORT int dill_tcp_listen_mem(
     struct dill_ipaddr *addr,
     int backlog,
     struct dill_tcp_listener_storage *mem);
+DILL_EXPORT int dill_tcp_listen_reuseport(
+    struct dill_ipaddr *addr,
+    int backlog);
+DILL_EXPORT int dill_tcp_listen_reuseport_mem(
+    struct dill_ipaddr *addr,
+    int backlog,
+    struct dill_tcp_listener_storage *mem);
+DILL_EXPORT int dill_tcp_fastopen(
+    int s,
+    int qlen);
+DILL_EXPORT int dill_tcp_reuseport_cpu(
+    int s);
 DILL_EXPORT int dill_tcp_accept(
     int s,
     struct dill_ipaddr *addr,
@@ -507,6 +703,12 @@ DILL_EXPORT int dill_tcp_accept_mem(
     struct dill_ipaddr *addr,
     struct dill_tcp_storage *mem,
     int64_t deadline);
+DILL_EXPORT ssize_t dill_tcp_accept_many(
+    int s,
+    int *hs,
+    struct dill_ipaddr *addrs,
+    size_t count,
+    int64_t deadline);
 DILL_EXPORT int dill_tcp_connect(
     const struct dill_ipaddr *addr,
     int64_t deadline);
@@ -514,6 +716,28 @@ DILL_EXPORT int dill_tcp_connect_mem(
     const struct dill_ipaddr *addr,
     struct dill_tcp_storage *mem,
     int64_t deadline);
+DILL_EXPORT int dill_tcp_connectl(
+    const struct dill_ipaddr *addr,
+    struct dill_iolist *first,
+    struct dill_iolist *last,
+    int64_t deadline);
+DILL_EXPORT int dill_tcp_connectl_mem(
+    const struct dill_ipaddr *addr,
+    struct dill_iolist *first,
+    struct dill_iolist *last,
+    struct dill_tcp_storage *mem,
+    int64_t deadline);
+DILL_EXPORT int dill_tcp_cork(
+    int s,
+    size_t size);
+DILL_EXPORT void dill_tcp_opts_init(
+    struct dill_tcp_opts *opts);
+DILL_EXPORT int dill_tcp_setopts(
+    int s,
+    const struct dill_tcp_opts *opts);
+DILL_EXPORT int dill_tcp_zerocopy(
+    int s,
+    size_t threshold);
 DILL_EXPORT int dill_tcp_done(
     int s,
     int64_t deadline);
@@ -536,10 +760,22 @@ DILL_EXPORT int dill_tcp_fromfd_mem(
 #define tcp_storage dill_tcp_storage
 #define tcp_listen dill_tcp_listen
 #define tcp_listen_mem dill_tcp_listen_mem
+#define tcp_listen_reuseport dill_tcp_listen_reuseport
+#define tcp_listen_reuseport_mem dill_tcp_listen_reuseport_mem
+#define tcp_fastopen dill_tcp_fastopen
+#define tcp_reuseport_cpu dill_tcp_reuseport_cpu
 #define tcp_accept dill_tcp_accept
 #define tcp_accept_mem dill_tcp_accept_mem
+#define tcp_accept_many dill_tcp_accept_many
 #define tcp_connect dill_tcp_connect
 #define tcp_connect_mem dill_tcp_connect_mem
+#define tcp_connectl dill_tcp_connectl
+#define tcp_connectl_mem dill_tcp_connectl_mem
+#define tcp_cork dill_tcp_cork
+#define tcp_opts dill_tcp_opts
+#define tcp_opts_init dill_tcp_opts_init
+#define tcp_setopts dill_tcp_setopts
+#define tcp_zerocopy dill_tcp_zerocopy
 #define tcp_done dill_tcp_done
 #define tcp_close dill_tcp_close
 #define tcp_listener_fromfd dill_tcp_listener_fromfd
@@ -554,9 +790,9 @@ DILL_EXPORT int dill_tcp_fromfd_mem(
 
 struct dill_ipc_listener_storage {char _[24];} DILL_ALIGN;
 
-struct dill_ipc_storage {char _[72];} DILL_ALIGN;
+struct dill_ipc_storage {char _[96];} DILL_ALIGN;
 
-struct dill_ipc_pair_storage {char _[144];} DILL_ALIGN;
+struct dill_ipc_pair_storage {char _[192];} DILL_ALIGN;
 
 DILL_EXPORT int dill_ipc_listen(
     const char *addr,
@@ -586,6 +822,9 @@ DILL_EXPORT int dill_ipc_sendfd(
 DILL_EXPORT int dill_ipc_recvfd(
     int s,
     int64_t deadline);
+DILL_EXPORT int dill_ipc_cork(
+    int s,
+    size_t size);
 DILL_EXPORT int dill_ipc_done(
     int s,
     int64_t deadline);
@@ -620,6 +859,7 @@ DILL_EXPORT int dill_ipc_pair_mem(
 #define ipc_connect_mem dill_ipc_connect_mem
 #define ipc_sendfd dill_ipc_sendfd
 #define ipc_recvfd dill_ipc_recvfd
+#define ipc_cork dill_ipc_cork
 #define ipc_done dill_ipc_done
 #define ipc_close dill_ipc_close
 #define ipc_listener_fromfd dill_ipc_listener_fromfd
@@ -630,6 +870,56 @@ DILL_EXPORT int dill_ipc_pair_mem(
 #define ipc_pair_mem dill_ipc_pair_mem
 #endif
 
+/******************************************************************************/
+/*  FILE protocol.                                                            */
+/*  Regular files with blocking I/O offloaded to helper threads.              */
+/******************************************************************************/
+
+struct dill_file_storage {char _[144];} DILL_ALIGN;
+
+DILL_EXPORT int dill_file_open(
+    const char *path,
+    int flags,
+    mode_t mode,
+    int64_t deadline);
+DILL_EXPORT int dill_file_open_mem(
+    const char *path,
+    int flags,
+    mode_t mode,
+    struct dill_file_storage *mem,
+    int64_t deadline);
+DILL_EXPORT int dill_file_fromfd(
+    int fd);
+DILL_EXPORT int dill_file_fromfd_mem(
+    int fd,
+    struct dill_file_storage *mem);
+DILL_EXPORT ssize_t dill_file_pread(
+    int s,
+    void *buf,
+    size_t len,
+    int64_t offset,
+    int64_t deadline);
+DILL_EXPORT int dill_file_pwrite(
+    int s,
+    const void *buf,
+    size_t len,
+    int64_t offset,
+    int64_t deadline);
+DILL_EXPORT int dill_file_sync(
+    int s,
+    int64_t deadline);
+
+#if !defined DILL_DISABLE_RAW_NAMES
+#define file_storage dill_file_storage
+#define file_open dill_file_open
+#define file_open_mem dill_file_open_mem
+#define file_fromfd dill_file_fromfd
+#define file_fromfd_mem dill_file_fromfd_mem
+#define file_pread dill_file_pread
+#define file_pwrite dill_file_pwrite
+#define file_sync dill_file_sync
+#endif
+
 /******************************************************************************/
 /*  PREFIX protocol.                                                          */
 /*  Messages are prefixed by size.                                            */
@@ -695,6 +985,18 @@ DILL_EXPORT int dill_suffix_detach(
 
 struct dill_udp_storage {char _[72];} DILL_ALIGN;
 
+/* A datagram sent by udp_sendv() or received by udp_recvv(). */
+struct dill_udp_msg {
+    /* Destination address or NULL to use the remote address of the socket.
+       When receiving, filled in with the source address, unless NULL. */
+    struct dill_ipaddr *addr;
+    void *buf;
+    /* Size of the datagram to send or size of the receive buffer. */
+    size_t len;
+    /* Filled in with the size of the received datagram. */
+    size_t nbytes;
+};
+
 DILL_EXPORT int dill_udp_open(
     struct dill_ipaddr *local,
     const struct dill_ipaddr *remote);
@@ -702,6 +1004,8 @@ DILL_EXPORT int dill_udp_open_mem(
     struct dill_ipaddr *local,
     const struct dill_ipaddr *remote,
     struct dill_udp_storage *mem);
+DILL_EXPORT int dill_udp_connect(
+    int s);
 DILL_EXPORT int dill_udp_send(
     int s,
     const struct dill_ipaddr *addr,
@@ -724,15 +1028,47 @@ DILL_EXPORT ssize_t dill_udp_recvl(
     struct dill_iolist *first,
     struct dill_iolist *last,
     int64_t deadline);
+DILL_EXPORT int dill_udp_sendv(
+    int s,
+    struct dill_udp_msg *msgs,
+    size_t count);
+DILL_EXPORT ssize_t dill_udp_recvv(
+    int s,
+    struct dill_udp_msg *msgs,
+    size_t count,
+    int64_t deadline);
+DILL_EXPORT int dill_udp_sendseg(
+    int s,
+    const struct dill_ipaddr *addr,
+    const void *buf,
+    size_t len,
+    size_t segsize);
+DILL_EXPORT ssize_t dill_udp_recvseg(
+    int s,
+    struct dill_ipaddr *addr,
+    void *buf,
+    size_t len,
+    size_t *segsize,
+    int64_t deadline);
+DILL_EXPORT int dill_udp_gro(
+    int s,
+    int enable);
 
 #if !defined DILL_DISABLE_RAW_NAMES
 #define udp_storage dill_udp_storage
 #define udp_open dill_udp_open
 #define udp_open_mem dill_udp_open_mem
+#define udp_connect dill_udp_connect
 #define udp_send dill_udp_send
 #define udp_recv dill_udp_recv
 #define udp_sendl dill_udp_sendl
 #define udp_recvl dill_udp_recvl
+#define udp_msg dill_udp_msg
+#define udp_sendv dill_udp_sendv
+#define udp_recvv dill_udp_recvv
+#define udp_sendseg dill_udp_sendseg
+#define udp_recvseg dill_udp_recvseg
+#define udp_gro dill_udp_gro
 #endif
 
 /******************************************************************************/
@@ -807,7 +1143,7 @@ DILL_EXPORT int dill_http_recvfield(
 /*  TLS protocol.                                                             */
 /******************************************************************************/
 
-struct dill_tls_storage {char _[72];} DILL_ALIGN;
+struct dill_tls_storage {char _[80];} DILL_ALIGN;
 
 DILL_EXPORT int dill_tls_attach_server(
     int s,
@@ -1113,6 +1449,40 @@ DILL_EXPORT int dill_happyeyeballs_connect(
 #define happyeyeballs_connect dill_happyeyeballs_connect
 #endif
 
+/******************************************************************************/
+/*  TCP connection pool.                                                      */
+/*  Hands out idle connections to the same destination instead of opening     */
+/*  new ones.                                                                 */
+/******************************************************************************/
+
+#define DILL_TCP_POOL_TLS 1
+
+DILL_EXPORT int dill_tcp_pool(
+    size_t max,
+    int64_t idle,
+    int flags);
+DILL_EXPORT int dill_tcp_pool_connect(
+    int p,
+    const struct dill_ipaddr *addr,
+    int64_t deadline);
+DILL_EXPORT int dill_tcp_pool_connect_name(
+    int p,
+    const char *name,
+    int port,
+    int64_t deadline);
+DILL_EXPORT int dill_tcp_pool_release(
+    int p,
+    int s,
+    int reuse);
+
+#if !defined DILL_DISABLE_RAW_NAMES
+#define TCP_POOL_TLS DILL_TCP_POOL_TLS
+#define tcp_pool dill_tcp_pool
+#define tcp_pool_connect dill_tcp_pool_connect
+#define tcp_pool_connect_name dill_tcp_pool_connect_name
+#define tcp_pool_release dill_tcp_pool_release
+#endif
+
 #endif
 
 #ifdef __cplusplus
@@ -58,6 +58,11 @@ struct dill_bsock_vfs {
         struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
     int (*brecvl)(struct dill_bsock_vfs *vfs,
         struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
+    /* Optional. If NULL, bflush() succeeds without doing anything. */
+    int (*bflush)(struct dill_bsock_vfs *vfs, int64_t deadline);
+    /* Optional. If NULL, brecvsome() and brecvsomel() fail with ENOTSUP. */
+    ssize_t (*brecvsomel)(struct dill_bsock_vfs *vfs,
+        struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
 };
 
 #if !defined DILL_DISABLE_RAW_NAMES
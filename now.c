@@ -69,6 +69,26 @@ int64_t dill_mnow(void) {
 #endif
 }
 
+int64_t dill_nsnow(void) {
+#if defined __APPLE__
+    static mach_timebase_info_data_t dill_mtid = {0};
+    if (dill_slow(!dill_mtid.denom))
+        mach_timebase_info(&dill_mtid);
+    uint64_t ticks = mach_absolute_time();
+    return (int64_t)(ticks * dill_mtid.numer / dill_mtid.denom);
+#elif defined CLOCK_MONOTONIC
+    struct timespec ts;
+    int rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+    dill_assert (rc == 0);
+    return ((int64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+    int rc = gettimeofday(&tv, NULL);
+    dill_assert (rc == 0);
+    return ((int64_t)tv.tv_sec) * 1000000000 + ((int64_t)tv.tv_usec) * 1000;
+#endif
+}
+
 /* Like now(), this function can be called only after context is initialized
    but unlike now() it doesn't do time caching. */
 static int64_t dill_now_(void) {
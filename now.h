@@ -48,5 +48,9 @@ void dill_ctx_now_term(struct dill_ctx_now *ctx);
    I.e. it can be called before calling dill_ctx_now_init(). */
 int64_t dill_mnow(void);
 
+/* Monotonic time in nanoseconds. Not cached, so it's more expensive than
+   dill_now(). */
+int64_t dill_nsnow(void);
+
 #endif
 
@@ -0,0 +1,284 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../libdill.h"
+#include "bench.h"
+
+/* Benchmark driver. Runs the selected workloads, each of them 'reps' times
+   after 'warmup' unrecorded samples, and prints latency percentiles either
+   as a human-readable table or as JSON. Individual samples are timed with
+   the monotonic clock; the average cost of reading the clock is measured
+   up front and subtracted from each sample. */
+
+static const struct bench_workload *bench_tables[] = {
+    bench_core,
+#if defined DILL_SOCKETS
+    bench_net,
+#endif
+    NULL
+};
+
+/* Number of log2-sized histogram buckets. Bucket i holds samples in range
+   [2^(i-1), 2^i) nanoseconds. */
+#define BENCH_BUCKETS 48
+
+struct bench_result {
+    long nsamples;
+    double mean;
+    double min;
+    double max;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double opspersec;
+    double bytespersec;
+    /* Mean duration of an operation in each repetition. */
+    double *repmeans;
+    int reps;
+    long hist[BENCH_BUCKETS];
+};
+
+static int64_t bench_overhead = 0;
+
+static int bench_cmp(const void *a, const void *b) {
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Measures the cost of a bench_begin()/bench_end() pair. */
+static void bench_calibrate(void) {
+    int64_t samples[1001];
+    int i;
+    for(i = 0; i != 1001; ++i) {
+        int64_t start = bench_now();
+        samples[i] = bench_now() - start;
+    }
+    qsort(samples, 1001, sizeof(int64_t), bench_cmp);
+    bench_overhead = samples[500];
+}
+
+static double bench_percentile(int64_t *sorted, long n, double p) {
+    long i = (long)(p * (n - 1) + 0.5);
+    return (double)sorted[i];
+}
+
+static int bench_bucket(int64_t val) {
+    int i = 0;
+    while(val > 0 && i < BENCH_BUCKETS - 1) {
+        val >>= 1;
+        i++;
+    }
+    return i;
+}
+
+static int bench_run(const struct bench_workload *w, long count, long warmup,
+      int reps, struct bench_result *res) {
+    struct bench b;
+    memset(&b, 0, sizeof(b));
+    memset(res, 0, sizeof(struct bench_result));
+    b.workload = w;
+    b.capacity = count * reps;
+    b.samples = malloc(b.capacity * sizeof(int64_t));
+    res->repmeans = malloc(reps * sizeof(double));
+    if(!b.samples || !res->repmeans) {errno = ENOMEM; goto error;}
+    if(w->setup && w->setup(&b) < 0) goto error;
+    b.recording = 0;
+    if(warmup > 0 && w->run(&b, warmup) < 0) goto error;
+    b.recording = 1;
+    b.bytes = 0;
+    int64_t elapsed = 0;
+    int i;
+    for(i = 0; i != reps; ++i) {
+        long first = b.nsamples;
+        int64_t start = bench_now();
+        if(w->run(&b, count) < 0) goto error;
+        elapsed += bench_now() - start;
+        int64_t sum = 0;
+        long j;
+        for(j = first; j != b.nsamples; ++j) {
+            b.samples[j] -= bench_overhead;
+            if(b.samples[j] < 0) b.samples[j] = 0;
+            sum += b.samples[j];
+        }
+        res->repmeans[i] = b.nsamples == first ? 0.0 :
+            (double)sum / (b.nsamples - first) / w->ops;
+        res->reps++;
+    }
+    if(w->teardown) w->teardown(&b);
+    long n = b.nsamples;
+    res->nsamples = n;
+    if(n > 0) {
+        int64_t sum = 0;
+        long j;
+        for(j = 0; j != n; ++j) {
+            sum += b.samples[j];
+            res->hist[bench_bucket(b.samples[j])]++;
+        }
+        qsort(b.samples, n, sizeof(int64_t), bench_cmp);
+        double ops = (double)w->ops;
+        res->mean = (double)sum / n / ops;
+        res->min = b.samples[0] / ops;
+        res->max = b.samples[n - 1] / ops;
+        res->p50 = bench_percentile(b.samples, n, 0.50) / ops;
+        res->p90 = bench_percentile(b.samples, n, 0.90) / ops;
+        res->p99 = bench_percentile(b.samples, n, 0.99) / ops;
+        res->p999 = bench_percentile(b.samples, n, 0.999) / ops;
+    }
+    if(elapsed > 0) {
+        res->opspersec = (double)n * w->ops * 1e9 / elapsed;
+        res->bytespersec = (double)b.bytes * 1e9 / elapsed;
+    }
+    free(b.samples);
+    return 0;
+error:
+    if(b.state && w->teardown) w->teardown(&b);
+    free(b.samples);
+    free(res->repmeans);
+    res->repmeans = NULL;
+    return -1;
+}
+
+static void bench_print_text(const struct bench_workload *w,
+      const struct bench_result *res) {
+    printf("%-24s %10.1f %10.1f %10.1f %10.1f %10.1f %12.0f  ns/%s\n",
+        w->name, res->mean, res->p50, res->p99, res->p999, res->max,
+        res->opspersec, w->op);
+}
+
+static void bench_print_json(const struct bench_workload *w,
+      const struct bench_result *res, int first) {
+    printf("%s\n    {\"name\": \"%s\", \"op\": \"%s\", "
+        "\"ops_per_sample\": %ld, \"samples\": %ld,\n"
+        "     \"mean_ns\": %.2f, \"min_ns\": %.2f, \"max_ns\": %.2f, "
+        "\"p50_ns\": %.2f, \"p90_ns\": %.2f, \"p99_ns\": %.2f, "
+        "\"p999_ns\": %.2f,\n"
+        "     \"ops_per_sec\": %.2f, \"bytes_per_sec\": %.2f,\n"
+        "     \"rep_mean_ns\": [",
+        first ? "" : ",", w->name, w->op, w->ops, res->nsamples,
+        res->mean, res->min, res->max, res->p50, res->p90, res->p99,
+        res->p999, res->opspersec, res->bytespersec);
+    int i;
+    for(i = 0; i != res->reps; ++i)
+        printf("%s%.2f", i ? ", " : "", res->repmeans[i]);
+    /* Histogram is reported in raw sample durations, i.e. not divided by
+       the number of operations per sample. */
+    printf("],\n     \"histogram\": [");
+    int sep = 0;
+    for(i = 0; i != BENCH_BUCKETS; ++i) {
+        if(!res->hist[i]) continue;
+        printf("%s[%lld, %ld]", sep ? ", " : "",
+            i == 0 ? 0LL : (long long)1 << i, res->hist[i]);
+        sep = 1;
+    }
+    printf("]}");
+}
+
+static int bench_selected(const char *name, int argc, char *argv[]) {
+    if(argc == 0) return 1;
+    int i;
+    for(i = 0; i != argc; ++i)
+        if(strcmp(name, argv[i]) == 0) return 1;
+    return 0;
+}
+
+static void bench_usage(void) {
+    fprintf(stderr, "usage: bench [-j] [-l] [-r <repetitions>] "
+        "[-w <warmup-samples>] [-n <samples>] [<benchmark>...]\n"
+        "  -j  print results as JSON\n"
+        "  -l  list available benchmarks\n"
+        "  -r  number of repetitions (default: 5)\n"
+        "  -w  number of unrecorded warmup samples (default: 10%% of -n)\n"
+        "  -n  number of samples per repetition "
+            "(default: benchmark-specific)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int json = 0;
+    int list = 0;
+    int reps = 5;
+    long warmup = -1;
+    long count = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "jlr:w:n:h")) != -1) {
+        switch(opt) {
+        case 'j': json = 1; break;
+        case 'l': list = 1; break;
+        case 'r': reps = atoi(optarg); break;
+        case 'w': warmup = atol(optarg); break;
+        case 'n': count = atol(optarg); break;
+        default: bench_usage(); return 1;
+        }
+    }
+    if(reps <= 0 || count < 0) {bench_usage(); return 1;}
+    argc -= optind;
+    argv += optind;
+    const struct bench_workload **t;
+    const struct bench_workload *w;
+    if(list) {
+        for(t = bench_tables; *t; ++t)
+            for(w = *t; w->name; ++w)
+                printf("%-24s ns/%s\n", w->name, w->op);
+        return 0;
+    }
+    bench_calibrate();
+    if(json)
+        printf("{\"reps\": %d, \"clock_overhead_ns\": %lld,\n"
+            "  \"benchmarks\": [", reps, (long long)bench_overhead);
+    else
+        printf("%-24s %10s %10s %10s %10s %10s %12s\n", "benchmark", "mean",
+            "p50", "p99", "p99.9", "max", "ops/s");
+    int first = 1;
+    int failed = 0;
+    for(t = bench_tables; *t; ++t) {
+        for(w = *t; w->name; ++w) {
+            if(!bench_selected(w->name, argc, argv)) continue;
+            long n = count ? count : w->count;
+            long wu = warmup >= 0 ? warmup : n / 10;
+            struct bench_result res;
+            int rc = bench_run(w, n, wu, reps, &res);
+            if(rc < 0) {
+                fprintf(stderr, "%s: %s\n", w->name, strerror(errno));
+                failed = 1;
+                continue;
+            }
+            if(json) bench_print_json(w, &res, first);
+            else bench_print_text(w, &res);
+            fflush(stdout);
+            free(res.repmeans);
+            first = 0;
+        }
+    }
+    if(json) printf("\n  ]\n}\n");
+    return failed;
+}
+
@@ -0,0 +1,98 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+
+/* Benchmark harness shared by all the workloads run by perf/bench.
+
+   A workload consists of optional setup and teardown functions and of a run
+   function that performs 'count' samples. Each sample is timed by calling
+   bench_begin() and bench_end(). A sample may consist of multiple operations
+   (e.g. a message passed through a chain of coroutines), in which case
+   the workload sets 'ops' so that the results are reported per operation. */
+
+struct bench;
+
+struct bench_workload {
+    /* Name used on the command line and in the output. */
+    const char *name;
+    /* Human-readable description of a single operation. */
+    const char *op;
+    /* Number of operations per sample. */
+    long ops;
+    /* Default number of samples per repetition. */
+    long count;
+    int (*setup)(struct bench *b);
+    int (*run)(struct bench *b, long count);
+    void (*teardown)(struct bench *b);
+};
+
+struct bench {
+    const struct bench_workload *workload;
+    /* Workload-specific state. */
+    void *state;
+    /* Collected samples, in nanoseconds. */
+    int64_t *samples;
+    long nsamples;
+    long capacity;
+    /* Set to 0 during warmup; samples are not recorded then. */
+    int recording;
+    int64_t start;
+    /* Number of bytes transferred by the workload, if applicable. */
+    uint64_t bytes;
+};
+
+static inline int64_t bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static inline void bench_begin(struct bench *b) {
+    b->start = bench_now();
+}
+
+/* Records a sample measured by the workload itself. Useful when multiple
+   coroutines are timing their samples concurrently. */
+static inline void bench_record(struct bench *b, int64_t elapsed) {
+    if(b->recording && b->nsamples < b->capacity)
+        b->samples[b->nsamples++] = elapsed;
+}
+
+static inline void bench_end(struct bench *b) {
+    bench_record(b, bench_now() - b->start);
+}
+
+/* Workload tables. Each of them is terminated by an entry with NULL name. */
+extern const struct bench_workload bench_core[];
+#if defined DILL_SOCKETS
+extern const struct bench_workload bench_net[];
+#endif
+
+#endif
+
@@ -0,0 +1,309 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "../libdill.h"
+#include "bench.h"
+
+/* Workloads equivalent to the standalone programs in this directory. */
+
+struct bench_core {
+    int bndl;
+    int ch[2];
+    int *chs;
+    long nchs;
+};
+
+static int bench_core_setup(struct bench *b) {
+    struct bench_core *self = calloc(1, sizeof(struct bench_core));
+    if(!self) return -1;
+    self->bndl = bundle();
+    if(self->bndl < 0) {free(self); return -1;}
+    self->ch[0] = self->ch[1] = -1;
+    b->state = self;
+    return 0;
+}
+
+static void bench_core_teardown(struct bench *b) {
+    struct bench_core *self = b->state;
+    /* Cancels all the worker coroutines. */
+    hclose(self->bndl);
+    if(self->ch[0] >= 0) hclose(self->ch[0]);
+    if(self->ch[1] >= 0) hclose(self->ch[1]);
+    long i;
+    for(i = 0; i != self->nchs; ++i) hclose(self->chs[i]);
+    free(self->chs);
+    free(self);
+}
+
+/******************************************************************************/
+/*  ctxswitch                                                                 */
+/******************************************************************************/
+
+static coroutine void ctxswitch_worker(void) {
+    while(1) {
+        int rc = yield();
+        if(rc < 0) return;
+    }
+}
+
+static int ctxswitch_setup(struct bench *b) {
+    if(bench_core_setup(b) < 0) return -1;
+    struct bench_core *self = b->state;
+    return bundle_go(self->bndl, ctxswitch_worker());
+}
+
+static int ctxswitch_run(struct bench *b, long count) {
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int rc = yield();
+        bench_end(b);
+        if(rc < 0) return -1;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/*  chan                                                                      */
+/******************************************************************************/
+
+static coroutine void chan_worker(int ch) {
+    int val;
+    while(1) {
+        int rc = chrecv(ch, &val, sizeof(val), -1);
+        if(rc < 0) return;
+        rc = chsend(ch, &val, sizeof(val), -1);
+        if(rc < 0) return;
+    }
+}
+
+static int chan_setup(struct bench *b) {
+    if(bench_core_setup(b) < 0) return -1;
+    struct bench_core *self = b->state;
+    int rc = chmake(self->ch);
+    if(rc < 0) return -1;
+    return bundle_go(self->bndl, chan_worker(self->ch[0]));
+}
+
+static int chan_run(struct bench *b, long count) {
+    struct bench_core *self = b->state;
+    int val = 0;
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int rc = chsend(self->ch[1], &val, sizeof(val), -1);
+        if(rc < 0) return -1;
+        rc = chrecv(self->ch[1], &val, sizeof(val), -1);
+        if(rc < 0) return -1;
+        bench_end(b);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/*  choose                                                                    */
+/******************************************************************************/
+
+static int choose_run(struct bench *b, long count) {
+    struct bench_core *self = b->state;
+    int val = 0;
+    long i;
+    for(i = 0; i != count; ++i) {
+        struct chclause clsout[] = {{CHSEND, self->ch[1], &val, sizeof(val)}};
+        struct chclause clsin[] = {{CHRECV, self->ch[1], &val, sizeof(val)}};
+        bench_begin(b);
+        int rc = choose(clsout, 1, -1);
+        if(rc < 0) return -1;
+        rc = choose(clsin, 1, -1);
+        if(rc < 0) return -1;
+        bench_end(b);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/*  go                                                                        */
+/******************************************************************************/
+
+static coroutine void go_worker(void) {
+}
+
+static int go_run(struct bench *b, long count) {
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int h = go(go_worker());
+        if(h < 0) return -1;
+        hclose(h);
+        bench_end(b);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/*  done                                                                      */
+/******************************************************************************/
+
+static coroutine void done_worker(int ch) {
+    int val;
+    while(1) {
+        int rc = chrecv(ch, &val, sizeof(val), -1);
+        if(rc == -1 && errno == EPIPE)
+            return;
+    }
+}
+
+static int done_run(struct bench *b, long count) {
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int ch[2];
+        int rc = chmake(ch);
+        if(rc < 0) return -1;
+        int h = go(done_worker(ch[0]));
+        if(h < 0) return -1;
+        chdone(ch[1]);
+        hclose(h);
+        hclose(ch[1]);
+        hclose(ch[0]);
+        bench_end(b);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/*  whispers                                                                  */
+/******************************************************************************/
+
+#define WHISPERS_COUNT 1000
+
+static coroutine void whispers_worker(int left, int right) {
+    int val;
+    while(1) {
+        int rc = chrecv(right, &val, sizeof(val), -1);
+        if(rc < 0) return;
+        val++;
+        rc = chsend(left, &val, sizeof(val), -1);
+        if(rc < 0) return;
+    }
+}
+
+static int whispers_setup(struct bench *b) {
+    if(bench_core_setup(b) < 0) return -1;
+    struct bench_core *self = b->state;
+    self->chs = calloc(WHISPERS_COUNT * 2, sizeof(int));
+    if(!self->chs) return -1;
+    long i;
+    for(i = 0; i != WHISPERS_COUNT; ++i) {
+        int rc = chmake(&self->chs[i * 2]);
+        if(rc < 0) return -1;
+        self->nchs += 2;
+    }
+    /* Coroutine i reads from channel i and writes to channel i + 1. */
+    for(i = 0; i != WHISPERS_COUNT - 1; ++i) {
+        int rc = bundle_go(self->bndl, whispers_worker(
+            self->chs[(i + 1) * 2], self->chs[i * 2 + 1]));
+        if(rc < 0) return -1;
+    }
+    return 0;
+}
+
+static int whispers_run(struct bench *b, long count) {
+    struct bench_core *self = b->state;
+    int first = self->chs[0];
+    int last = self->chs[(WHISPERS_COUNT - 1) * 2 + 1];
+    long i;
+    for(i = 0; i != count; ++i) {
+        int val = 0;
+        bench_begin(b);
+        int rc = chsend(first, &val, sizeof(val), -1);
+        if(rc < 0) return -1;
+        rc = chrecv(last, &val, sizeof(val), -1);
+        if(rc < 0) return -1;
+        bench_end(b);
+        if(val != WHISPERS_COUNT - 1) {errno = EPROTO; return -1;}
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/*  timer                                                                     */
+/******************************************************************************/
+
+#define TIMER_COUNT 1000
+
+/* Keeps a timer armed, so that the timer tree is populated while
+   the benchmark is running. */
+static coroutine void timer_worker(int64_t deadline) {
+    msleep(deadline);
+}
+
+static int timer_setup(struct bench *b) {
+    if(bench_core_setup(b) < 0) return -1;
+    struct bench_core *self = b->state;
+    int64_t nw = now();
+    long i;
+    for(i = 0; i != TIMER_COUNT; ++i) {
+        int rc = bundle_go(self->bndl,
+            timer_worker(nw + 3600000 + (rand() % 1000)));
+        if(rc < 0) return -1;
+    }
+    /* Let all the workers arm their timers. */
+    return yield();
+}
+
+static int timer_run(struct bench *b, long count) {
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        /* The deadline has already expired so the timer is armed and fired
+           straight away. */
+        int rc = msleep(now() - 1);
+        bench_end(b);
+        if(rc < 0) return -1;
+    }
+    return 0;
+}
+
+const struct bench_workload bench_core[] = {
+    {"ctxswitch", "context switch", 2, 1000000,
+        ctxswitch_setup, ctxswitch_run, bench_core_teardown},
+    {"chan", "message pass", 2, 1000000,
+        chan_setup, chan_run, bench_core_teardown},
+    {"choose", "message pass", 2, 1000000,
+        chan_setup, choose_run, bench_core_teardown},
+    {"go", "coroutine creation+termination", 1, 1000000,
+        bench_core_setup, go_run, bench_core_teardown},
+    {"done", "coroutine/channel cancellation", 1, 1000000,
+        bench_core_setup, done_run, bench_core_teardown},
+    {"whispers", "message pass", WHISPERS_COUNT, 1000,
+        whispers_setup, whispers_run, bench_core_teardown},
+    {"timer", "timer arm+fire", 1, 100000,
+        timer_setup, timer_run, bench_core_teardown},
+    {NULL}
+};
+
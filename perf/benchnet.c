@@ -0,0 +1,687 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "../libdill.h"
+#include "bench.h"
+
+/* Networking workloads. Both peers live in the same thread and talk to each
+   other over the loopback interface or over UNIX domain socket pairs. */
+
+#if !defined BENCH_CERTDIR
+#define BENCH_CERTDIR "tests"
+#endif
+
+/* Size of a message in the echo and message-based workloads. */
+#define ECHO_SIZE 64
+/* Size of a block in the bulk transfer workloads. */
+#define BULK_SIZE 65536
+
+struct bench_net {
+    /* Long-lived peer coroutines. */
+    int servers;
+    /* Coroutines started by a single run of the workload. */
+    int clients;
+    /* Client and server ends of the connections. */
+    int *c;
+    int *s;
+    long nconns;
+    long capacity;
+    /* UDP sockets and address of the receiver. */
+    struct ipaddr addr;
+    char *buf;
+};
+
+static int bench_net_setup(struct bench *b, long capacity) {
+    struct bench_net *self = calloc(1, sizeof(struct bench_net));
+    if(!self) return -1;
+    b->state = self;
+    self->clients = -1;
+    self->servers = bundle();
+    if(self->servers < 0) return -1;
+    self->clients = bundle();
+    if(self->clients < 0) return -1;
+    self->c = calloc(capacity, sizeof(int));
+    self->s = calloc(capacity, sizeof(int));
+    self->buf = calloc(1, BULK_SIZE);
+    if(!self->c || !self->s || !self->buf) return -1;
+    self->capacity = capacity;
+    return 0;
+}
+
+static void bench_net_teardown(struct bench *b) {
+    struct bench_net *self = b->state;
+    if(self->clients >= 0) hclose(self->clients);
+    if(self->servers >= 0) hclose(self->servers);
+    long i;
+    for(i = 0; i != self->nconns; ++i) {
+        if(self->c[i] >= 0) hclose(self->c[i]);
+        if(self->s[i] >= 0) hclose(self->s[i]);
+    }
+    free(self->c);
+    free(self->s);
+    free(self->buf);
+    free(self);
+}
+
+/* Makes sure there are enough file descriptors for 'count' connections. */
+static int bench_net_fds(long count) {
+    struct rlimit rl;
+    int rc = getrlimit(RLIMIT_NOFILE, &rl);
+    if(rc < 0) return -1;
+    rlim_t need = count * 2 + 64;
+    if(rl.rlim_cur >= need) return 0;
+    rl.rlim_cur = need;
+    if(rl.rlim_max < need) rl.rlim_max = need;
+    return setrlimit(RLIMIT_NOFILE, &rl);
+}
+
+static int bench_tcp_connect(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    int rc = bench_net_fds(count);
+    if(rc < 0) return -1;
+    struct ipaddr addr;
+    rc = ipaddr_local(&addr, "127.0.0.1", 0, IPADDR_IPV4);
+    if(rc < 0) return -1;
+    int ls = tcp_listen(&addr, 128);
+    if(ls < 0) return -1;
+    long i;
+    for(i = 0; i != count; ++i) {
+        /* The handshake is done by the kernel, so there's no need
+           to accept in parallel. */
+        int c = tcp_connect(&addr, -1);
+        if(c < 0) break;
+        int s = tcp_accept(ls, NULL, -1);
+        if(s < 0) {hclose(c); break;}
+        self->c[self->nconns] = c;
+        self->s[self->nconns] = s;
+        self->nconns++;
+    }
+    int err = errno;
+    hclose(ls);
+    if(i != count) {errno = err; return -1;}
+    return 0;
+}
+
+static int bench_ipc_connect(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    int rc = bench_net_fds(count);
+    if(rc < 0) return -1;
+    long i;
+    for(i = 0; i != count; ++i) {
+        int p[2];
+        rc = ipc_pair(p);
+        if(rc < 0) return -1;
+        self->c[self->nconns] = p[0];
+        self->s[self->nconns] = p[1];
+        self->nconns++;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/*  Echo: round-trip latency over 1, 100 and 10k connections.                 */
+/******************************************************************************/
+
+static coroutine void echo_server(int s) {
+    char buf[ECHO_SIZE];
+    while(1) {
+        int rc = brecv(s, buf, sizeof(buf), -1);
+        if(rc < 0) return;
+        rc = bsend(s, buf, sizeof(buf), -1);
+        if(rc < 0) return;
+    }
+}
+
+static coroutine void echo_client(struct bench *b, int s, long count) {
+    char buf[ECHO_SIZE];
+    memset(buf, 'x', sizeof(buf));
+    long i;
+    for(i = 0; i != count; ++i) {
+        int64_t start = bench_now();
+        int rc = bsend(s, buf, sizeof(buf), -1);
+        if(rc < 0) return;
+        rc = brecv(s, buf, sizeof(buf), -1);
+        if(rc < 0) return;
+        bench_record(b, bench_now() - start);
+        b->bytes += 2 * ECHO_SIZE;
+    }
+}
+
+static int echo_setup(struct bench *b, long conns, int tcp) {
+    int rc = bench_net_setup(b, conns);
+    if(rc < 0) return -1;
+    rc = tcp ? bench_tcp_connect(b, conns) : bench_ipc_connect(b, conns);
+    if(rc < 0) return -1;
+    struct bench_net *self = b->state;
+    long i;
+    for(i = 0; i != conns; ++i) {
+        rc = bundle_go(self->servers, echo_server(self->s[i]));
+        if(rc < 0) return -1;
+    }
+    return 0;
+}
+
+static int echo_run(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    long i;
+    for(i = 0; i != self->nconns; ++i) {
+        /* Spread the round trips evenly among the connections. */
+        long n = count / self->nconns + (i < count % self->nconns ? 1 : 0);
+        if(n == 0) break;
+        int rc = bundle_go(self->clients, echo_client(b, self->c[i], n));
+        if(rc < 0) return -1;
+    }
+    return bundle_wait(self->clients, -1);
+}
+
+static int tcp_echo1_setup(struct bench *b) {return echo_setup(b, 1, 1);}
+static int tcp_echo100_setup(struct bench *b) {return echo_setup(b, 100, 1);}
+static int tcp_echo10k_setup(struct bench *b) {return echo_setup(b, 10000, 1);}
+static int ipc_echo1_setup(struct bench *b) {return echo_setup(b, 1, 0);}
+static int ipc_echo100_setup(struct bench *b) {return echo_setup(b, 100, 0);}
+static int ipc_echo10k_setup(struct bench *b) {return echo_setup(b, 10000, 0);}
+
+/******************************************************************************/
+/*  Bulk: one-way throughput over a single connection.                        */
+/******************************************************************************/
+
+static coroutine void bulk_sink(int s, long count, char *buf) {
+    long i;
+    for(i = 0; i != count; ++i) {
+        int rc = brecv(s, buf, BULK_SIZE, -1);
+        if(rc < 0) return;
+    }
+}
+
+static int bulk_run(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    /* Sink has its own buffer so that it doesn't clash with the sender. */
+    char *buf = malloc(BULK_SIZE);
+    if(!buf) return -1;
+    int rc = bundle_go(self->clients, bulk_sink(self->s[0], count, buf));
+    if(rc < 0) {free(buf); return -1;}
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        rc = bsend(self->c[0], self->buf, BULK_SIZE, -1);
+        if(rc < 0) break;
+        bench_end(b);
+        b->bytes += BULK_SIZE;
+    }
+    /* The workload is complete once all the data are received. */
+    if(rc == 0) rc = bundle_wait(self->clients, -1);
+    free(buf);
+    return rc;
+}
+
+static int tcp_bulk_setup(struct bench *b) {
+    int rc = bench_net_setup(b, 1);
+    if(rc < 0) return -1;
+    return bench_tcp_connect(b, 1);
+}
+
+static int ipc_bulk_setup(struct bench *b) {
+    int rc = bench_net_setup(b, 1);
+    if(rc < 0) return -1;
+    return bench_ipc_connect(b, 1);
+}
+
+/******************************************************************************/
+/*  Accept: connections established per second.                              */
+/******************************************************************************/
+
+#define ACCEPT_BURST 16
+
+/* The listener is stored as the client end of the only connection. */
+static int accept_setup(struct bench *b) {
+    int rc = bench_net_setup(b, ACCEPT_BURST);
+    if(rc < 0) return -1;
+    rc = bench_net_fds(ACCEPT_BURST);
+    if(rc < 0) return -1;
+    struct bench_net *self = b->state;
+    rc = ipaddr_local(&self->addr, "127.0.0.1", 0, IPADDR_IPV4);
+    if(rc < 0) return -1;
+    self->s[0] = -1;
+    self->c[0] = tcp_listen(&self->addr, 128);
+    if(self->c[0] < 0) return -1;
+    self->nconns = 1;
+    return 0;
+}
+
+/* A burst of connections is established and then accepted. Handles are
+   closed with RST, so there are no sockets left in TIME_WAIT state. */
+static int accept_run_(struct bench *b, long count, int many) {
+    struct bench_net *self = b->state;
+    int cs[ACCEPT_BURST];
+    int ss[ACCEPT_BURST];
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int j;
+        for(j = 0; j != ACCEPT_BURST; ++j) {
+            cs[j] = tcp_connect(&self->addr, -1);
+            if(cs[j] < 0) return -1;
+        }
+        j = 0;
+        while(j != ACCEPT_BURST) {
+            if(many) {
+                ssize_t n = tcp_accept_many(self->c[0], ss + j, NULL,
+                    ACCEPT_BURST - j, -1);
+                if(n < 0) return -1;
+                j += n;
+            }
+            else {
+                ss[j] = tcp_accept(self->c[0], NULL, -1);
+                if(ss[j] < 0) return -1;
+                j++;
+            }
+        }
+        bench_end(b);
+        for(j = 0; j != ACCEPT_BURST; ++j) {
+            hclose(cs[j]);
+            hclose(ss[j]);
+        }
+    }
+    return 0;
+}
+
+static int accept_run(struct bench *b, long count) {
+    return accept_run_(b, count, 0);
+}
+
+static int accept_many_run(struct bench *b, long count) {
+    return accept_run_(b, count, 1);
+}
+
+/******************************************************************************/
+/*  UDP: datagrams per second.                                                */
+/******************************************************************************/
+
+#define UDP_BURST 32
+
+static int udp_setup(struct bench *b) {
+    int rc = bench_net_setup(b, 1);
+    if(rc < 0) return -1;
+    struct bench_net *self = b->state;
+    struct ipaddr addr;
+    rc = ipaddr_local(&addr, "127.0.0.1", 0, IPADDR_IPV4);
+    if(rc < 0) return -1;
+    self->c[0] = udp_open(&addr, NULL);
+    if(self->c[0] < 0) return -1;
+    rc = ipaddr_local(&self->addr, "127.0.0.1", 0, IPADDR_IPV4);
+    if(rc < 0) {hclose(self->c[0]); return -1;}
+    self->s[0] = udp_open(&self->addr, NULL);
+    if(self->s[0] < 0) {hclose(self->c[0]); return -1;}
+    self->nconns = 1;
+    return 0;
+}
+
+/* A datagram is sent and received before the next one is sent. */
+static int udp_run(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int rc = udp_send(self->c[0], &self->addr, self->buf, ECHO_SIZE);
+        if(rc < 0) return -1;
+        ssize_t sz = udp_recv(self->s[0], NULL, self->buf, ECHO_SIZE, -1);
+        if(sz < 0) return -1;
+        bench_end(b);
+        b->bytes += ECHO_SIZE;
+    }
+    return 0;
+}
+
+/* Same as above, but the sender is connected to the receiver. */
+static int udp_connected_setup(struct bench *b) {
+    int rc = bench_net_setup(b, 1);
+    if(rc < 0) return -1;
+    struct bench_net *self = b->state;
+    rc = ipaddr_local(&self->addr, "127.0.0.1", 0, IPADDR_IPV4);
+    if(rc < 0) return -1;
+    self->s[0] = udp_open(&self->addr, NULL);
+    if(self->s[0] < 0) return -1;
+    self->nconns = 1;
+    self->c[0] = udp_open(NULL, &self->addr);
+    if(self->c[0] < 0) return -1;
+    return udp_connect(self->c[0]);
+}
+
+/* Multiple datagrams are in flight. The burst is small enough to fit into
+   the socket buffers, so there's no packet loss on the loopback interface. */
+static int udp_burst_run(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int j;
+        for(j = 0; j != UDP_BURST; ++j) {
+            int rc = udp_send(self->c[0], &self->addr, self->buf, ECHO_SIZE);
+            if(rc < 0) return -1;
+        }
+        for(j = 0; j != UDP_BURST; ++j) {
+            ssize_t sz = udp_recv(self->s[0], NULL, self->buf, ECHO_SIZE, -1);
+            if(sz < 0) return -1;
+        }
+        bench_end(b);
+        b->bytes += UDP_BURST * ECHO_SIZE;
+    }
+    return 0;
+}
+
+/* Same as above, except that the datagrams are sent and received in batches,
+   using a single system call per batch if possible. */
+static int udp_batch_run(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    struct udp_msg msgs[UDP_BURST];
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int j;
+        for(j = 0; j != UDP_BURST; ++j) {
+            msgs[j].addr = &self->addr;
+            msgs[j].buf = self->buf + j * ECHO_SIZE;
+            msgs[j].len = ECHO_SIZE;
+        }
+        int rc = udp_sendv(self->c[0], msgs, UDP_BURST);
+        if(rc < 0) return -1;
+        j = 0;
+        while(j != UDP_BURST) {
+            int k;
+            for(k = 0; k != UDP_BURST - j; ++k) msgs[k].addr = NULL;
+            ssize_t n = udp_recvv(self->s[0], msgs, UDP_BURST - j, -1);
+            if(n < 0) return -1;
+            j += n;
+        }
+        bench_end(b);
+        b->bytes += UDP_BURST * ECHO_SIZE;
+    }
+    return 0;
+}
+
+/* Same as above, but the datagrams are segmented by the sender's kernel and
+   may be coalesced again on the receiver's side. */
+static int udp_gso_setup(struct bench *b) {
+    int rc = udp_setup(b);
+    if(rc < 0) return -1;
+    struct bench_net *self = b->state;
+    rc = udp_gro(self->s[0], 1);
+    if(rc < 0 && errno != ENOTSUP) return -1;
+    return 0;
+}
+
+static int udp_gso_run(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int rc = udp_sendseg(self->c[0], &self->addr, self->buf,
+            UDP_BURST * ECHO_SIZE, ECHO_SIZE);
+        if(rc < 0) return -1;
+        size_t received = 0;
+        while(received != UDP_BURST * ECHO_SIZE) {
+            size_t segsize;
+            ssize_t sz = udp_recvseg(self->s[0], NULL, self->buf, BULK_SIZE,
+                &segsize, -1);
+            if(sz < 0) return -1;
+            received += sz;
+        }
+        bench_end(b);
+        b->bytes += UDP_BURST * ECHO_SIZE;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/*  WebSocket: messages per second.                                           */
+/******************************************************************************/
+
+static coroutine void ws_sink(int s, long count) {
+    char buf[ECHO_SIZE];
+    long i;
+    for(i = 0; i != count; ++i) {
+        ssize_t sz = ws_recv(s, NULL, buf, sizeof(buf), -1);
+        if(sz < 0) return;
+    }
+}
+
+static int ws_setup(struct bench *b) {
+    int rc = bench_net_setup(b, 1);
+    if(rc < 0) return -1;
+    rc = bench_ipc_connect(b, 1);
+    if(rc < 0) return -1;
+    struct bench_net *self = b->state;
+    /* On failure, the underlying socket is closed by the attach function. */
+    self->s[0] = ws_attach_server(self->s[0], WS_BINARY | WS_NOHTTP,
+        NULL, 0, NULL, 0, -1);
+    if(self->s[0] < 0) return -1;
+    self->c[0] = ws_attach_client(self->c[0], WS_BINARY | WS_NOHTTP,
+        NULL, NULL, -1);
+    if(self->c[0] < 0) return -1;
+    return 0;
+}
+
+static int ws_run(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    int rc = bundle_go(self->clients, ws_sink(self->s[0], count));
+    if(rc < 0) return -1;
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        rc = ws_send(self->c[0], WS_BINARY, self->buf, ECHO_SIZE, -1);
+        if(rc < 0) return -1;
+        bench_end(b);
+        b->bytes += ECHO_SIZE;
+    }
+    return bundle_wait(self->clients, -1);
+}
+
+/******************************************************************************/
+/*  HTTP: request/response exchanges per second over a kept-alive connection. */
+/******************************************************************************/
+
+static coroutine void http_server(int u) {
+    char command[16];
+    char resource[64];
+    char name[64];
+    char value[64];
+    while(1) {
+        int s = http_attach(u);
+        if(s < 0) break;
+        int rc = http_recvrequest(s, command, sizeof(command),
+            resource, sizeof(resource), -1);
+        if(rc < 0) {hclose(s); return;}
+        while(1) {
+            rc = http_recvfield(s, name, sizeof(name), value, sizeof(value),
+                -1);
+            if(rc < 0) break;
+        }
+        if(errno != EPIPE) {hclose(s); return;}
+        rc = http_sendstatus(s, 200, "OK", -1);
+        if(rc < 0) {hclose(s); return;}
+        rc = http_sendfield(s, "Content-Length", "0", -1);
+        if(rc < 0) {hclose(s); return;}
+        rc = http_done(s, -1);
+        if(rc < 0) {hclose(s); return;}
+        u = http_detach(s, -1);
+        if(u < 0) return;
+    }
+    hclose(u);
+}
+
+static int http_setup(struct bench *b) {
+    int rc = bench_net_setup(b, 1);
+    if(rc < 0) return -1;
+    /* HTTP sends each line separately. Over TCP, the result would be
+       dominated by Nagle's algorithm interacting with delayed ACKs. */
+    rc = bench_ipc_connect(b, 1);
+    if(rc < 0) return -1;
+    struct bench_net *self = b->state;
+    /* Server coroutine takes ownership of the server end. */
+    rc = bundle_go(self->servers, http_server(self->s[0]));
+    if(rc < 0) return -1;
+    self->s[0] = -1;
+    return 0;
+}
+
+static int http_run(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    char reason[16];
+    char name[64];
+    char value[64];
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int s = http_attach(self->c[0]);
+        if(s < 0) return -1;
+        int rc = http_sendrequest(s, "GET", "/", -1);
+        if(rc < 0) return -1;
+        rc = http_sendfield(s, "Host", "localhost", -1);
+        if(rc < 0) return -1;
+        rc = http_done(s, -1);
+        if(rc < 0) return -1;
+        rc = http_recvstatus(s, reason, sizeof(reason), -1);
+        if(rc < 0) return -1;
+        while(1) {
+            rc = http_recvfield(s, name, sizeof(name), value, sizeof(value),
+                -1);
+            if(rc < 0) break;
+        }
+        if(errno != EPIPE) return -1;
+        /* The underlying connection is reused for the next request. */
+        self->c[0] = http_detach(s, -1);
+        if(self->c[0] < 0) return -1;
+        bench_end(b);
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/*  TLS: handshakes per second and bulk throughput.                           */
+/******************************************************************************/
+
+#if defined HAVE_TLS
+
+static coroutine void tls_server(int u, int *s) {
+    /* On failure, the underlying socket is closed by tls_attach_server. */
+    *s = tls_attach_server(u, BENCH_CERTDIR "/cert.pem",
+        BENCH_CERTDIR "/key.pem", -1);
+}
+
+static int tls_handshake_setup(struct bench *b) {
+    return bench_net_setup(b, 1);
+}
+
+static int tls_handshake_run(struct bench *b, long count) {
+    struct bench_net *self = b->state;
+    long i;
+    for(i = 0; i != count; ++i) {
+        bench_begin(b);
+        int p[2];
+        int rc = ipc_pair(p);
+        if(rc < 0) return -1;
+        int s = -1;
+        rc = bundle_go(self->servers, tls_server(p[1], &s));
+        if(rc < 0) {hclose(p[0]); hclose(p[1]); return -1;}
+        int c = tls_attach_client(p[0], -1);
+        if(c < 0) return -1;
+        rc = bundle_wait(self->servers, -1);
+        if(rc < 0 || s < 0) {hclose(c); return -1;}
+        hclose(c);
+        hclose(s);
+        bench_end(b);
+    }
+    return 0;
+}
+
+static int tls_bulk_setup(struct bench *b) {
+    int rc = bench_net_setup(b, 1);
+    if(rc < 0) return -1;
+    struct bench_net *self = b->state;
+    rc = bench_tcp_connect(b, 1);
+    if(rc < 0) return -1;
+    int s = -1;
+    rc = bundle_go(self->servers, tls_server(self->s[0], &s));
+    if(rc < 0) return -1;
+    /* Both ends are owned by TLS sockets from now on. */
+    self->s[0] = -1;
+    self->c[0] = tls_attach_client(self->c[0], -1);
+    if(self->c[0] < 0) return -1;
+    rc = bundle_wait(self->servers, -1);
+    if(rc < 0) return -1;
+    self->s[0] = s;
+    return s < 0 ? -1 : 0;
+}
+
+#endif
+
+const struct bench_workload bench_net[] = {
+    {"tcp_echo_1", "round trip", 1, 100000,
+        tcp_echo1_setup, echo_run, bench_net_teardown},
+    {"tcp_echo_100", "round trip", 1, 100000,
+        tcp_echo100_setup, echo_run, bench_net_teardown},
+    {"tcp_echo_10k", "round trip", 1, 100000,
+        tcp_echo10k_setup, echo_run, bench_net_teardown},
+    {"tcp_bulk", "64kB block", 1, 10000,
+        tcp_bulk_setup, bulk_run, bench_net_teardown},
+    {"ipc_echo_1", "round trip", 1, 100000,
+        ipc_echo1_setup, echo_run, bench_net_teardown},
+    {"ipc_echo_100", "round trip", 1, 100000,
+        ipc_echo100_setup, echo_run, bench_net_teardown},
+    {"ipc_echo_10k", "round trip", 1, 100000,
+        ipc_echo10k_setup, echo_run, bench_net_teardown},
+    {"ipc_bulk", "64kB block", 1, 10000,
+        ipc_bulk_setup, bulk_run, bench_net_teardown},
+    {"tcp_accept", "connection", ACCEPT_BURST, 2000,
+        accept_setup, accept_run, bench_net_teardown},
+    {"tcp_accept_many", "connection", ACCEPT_BURST, 2000,
+        accept_setup, accept_many_run, bench_net_teardown},
+    {"udp", "datagram", 1, 100000,
+        udp_setup, udp_run, bench_net_teardown},
+    {"udp_connected", "datagram", 1, 100000,
+        udp_connected_setup, udp_run, bench_net_teardown},
+    {"udp_burst", "datagram", UDP_BURST, 10000,
+        udp_setup, udp_burst_run, bench_net_teardown},
+    {"udp_batch", "datagram", UDP_BURST, 10000,
+        udp_setup, udp_batch_run, bench_net_teardown},
+    {"udp_gso", "datagram", UDP_BURST, 10000,
+        udp_gso_setup, udp_gso_run, bench_net_teardown},
+#if defined HAVE_TLS
+    {"tls_handshake", "handshake", 1, 1000,
+        tls_handshake_setup, tls_handshake_run, bench_net_teardown},
+    {"tls_bulk", "64kB block", 1, 10000,
+        tls_bulk_setup, bulk_run, bench_net_teardown},
+#endif
+    {"ws", "message", 1, 100000,
+        ws_setup, ws_run, bench_net_teardown},
+    {"http", "request/response", 1, 20000,
+        http_setup, http_run, bench_net_teardown},
+    {NULL}
+};
+
@@ -50,6 +50,11 @@ int dill_pollset_in(struct dill_fdclause *fdcl, int id, int fd);
 /* Add waiting for an out event on the fd to the list of current clauses. */
 int dill_pollset_out(struct dill_fdclause *fdcl, int id, int fd);
 
+/* Add waiting for an error condition on the fd, e.g. for a message in
+   the socket's error queue, to the list of current clauses. Fails with
+   ENOTSUP if the pollset can't do that. */
+int dill_pollset_err(struct dill_fdclause *fdcl, int id, int fd);
+
 /* Drop any cached info about the file descriptor. */
 int dill_pollset_clean(int fd);
 
@@ -0,0 +1,481 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#define DILL_DISABLE_RAW_NAMES
+#include "libdillimpl.h"
+#include "cr.h"
+#include "fd.h"
+#include "list.h"
+#include "utils.h"
+
+dill_unique_id(dill_tcp_pool_type);
+
+struct dill_tcp_pool_dest;
+
+/* Connection either handed out to the user or sitting idle in the pool. */
+struct dill_tcp_pool_conn {
+    /* Busy connections are in the pool's 'busy' list, idle ones in their
+       destination's 'idle' list. */
+    struct dill_list item;
+    /* Idle connections only. Position in the pool's 'idles' list. */
+    struct dill_list lru;
+    struct dill_tcp_pool_dest *dest;
+    /* Handle passed to the user. */
+    int h;
+    /* State of the underlying TCP socket. Attaching TLS changes the handle
+       of the socket, but not the socket itself. */
+    struct dill_fd_stream *st;
+    /* Idle connections only. Time when the connection gets closed. */
+    int64_t expiry;
+};
+
+struct dill_tcp_pool_dest {
+    struct dill_list item;
+    /* Destination is identified either by the address or, if 'name' is not
+       NULL, by the name and the port. */
+    struct dill_ipaddr addr;
+    char *name;
+    int port;
+    /* Idle connections, the most recently used one first. */
+    struct dill_list idle;
+    /* Coroutines waiting for a connection to be released. */
+    struct dill_list waiters;
+    /* Number of connections handed out or being established. */
+    size_t nbusy;
+    /* Number of waiters that were woken up but haven't resumed yet. */
+    size_t nwoken;
+};
+
+struct dill_tcp_pool_waiter {
+    struct dill_clause cl;
+    struct dill_list item;
+};
+
+struct dill_tcp_pool {
+    struct dill_hvfs hvfs;
+    /* Maximum number of busy connections per destination. 0 means
+       unlimited. */
+    size_t max;
+    int64_t idle;
+    struct dill_list dests;
+    struct dill_list busy;
+    /* All idle connections, the one that expires first at the beginning. */
+    struct dill_list idles;
+    /* Expired connections are closed by the reaper coroutine. When the first
+       connection becomes idle the reaper is woken up via the channel. */
+    int bndl;
+    int ch[2];
+    struct dill_bundle_storage bndl_mem;
+    struct dill_chstorage ch_mem;
+    /* Number of connection attempts in progress, including the woken up
+       waiters. If the pool is closed in the meantime the object is
+       deallocated by the last of them. */
+    int pending;
+    unsigned int tls : 1;
+    unsigned int closed : 1;
+};
+
+static void *dill_tcp_pool_hquery(struct dill_hvfs *hvfs, const void *type);
+static void dill_tcp_pool_hclose(struct dill_hvfs *hvfs);
+static dill_coroutine void dill_tcp_pool_reaper(struct dill_tcp_pool *self);
+
+int dill_tcp_pool(size_t max, int64_t idle, int flags) {
+    int err;
+    if(dill_slow(idle < 0 || (flags & ~DILL_TCP_POOL_TLS))) {
+        err = EINVAL; goto error1;}
+#if !defined HAVE_TLS
+    if(dill_slow(flags & DILL_TCP_POOL_TLS)) {err = ENOTSUP; goto error1;}
+#endif
+    struct dill_tcp_pool *self = malloc(sizeof(struct dill_tcp_pool));
+    if(dill_slow(!self)) {err = ENOMEM; goto error1;}
+    self->hvfs.query = dill_tcp_pool_hquery;
+    self->hvfs.close = dill_tcp_pool_hclose;
+    self->max = max;
+    self->idle = idle;
+    dill_list_init(&self->dests);
+    dill_list_init(&self->busy);
+    dill_list_init(&self->idles);
+    self->pending = 0;
+    self->tls = flags & DILL_TCP_POOL_TLS ? 1 : 0;
+    self->closed = 0;
+    int rc = dill_chmake_mem(&self->ch_mem, self->ch);
+    if(dill_slow(rc < 0)) {err = errno; goto error2;}
+    self->bndl = dill_bundle_mem(&self->bndl_mem);
+    if(dill_slow(self->bndl < 0)) {err = errno; goto error3;}
+    rc = dill_bundle_go(self->bndl, dill_tcp_pool_reaper(self));
+    if(dill_slow(rc < 0)) {err = errno; goto error4;}
+    int h = dill_hmake(&self->hvfs);
+    if(dill_slow(h < 0)) {err = errno; goto error4;}
+    return h;
+error4:
+    rc = dill_hclose(self->bndl);
+    dill_assert(rc == 0);
+error3:
+    rc = dill_hclose(self->ch[0]);
+    dill_assert(rc == 0);
+    rc = dill_hclose(self->ch[1]);
+    dill_assert(rc == 0);
+error2:
+    free(self);
+error1:
+    errno = err;
+    return -1;
+}
+
+static void *dill_tcp_pool_hquery(struct dill_hvfs *hvfs, const void *type) {
+    struct dill_tcp_pool *self = (struct dill_tcp_pool*)hvfs;
+    if(type == dill_tcp_pool_type) return self;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+/* Deallocates the destination if nobody is using it any more. */
+static void dill_tcp_pool_trydrop(struct dill_tcp_pool_dest *dest) {
+    if(!dill_list_empty(&dest->idle) || !dill_list_empty(&dest->waiters) ||
+          dest->nbusy || dest->nwoken) return;
+    dill_list_erase(&dest->item);
+    free(dest->name);
+    free(dest);
+}
+
+/* Closes an idle connection. */
+static void dill_tcp_pool_evict(struct dill_tcp_pool_conn *conn) {
+    dill_list_erase(&conn->item);
+    dill_list_erase(&conn->lru);
+    int rc = dill_hclose(conn->h);
+    dill_assert(rc == 0);
+    dill_tcp_pool_trydrop(conn->dest);
+    free(conn);
+}
+
+static dill_coroutine void dill_tcp_pool_reaper(struct dill_tcp_pool *self) {
+    while(1) {
+        int64_t deadline = -1;
+        int64_t nw = dill_now();
+        while(!dill_list_empty(&self->idles)) {
+            struct dill_tcp_pool_conn *conn = dill_cont(
+                dill_list_next(&self->idles), struct dill_tcp_pool_conn, lru);
+            if(conn->expiry > nw) {deadline = conn->expiry; break;}
+            dill_tcp_pool_evict(conn);
+        }
+        char c;
+        int rc = dill_chrecv(self->ch[0], &c, 1, deadline);
+        if(dill_slow(rc < 0 && errno == ECANCELED)) return;
+        dill_assert(rc == 0 || errno == ETIMEDOUT);
+    }
+}
+
+/* Checks whether an idle connection can be handed out. The peer may have
+   closed it or reset it while it was sitting in the pool. */
+static int dill_tcp_pool_alive(struct dill_tcp_pool *self,
+      struct dill_tcp_pool_conn *conn) {
+    struct dill_fd_stream *st = conn->st;
+    if(dill_slow(st->indone || st->outdone || st->inerr || st->outerr))
+        return 0;
+    char c;
+    ssize_t sz = recv(st->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if(dill_fast(sz < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)))
+        return 1;
+    /* TLS peers may send records, e.g. session tickets, at any time. With
+       plain TCP, unsolicited data means that the protocol got out of sync. */
+    if(sz > 0 && self->tls) return 1;
+    return 0;
+}
+
+/* Checks whether a connection returned by the user is in a state that allows
+   it to be reused. */
+static int dill_tcp_pool_reusable(struct dill_tcp_pool *self,
+      struct dill_tcp_pool_conn *conn) {
+    struct dill_fd_stream *st = conn->st;
+    if(dill_slow(st->rbusy || st->sbusy || st->indone || st->outdone ||
+        st->inerr || st->outerr)) return 0;
+    /* Unread or unsent data would leak into the next exchange. With TLS,
+       buffered data may be records that are not part of the exchange. */
+    if(dill_slow(!self->tls && st->rxbuf.pos < st->rxbuf.len)) return 0;
+    if(dill_slow(st->txbuf && st->txbuf->len)) return 0;
+    return 1;
+}
+
+static void dill_tcp_pool_wcancel(struct dill_clause *cl) {
+    struct dill_tcp_pool_waiter *w =
+        dill_cont(cl, struct dill_tcp_pool_waiter, cl);
+    dill_list_erase(&w->item);
+}
+
+/* Lets the first coroutine waiting for the destination try again. Both
+   the destination and the pool are kept alive till it resumes. */
+static void dill_tcp_pool_wakeup(struct dill_tcp_pool *self,
+      struct dill_tcp_pool_dest *dest) {
+    if(dill_list_empty(&dest->waiters)) return;
+    struct dill_tcp_pool_waiter *w = dill_cont(dill_list_next(&dest->waiters),
+        struct dill_tcp_pool_waiter, item);
+    dest->nwoken++;
+    self->pending++;
+    dill_trigger(&w->cl, 0);
+}
+
+static struct dill_tcp_pool_dest *dill_tcp_pool_getdest(
+      struct dill_tcp_pool *self, const struct dill_ipaddr *addr,
+      const char *name, int port) {
+    struct dill_list *it;
+    for(it = dill_list_next(&self->dests); it != &self->dests;
+          it = dill_list_next(it)) {
+        struct dill_tcp_pool_dest *dest =
+            dill_cont(it, struct dill_tcp_pool_dest, item);
+        if(name) {
+            if(dest->name && dest->port == port &&
+                  strcmp(dest->name, name) == 0) return dest;
+        }
+        else {
+            if(!dest->name && dill_ipaddr_equal(&dest->addr, addr, 0))
+                return dest;
+        }
+    }
+    struct dill_tcp_pool_dest *dest = malloc(sizeof(struct dill_tcp_pool_dest));
+    if(dill_slow(!dest)) {errno = ENOMEM; return NULL;}
+    if(name) {
+        dest->name = strdup(name);
+        if(dill_slow(!dest->name)) {free(dest); errno = ENOMEM; return NULL;}
+        dest->port = port;
+    }
+    else {
+        dest->addr = *addr;
+        dest->name = NULL;
+        dest->port = 0;
+    }
+    dill_list_init(&dest->idle);
+    dill_list_init(&dest->waiters);
+    dest->nbusy = 0;
+    dest->nwoken = 0;
+    dill_list_insert(&dest->item, &self->dests);
+    return dest;
+}
+
+/* Opens a new connection. On failure, nothing is left open. */
+static int dill_tcp_pool_open(struct dill_tcp_pool_conn *conn, int tls,
+      const struct dill_ipaddr *addr, const char *name, int port,
+      int64_t deadline) {
+    if(name) conn->h = dill_happyeyeballs_connect(name, port, deadline);
+    else conn->h = dill_tcp_connect(addr, deadline);
+    if(dill_slow(conn->h < 0)) return -1;
+    conn->st = dill_hquery(conn->h, dill_fd_stream_type);
+    dill_assert(conn->st);
+#if defined HAVE_TLS
+    /* If attaching fails, the TCP socket is closed. */
+    if(tls) {
+        conn->h = dill_tls_attach_client(conn->h, deadline);
+        if(dill_slow(conn->h < 0)) return -1;
+    }
+#endif
+    return 0;
+}
+
+static int dill_tcp_pool_connect_(int p, const struct dill_ipaddr *addr,
+      const char *name, int port, int64_t deadline) {
+    int err;
+    struct dill_tcp_pool *self = dill_hquery(p, dill_tcp_pool_type);
+    if(dill_slow(!self)) {err = errno; goto error1;}
+    struct dill_tcp_pool_dest *dest = dill_tcp_pool_getdest(self, addr,
+        name, port);
+    if(dill_slow(!dest)) {err = errno; goto error1;}
+    struct dill_tcp_pool_conn *conn;
+    int rc;
+    while(1) {
+        /* Hand out the most recently used idle connection, if any. */
+        while(!dill_list_empty(&dest->idle)) {
+            conn = dill_cont(dill_list_next(&dest->idle),
+                struct dill_tcp_pool_conn, item);
+            if(dill_fast(dill_tcp_pool_alive(self, conn))) {
+                dill_list_erase(&conn->item);
+                dill_list_erase(&conn->lru);
+                dill_list_insert(&conn->item, &self->busy);
+                dest->nbusy++;
+                return conn->h;
+            }
+            dill_list_erase(&conn->item);
+            dill_list_erase(&conn->lru);
+            rc = dill_hclose(conn->h);
+            dill_assert(rc == 0);
+            free(conn);
+        }
+        if(!self->max || dest->nbusy < self->max) break;
+        /* All the connections to the destination are in use. Wait till one
+           of them is released. */
+        rc = dill_canblock();
+        if(dill_slow(rc < 0)) {err = errno; goto error2;}
+        if(dill_slow(deadline == 0)) {err = ETIMEDOUT; goto error2;}
+        struct dill_tcp_pool_waiter w;
+        dill_list_insert(&w.item, &dest->waiters);
+        dill_waitfor(&w.cl, 0, dill_tcp_pool_wcancel);
+        struct dill_tmclause tmcl;
+        dill_timer(&tmcl, 1, deadline);
+        int id = dill_wait();
+        if(dill_slow(id < 0)) {err = errno; goto error2;}
+        if(dill_slow(id == 1)) {err = ETIMEDOUT; goto error2;}
+        /* The pool was closed. The destination doesn't exist any more. */
+        if(dill_slow(errno != 0)) return -1;
+        /* Woken up by dill_tcp_pool_wakeup(). The pool may have been closed
+           since then, in which case the destination is gone as well. */
+        self->pending--;
+        if(dill_slow(self->closed)) {
+            if(!self->pending) free(self);
+            errno = EBADF;
+            return -1;
+        }
+        dest->nwoken--;
+    }
+    /* Open a new connection. The slot is taken before connecting so that
+       concurrent callers don't exceed the limit. */
+    conn = malloc(sizeof(struct dill_tcp_pool_conn));
+    if(dill_slow(!conn)) {err = ENOMEM; goto error2;}
+    conn->dest = dest;
+    dest->nbusy++;
+    self->pending++;
+    rc = dill_tcp_pool_open(conn, self->tls, addr, name, port, deadline);
+    err = errno;
+    self->pending--;
+    if(dill_slow(self->closed)) {
+        /* The pool was closed while connecting. */
+        if(rc == 0) {
+            rc = dill_hclose(conn->h);
+            dill_assert(rc == 0);
+        }
+        free(conn);
+        if(!self->pending) free(self);
+        errno = EBADF;
+        return -1;
+    }
+    if(dill_slow(rc < 0)) {
+        dest->nbusy--;
+        free(conn);
+        dill_tcp_pool_wakeup(self, dest);
+        goto error2;
+    }
+    dill_list_insert(&conn->item, &self->busy);
+    return conn->h;
+error2:
+    dill_tcp_pool_trydrop(dest);
+error1:
+    errno = err;
+    return -1;
+}
+
+int dill_tcp_pool_connect(int p, const struct dill_ipaddr *addr,
+      int64_t deadline) {
+    if(dill_slow(!addr)) {errno = EINVAL; return -1;}
+    return dill_tcp_pool_connect_(p, addr, NULL, 0, deadline);
+}
+
+int dill_tcp_pool_connect_name(int p, const char *name, int port,
+      int64_t deadline) {
+    if(dill_slow(!name || port <= 0)) {errno = EINVAL; return -1;}
+    return dill_tcp_pool_connect_(p, NULL, name, port, deadline);
+}
+
+int dill_tcp_pool_release(int p, int s, int reuse) {
+    struct dill_tcp_pool *self = dill_hquery(p, dill_tcp_pool_type);
+    if(dill_slow(!self)) return -1;
+    /* Find the connection among the ones handed out. */
+    struct dill_list *it;
+    struct dill_tcp_pool_conn *conn;
+    for(it = dill_list_next(&self->busy); it != &self->busy;
+          it = dill_list_next(it)) {
+        conn = dill_cont(it, struct dill_tcp_pool_conn, item);
+        if(conn->h == s) break;
+    }
+    if(dill_slow(it == &self->busy)) {errno = EINVAL; return -1;}
+    dill_list_erase(&conn->item);
+    struct dill_tcp_pool_dest *dest = conn->dest;
+    dest->nbusy--;
+    if(!reuse || !self->idle || !dill_tcp_pool_reusable(self, conn)) {
+        int rc = dill_hclose(conn->h);
+        dill_assert(rc == 0);
+        free(conn);
+    }
+    else {
+        conn->expiry = dill_now() + self->idle;
+        dill_list_insert(&conn->item, dill_list_next(&dest->idle));
+        int wasempty = dill_list_empty(&self->idles);
+        dill_list_insert(&conn->lru, &self->idles);
+        /* The reaper sleeps indefinitely while there are no idle
+           connections. If it's not waiting at the moment, it will notice
+           the new connection when it gets to run. */
+        if(wasempty) {
+            char c = 0;
+            int rc = dill_chsend(self->ch[1], &c, 1, 0);
+            dill_assert(rc == 0 || errno == ETIMEDOUT || errno == ECANCELED);
+        }
+    }
+    dill_tcp_pool_wakeup(self, dest);
+    dill_tcp_pool_trydrop(dest);
+    return 0;
+}
+
+static void dill_tcp_pool_hclose(struct dill_hvfs *hvfs) {
+    struct dill_tcp_pool *self = (struct dill_tcp_pool*)hvfs;
+    int rc = dill_hclose(self->bndl);
+    dill_assert(rc == 0);
+    rc = dill_hclose(self->ch[0]);
+    dill_assert(rc == 0);
+    rc = dill_hclose(self->ch[1]);
+    dill_assert(rc == 0);
+    /* Connections that were handed out remain open. They are owned by
+       the user from now on. */
+    while(!dill_list_empty(&self->busy)) {
+        struct dill_tcp_pool_conn *conn = dill_cont(
+            dill_list_next(&self->busy), struct dill_tcp_pool_conn, item);
+        dill_list_erase(&conn->item);
+        free(conn);
+    }
+    while(!dill_list_empty(&self->dests)) {
+        struct dill_tcp_pool_dest *dest = dill_cont(
+            dill_list_next(&self->dests), struct dill_tcp_pool_dest, item);
+        while(!dill_list_empty(&dest->idle)) {
+            struct dill_tcp_pool_conn *conn = dill_cont(
+                dill_list_next(&dest->idle), struct dill_tcp_pool_conn, item);
+            dill_list_erase(&conn->item);
+            rc = dill_hclose(conn->h);
+            dill_assert(rc == 0);
+            free(conn);
+        }
+        while(!dill_list_empty(&dest->waiters)) {
+            struct dill_tcp_pool_waiter *w = dill_cont(
+                dill_list_next(&dest->waiters), struct dill_tcp_pool_waiter,
+                item);
+            dill_trigger(&w->cl, EBADF);
+        }
+        dill_list_erase(&dest->item);
+        free(dest->name);
+        free(dest);
+    }
+    if(self->pending) {self->closed = 1; return;}
+    free(self);
+}
+
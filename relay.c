@@ -0,0 +1,230 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#if defined __linux__
+#define _GNU_SOURCE
+#include <fcntl.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define DILL_DISABLE_RAW_NAMES
+#include "libdillimpl.h"
+#include "fd.h"
+#include "utils.h"
+
+/* Maximum amount of data moved by a single splice() call. It matches
+   the default capacity of a pipe so that the pipe never gets full. */
+#define DILL_RELAY_SPLICESIZE 65536
+
+/* Passes the outbound half-close to the destination socket. Protocols that
+   don't support half-closing are only flushed. */
+static int dill_relay_done(int s, int64_t deadline) {
+    int rc = dill_tcp_done(s, deadline);
+    if(rc == 0 || errno != ENOTSUP) return rc;
+    rc = dill_ipc_done(s, deadline);
+    if(rc == 0 || errno != ENOTSUP) return rc;
+#if defined HAVE_TLS
+    rc = dill_tls_done(s, deadline);
+    if(rc == 0 || errno != ENOTSUP) return rc;
+#endif
+    return dill_bflush(s, deadline);
+}
+
+/* Moves data through user space. Works with any pair of bytestream
+   sockets. */
+static int dill_relay_copy(int src, int dst, uint64_t *nbytes,
+      int64_t deadline) {
+    uint8_t *buf = dill_fd_alloccopybuf();
+    if(dill_slow(!buf)) return -1;
+    int rc;
+    while(1) {
+        ssize_t sz = dill_brecvsome(src, buf, DILL_FD_COPYBUFSIZE, deadline);
+        if(sz < 0) {
+            rc = errno == EPIPE ? 0 : -1;
+            break;
+        }
+        rc = dill_bsend(dst, buf, sz, deadline);
+        if(dill_slow(rc < 0)) break;
+        /* There's nobody else to flush the data on destination socket
+           while we are waiting for more data from the source socket. */
+        rc = dill_bflush(dst, deadline);
+        if(dill_slow(rc < 0)) break;
+        *nbytes += sz;
+    }
+    dill_fd_freecopybuf(buf);
+    return rc;
+}
+
+#if defined __linux__
+
+/* Moves data from one fd-backed socket to another via a pipe, without
+   copying it to user space. */
+static int dill_relay_splice(struct dill_fd_stream *in, int dst,
+      struct dill_fd_stream *out, uint64_t *nbytes, int64_t deadline) {
+    int err;
+    if(dill_slow(in->rbusy || out->sbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(in->inerr || out->outerr)) {errno = ECONNRESET; return -1;}
+    if(dill_slow(out->outdone)) {errno = EPIPE; return -1;}
+    if(in->indone) return 0;
+    /* Data already read into the receive buffer and data still sitting in
+       the transmit buffer have to be passed on first. */
+    if(in->rxbuf.pos < in->rxbuf.len) {
+        size_t len = in->rxbuf.len - in->rxbuf.pos;
+        int rc = dill_bsend(dst, in->rxbuf.buf + in->rxbuf.pos, len,
+            deadline);
+        if(dill_slow(rc < 0)) return -1;
+        in->rxbuf.pos = in->rxbuf.len;
+        *nbytes += len;
+    }
+    int rc = dill_bflush(dst, deadline);
+    if(dill_slow(rc < 0)) return -1;
+    int p[2];
+    rc = pipe2(p, O_NONBLOCK | O_CLOEXEC);
+    if(dill_slow(rc < 0)) return -1;
+    in->rbusy = 1;
+    out->sbusy = 1;
+    while(1) {
+        ssize_t sz = splice(in->fd, NULL, p[1], NULL, DILL_RELAY_SPLICESIZE,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(sz == 0) {in->indone = 1; err = 0; break;}
+        if(sz < 0) {
+            if(dill_slow(errno != EWOULDBLOCK && errno != EAGAIN)) {
+                in->inerr = 1;
+                err = errno == EPIPE ? ECONNRESET : errno;
+                break;
+            }
+            rc = dill_fdin(in->fd, deadline);
+            if(dill_slow(rc < 0)) {in->inerr = 1; err = errno; break;}
+            continue;
+        }
+        /* The pipe is always emptied before reading more data into it. */
+        size_t len = sz;
+        while(len) {
+            struct dill_fd_sigpipe sp;
+            dill_fd_blocksigpipe(&sp);
+            sz = splice(p[0], NULL, out->fd, NULL, len,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            dill_fd_unblocksigpipe(&sp);
+            if(sz < 0) {
+                if(dill_slow(errno != EWOULDBLOCK && errno != EAGAIN)) {
+                    out->outerr = 1;
+                    err = errno == EPIPE ? ECONNRESET : errno;
+                    goto exit;
+                }
+                rc = dill_fdout(out->fd, deadline);
+                if(dill_slow(rc < 0)) {
+                    out->outerr = 1;
+                    err = errno;
+                    goto exit;
+                }
+                continue;
+            }
+            len -= sz;
+            *nbytes += sz;
+        }
+    }
+exit:
+    in->rbusy = 0;
+    out->sbusy = 0;
+    close(p[0]);
+    close(p[1]);
+    if(dill_slow(err)) {errno = err; return -1;}
+    return 0;
+}
+
+#endif
+
+/* Relays data in one direction until EOF is encountered. */
+static int dill_relay_pass(int src, int dst, uint64_t *nbytes,
+      int64_t deadline) {
+    int rc;
+#if defined __linux__
+    struct dill_fd_stream *in = dill_hquery(src, dill_fd_stream_type);
+    struct dill_fd_stream *out = dill_hquery(dst, dill_fd_stream_type);
+    if(in && out) rc = dill_relay_splice(in, dst, out, nbytes, deadline);
+    else rc = dill_relay_copy(src, dst, nbytes, deadline);
+#else
+    rc = dill_relay_copy(src, dst, nbytes, deadline);
+#endif
+    if(dill_slow(rc < 0)) return -1;
+    return dill_relay_done(dst, deadline);
+}
+
+static dill_coroutine void dill_relay_worker(int src, int dst,
+      uint64_t *nbytes, int64_t deadline, int ch) {
+    int err = 0;
+    int rc = dill_relay_pass(src, dst, nbytes, deadline);
+    if(dill_slow(rc < 0)) err = errno;
+    rc = dill_chsend(ch, &err, sizeof(err), -1);
+    dill_assert(rc == 0 || errno == ECANCELED);
+}
+
+int dill_brelay(int s1, int s2, uint64_t *nbytes, int64_t deadline) {
+    int err = 0;
+    uint64_t counts[2] = {0, 0};
+    if(dill_slow(s1 == s2)) {err = EINVAL; goto exit1;}
+    if(dill_slow(!dill_hquery(s1, dill_bsock_type))) {err = errno; goto exit1;}
+    if(dill_slow(!dill_hquery(s2, dill_bsock_type))) {err = errno; goto exit1;}
+    /* Each direction is handled by its own coroutine. They report
+       the outcome via the channel. If one of them fails, the other one
+       is canceled straight away. */
+    int ch[2];
+    struct dill_chstorage ch_storage;
+    int rc = dill_chmake_mem(&ch_storage, ch);
+    if(dill_slow(rc < 0)) {err = errno; goto exit1;}
+    struct dill_bundle_storage bndl_storage;
+    int bndl = dill_bundle_mem(&bndl_storage);
+    if(dill_slow(bndl < 0)) {err = errno; goto exit2;}
+    rc = dill_bundle_go(bndl,
+        dill_relay_worker(s1, s2, &counts[0], deadline, ch[1]));
+    if(dill_slow(rc < 0)) {err = errno; goto exit3;}
+    rc = dill_bundle_go(bndl,
+        dill_relay_worker(s2, s1, &counts[1], deadline, ch[1]));
+    if(dill_slow(rc < 0)) {err = errno; goto exit3;}
+    int i;
+    for(i = 0; i != 2; ++i) {
+        /* The workers enforce the deadline themselves. */
+        rc = dill_chrecv(ch[0], &err, sizeof(err), -1);
+        if(dill_slow(rc < 0)) {err = errno; goto exit3;}
+        if(dill_slow(err)) goto exit3;
+    }
+exit3:
+    rc = dill_hclose(bndl);
+    dill_assert(rc == 0);
+exit2:
+    rc = dill_hclose(ch[0]);
+    dill_assert(rc == 0);
+    rc = dill_hclose(ch[1]);
+    dill_assert(rc == 0);
+exit1:
+    if(nbytes) {
+        nbytes[0] = counts[0];
+        nbytes[1] = counts[1];
+    }
+    if(dill_slow(err)) {errno = err; return -1;}
+    return 0;
+}
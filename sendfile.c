@@ -0,0 +1,140 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#if defined __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define DILL_DISABLE_RAW_NAMES
+#include "libdillimpl.h"
+#include "fd.h"
+#include "utils.h"
+
+/* Reads the file into a buffer and sends it chunk by chunk. Works with
+   any bytestream socket and any file descriptor that supports pread().
+   Reading is done by the helper threads of the FILE protocol so that
+   a slow disk doesn't block the other coroutines. */
+static int dill_sendfile_copy(int s, int fd, off_t offset, size_t len,
+      int64_t deadline) {
+    int err;
+    uint8_t *buf = dill_fd_alloccopybuf();
+    if(dill_slow(!buf)) {err = errno; goto error1;}
+    /* The file handle takes ownership of the file descriptor it is given.
+       The caller keeps the original one. */
+    int dfd = dup(fd);
+    if(dill_slow(dfd < 0)) {err = errno; goto error2;}
+    struct dill_file_storage mem;
+    int f = dill_file_fromfd_mem(dfd, &mem);
+    if(dill_slow(f < 0)) {err = errno; close(dfd); goto error2;}
+    int rc;
+    while(len) {
+        size_t chunk = len < DILL_FD_COPYBUFSIZE ? len : DILL_FD_COPYBUFSIZE;
+        ssize_t sz = dill_file_pread(f, buf, chunk, offset, deadline);
+        if(dill_slow(sz < 0)) {err = errno; goto error3;}
+        /* The file is shorter than requested. */
+        if(dill_slow(sz == 0)) {err = EINVAL; goto error3;}
+        rc = dill_bsend(s, buf, sz, deadline);
+        if(dill_slow(rc < 0)) {err = errno; goto error3;}
+        offset += sz;
+        len -= sz;
+    }
+    rc = dill_hclose(f);
+    dill_assert(rc == 0);
+    dill_fd_freecopybuf(buf);
+    return 0;
+error3:
+    rc = dill_hclose(f);
+    dill_assert(rc == 0);
+error2:
+    dill_fd_freecopybuf(buf);
+error1:
+    errno = err;
+    return -1;
+}
+
+#if defined __linux__
+
+/* Returns 1 if the file can't be sent by sendfile() and should be copied
+   instead. This can only happen before any data were sent. */
+static int dill_sendfile_fast(struct dill_fd_stream *st, int fd,
+      off_t *offset, size_t *len, int64_t deadline) {
+    int first = 1;
+    while(*len) {
+        struct dill_fd_sigpipe sp;
+        dill_fd_blocksigpipe(&sp);
+        ssize_t sz = sendfile(st->fd, fd, offset, *len);
+        dill_fd_unblocksigpipe(&sp);
+        if(sz < 0) {
+            if(errno == EWOULDBLOCK || errno == EAGAIN) {
+                int rc = dill_fdout(st->fd, deadline);
+                if(dill_slow(rc < 0)) return -1;
+                first = 0;
+                continue;
+            }
+            /* The file doesn't support sendfile(). Try pread() instead. */
+            if(first && (errno == EINVAL || errno == ENOSYS)) return 1;
+            if(errno == EPIPE) errno = ECONNRESET;
+            return -1;
+        }
+        if(dill_slow(sz == 0)) {errno = EINVAL; return -1;}
+        *len -= sz;
+        first = 0;
+    }
+    return 0;
+}
+
+#endif
+
+int dill_bsendfile(int s, int fd, off_t offset, size_t len,
+      int64_t deadline) {
+    if(dill_slow(fd < 0 || offset < 0)) {errno = EINVAL; return -1;}
+#if defined __linux__
+    struct dill_fd_stream *st = dill_hquery(s, dill_fd_stream_type);
+    if(st) {
+        if(dill_slow(st->sbusy)) {errno = EBUSY; return -1;}
+        if(dill_slow(st->outdone)) {errno = EPIPE; return -1;}
+        if(dill_slow(st->outerr)) {errno = ECONNRESET; return -1;}
+        /* Buffered data have to go first. */
+        int rc = dill_bflush(s, deadline);
+        if(dill_slow(rc < 0)) return -1;
+        st->sbusy = 1;
+        size_t left = len;
+        rc = dill_sendfile_fast(st, fd, &offset, &left, deadline);
+        st->sbusy = 0;
+        if(dill_fast(rc == 0)) return 0;
+        if(dill_slow(rc < 0)) {
+            /* If nothing was sent and the problem is with the file rather
+               than with the connection the socket can still be used. */
+            if(left != len || errno == ECONNRESET || errno == ETIMEDOUT ||
+                  errno == ECANCELED) st->outerr = 1;
+            return -1;
+        }
+    }
+#endif
+    return dill_sendfile_copy(s, fd, offset, len, deadline);
+}
@@ -0,0 +1,256 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if defined __linux__
+#include <sys/signalfd.h>
+#endif
+
+#if defined DILL_THREADS
+#include <pthread.h>
+#endif
+
+#define DILL_DISABLE_RAW_NAMES
+#include "libdillimpl.h"
+#include "utils.h"
+
+/* Signals are received via a file descriptor. On Linux, the signals are
+   blocked in the calling thread and read from a signalfd. Elsewhere, there's
+   a signal handler that writes the signal number into a pipe. */
+
+dill_unique_id(dill_signal_type);
+
+static void *dill_signal_hquery(struct dill_hvfs *hvfs, const void *type);
+static void dill_signal_hclose(struct dill_hvfs *hvfs);
+
+struct dill_signal {
+    struct dill_hvfs hvfs;
+    /* File descriptor the signals are read from. */
+    int fd;
+    /* Write end of the pipe, if signalfd is not available. */
+    int wfd;
+    /* Signals received by this handle. */
+    sigset_t set;
+    /* Signals blocked by this handle. They are unblocked when the handle
+       is closed. */
+    sigset_t blocked;
+    unsigned int mem : 1;
+};
+
+DILL_CHECK_STORAGE(dill_signal, dill_signal_storage)
+
+static int dill_signal_mask(int how, const sigset_t *set, sigset_t *old) {
+#if defined DILL_THREADS
+    int rc = pthread_sigmask(how, set, old);
+    if(dill_slow(rc != 0)) {errno = rc; return -1;}
+    return 0;
+#else
+    return sigprocmask(how, set, old);
+#endif
+}
+
+#if !defined __linux__
+
+/* Write ends of the pipes, indexed by the signal number. */
+static volatile sig_atomic_t dill_signal_pipes[NSIG];
+static struct sigaction dill_signal_old[NSIG];
+
+static void dill_signal_handler(int signo) {
+    int err = errno;
+    unsigned char b = signo;
+    /* If the pipe is full the signal is dropped, same as it would be
+       coalesced by the kernel. */
+    ssize_t sz = write(dill_signal_pipes[signo], &b, 1);
+    (void)sz;
+    errno = err;
+}
+
+static int dill_signal_fd(struct dill_signal *self) {
+    int err;
+    int p[2];
+    int rc = pipe(p);
+    if(dill_slow(rc < 0)) {err = errno; goto error1;}
+    int i;
+    for(i = 0; i != 2; ++i) {
+        int opt = fcntl(p[i], F_GETFL, 0);
+        if(dill_slow(opt < 0)) {err = errno; goto error2;}
+        rc = fcntl(p[i], F_SETFL, opt | O_NONBLOCK);
+        if(dill_slow(rc < 0)) {err = errno; goto error2;}
+        opt = fcntl(p[i], F_GETFD);
+        if(dill_slow(opt < 0)) {err = errno; goto error2;}
+        rc = fcntl(p[i], F_SETFD, opt | FD_CLOEXEC);
+        if(dill_slow(rc < 0)) {err = errno; goto error2;}
+    }
+    /* Only one handle per signal is supported. */
+    int signo;
+    for(signo = 1; signo != NSIG; ++signo) {
+        if(sigismember(&self->set, signo) != 1) continue;
+        if(dill_slow(dill_signal_pipes[signo])) {err = EBUSY; goto error2;}
+    }
+    struct sigaction sa;
+    sa.sa_handler = dill_signal_handler;
+    sigfillset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    for(signo = 1; signo != NSIG; ++signo) {
+        if(sigismember(&self->set, signo) != 1) continue;
+        dill_signal_pipes[signo] = p[1];
+        rc = sigaction(signo, &sa, &dill_signal_old[signo]);
+        if(dill_slow(rc < 0)) {err = errno; goto error3;}
+    }
+    self->fd = p[0];
+    self->wfd = p[1];
+    return 0;
+error3:
+    /* The failed signal has its pipe set but its handler wasn't installed. */
+    dill_signal_pipes[signo] = 0;
+    while(--signo) {
+        if(sigismember(&self->set, signo) != 1) continue;
+        sigaction(signo, &dill_signal_old[signo], NULL);
+        dill_signal_pipes[signo] = 0;
+    }
+error2:
+    close(p[0]);
+    close(p[1]);
+error1:
+    errno = err;
+    return -1;
+}
+
+static void dill_signal_unfd(struct dill_signal *self) {
+    int signo;
+    for(signo = 1; signo != NSIG; ++signo) {
+        if(sigismember(&self->set, signo) != 1) continue;
+        sigaction(signo, &dill_signal_old[signo], NULL);
+        dill_signal_pipes[signo] = 0;
+    }
+    close(self->wfd);
+}
+
+#endif
+
+int dill_signal_open_mem(const sigset_t *set,
+      struct dill_signal_storage *mem) {
+    int err;
+    if(dill_slow(!set || !mem)) {err = EINVAL; goto error1;}
+    struct dill_signal *self = (struct dill_signal*)mem;
+    self->hvfs.query = dill_signal_hquery;
+    self->hvfs.close = dill_signal_hclose;
+    self->set = *set;
+    self->wfd = -1;
+    self->mem = 1;
+    sigemptyset(&self->blocked);
+#if defined __linux__
+    /* The signals have to be blocked, otherwise they would be delivered
+       the usual way. */
+    sigset_t old;
+    int rc = dill_signal_mask(SIG_BLOCK, set, &old);
+    if(dill_slow(rc < 0)) {err = errno; goto error1;}
+    int signo;
+    for(signo = 1; signo != NSIG; ++signo) {
+        if(sigismember(set, signo) == 1 && sigismember(&old, signo) != 1)
+            sigaddset(&self->blocked, signo);
+    }
+    self->fd = signalfd(-1, set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(dill_slow(self->fd < 0)) {err = errno; goto error2;}
+#else
+    int rc = dill_signal_fd(self);
+    if(dill_slow(rc < 0)) {err = errno; goto error2;}
+#endif
+    int h = dill_hmake(&self->hvfs);
+    if(dill_slow(h < 0)) {err = errno; goto error3;}
+    return h;
+error3:
+#if !defined __linux__
+    dill_signal_unfd(self);
+#endif
+    close(self->fd);
+error2:
+    dill_signal_mask(SIG_UNBLOCK, &self->blocked, NULL);
+error1:
+    errno = err;
+    return -1;
+}
+
+int dill_signal_open(const sigset_t *set) {
+    int err;
+    struct dill_signal *obj = malloc(sizeof(struct dill_signal));
+    if(dill_slow(!obj)) {err = ENOMEM; goto error1;}
+    int s = dill_signal_open_mem(set, (struct dill_signal_storage*)obj);
+    if(dill_slow(s < 0)) {err = errno; goto error2;}
+    obj->mem = 0;
+    return s;
+error2:
+    free(obj);
+error1:
+    errno = err;
+    return -1;
+}
+
+static void *dill_signal_hquery(struct dill_hvfs *hvfs, const void *type) {
+    struct dill_signal *self = (struct dill_signal*)hvfs;
+    if(type == dill_signal_type) return self;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+int dill_signal_wait(int s, int64_t deadline) {
+    struct dill_signal *self = dill_hquery(s, dill_signal_type);
+    if(dill_slow(!self)) return -1;
+    while(1) {
+#if defined __linux__
+        struct signalfd_siginfo info;
+        ssize_t sz = read(self->fd, &info, sizeof(info));
+        if(dill_fast(sz == sizeof(info))) return info.ssi_signo;
+#else
+        unsigned char signo;
+        ssize_t sz = read(self->fd, &signo, 1);
+        if(dill_fast(sz == 1)) return signo;
+#endif
+        dill_assert(sz < 0);
+        if(dill_slow(errno != EAGAIN && errno != EWOULDBLOCK &&
+            errno != EINTR)) return -1;
+        /* Wait till a signal arrives. */
+        int rc = dill_fdin(self->fd, deadline);
+        if(dill_slow(rc < 0)) return -1;
+    }
+}
+
+static void dill_signal_hclose(struct dill_hvfs *hvfs) {
+    struct dill_signal *self = (struct dill_signal*)hvfs;
+    int rc = dill_fdclean(self->fd);
+    dill_assert(rc == 0);
+#if !defined __linux__
+    dill_signal_unfd(self);
+#endif
+    close(self->fd);
+    /* Signals that were not blocked before are unblocked. Any pending
+       instances of them are going to be delivered the usual way. */
+    dill_signal_mask(SIG_UNBLOCK, &self->blocked, NULL);
+    if(!self->mem) free(self);
+}
@@ -61,6 +61,8 @@ static size_t dill_page_size(void) {
 int dill_ctx_stack_init(struct dill_ctx_stack *ctx) {
     ctx->count = 0;
     dill_slist_init(&ctx->cache);
+    ctx->hits = 0;
+    ctx->misses = 0;
     return 0;
 }
 
@@ -87,9 +89,11 @@ void *dill_allocstack(size_t *stack_size) {
     /* If there's a cached stack, use it. */
     if(!dill_slist_empty(&ctx->cache)) {
         --ctx->count;
+        ctx->hits++;
         return (void*)(dill_slist_pop(&ctx->cache) + 1);
     }
     /* Allocate a new stack. */
+    ctx->misses++;
     uint8_t *top;
 #if (HAVE_POSIX_MEMALIGN && HAVE_MPROTECT) & !defined DILL_NOGUARD
     /* Allocate the stack so that it's memory-page-aligned.
@@ -26,6 +26,7 @@
 #define DILL_STACK_INCLUDED
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "slist.h"
 
@@ -36,6 +37,9 @@
 struct dill_ctx_stack {
     int count;
     struct dill_slist cache;
+    /* Statistics. */
+    uint64_t hits;
+    uint64_t misses;
 };
 
 int dill_ctx_stack_init(struct dill_ctx_stack *ctx);
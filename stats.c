@@ -0,0 +1,83 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include "ctx.h"
+#include "utils.h"
+
+/* The counters are updated by the respective subsystems, each in its own
+   part of the thread-local context. Given that they are accessed only from
+   the owning thread, there's no need for atomic operations. */
+
+int dill_stats(struct dill_stats *stats) {
+    if(dill_slow(!stats)) {errno = EINVAL; return -1;}
+    struct dill_ctx *ctx = dill_getctx;
+    memset(stats, 0, sizeof(struct dill_stats));
+    stats->coroutines = ctx->cr.coroutines;
+    stats->spawns = ctx->cr.spawns;
+    stats->switches = ctx->cr.switches;
+    stats->ready = ctx->cr.ready_count;
+    stats->timers = ctx->cr.timers_count;
+    stats->timeouts = ctx->cr.timeouts;
+    stats->busypolls = ctx->cr.busypolls;
+    stats->polls = ctx->pollset.polls;
+    stats->pollevents = ctx->pollset.events;
+    stats->pollchanges = ctx->pollset.changes;
+    stats->stackhits = ctx->stack.hits;
+    stats->stackmisses = ctx->stack.misses;
+    stats->stackcached = ctx->stack.count;
+#if defined DILL_SOCKETS
+    stats->rxbufhits = ctx->fd.hits;
+    stats->rxbufmisses = ctx->fd.misses;
+    stats->rxbufcached = ctx->fd.count;
+#endif
+    return 0;
+}
+
+/* Latency tracking is off by default, because it requires reading the clock
+   on every wakeup caused by an external event. */
+
+int dill_latency_enable(int enable) {
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    int old = ctx->latency;
+    ctx->latency = enable ? 1 : 0;
+    /* Don't count the time when tracking was off as a loop iteration. */
+    ctx->poll_end = 0;
+    return old;
+}
+
+int dill_latency(struct dill_latency *latency, int reset) {
+    if(dill_slow(!latency)) {errno = EINVAL; return -1;}
+    struct dill_ctx_cr *ctx = &dill_getctx->cr;
+    latency->wakeup = ctx->wakeup;
+    latency->loop = ctx->loop;
+    if(reset) {
+        memset(&ctx->wakeup, 0, sizeof(ctx->wakeup));
+        memset(&ctx->loop, 0, sizeof(ctx->loop));
+    }
+    return 0;
+}
+
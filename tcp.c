@@ -23,9 +23,15 @@
 */
 
 #include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#if defined __linux__
+#include <linux/filter.h>
+#endif
+
 #define DILL_DISABLE_RAW_NAMES
 #include "libdillimpl.h"
 #include "fd.h"
@@ -34,6 +40,15 @@
 dill_unique_id(dill_tcp_type);
 dill_unique_id(dill_tcp_listener_type);
 
+/* Socket option that makes the kernel balance incoming connections among
+   all the listening sockets bound to the same address. Elsewhere,
+   SO_REUSEPORT only allows binding to the same address. */
+#if defined SO_REUSEPORT_LB
+#define DILL_TCP_REUSEPORT SO_REUSEPORT_LB
+#elif defined __linux__ && defined SO_REUSEPORT
+#define DILL_TCP_REUSEPORT SO_REUSEPORT
+#endif
+
 /******************************************************************************/
 /*  TCP connection socket                                                     */
 /******************************************************************************/
@@ -44,18 +59,17 @@ static int dill_tcp_bsendl(struct dill_bsock_vfs *bvfs,
     struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
 static int dill_tcp_brecvl(struct dill_bsock_vfs *bvfs,
     struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
+static int dill_tcp_bflush(struct dill_bsock_vfs *bvfs, int64_t deadline);
+static ssize_t dill_tcp_brecvsomel(struct dill_bsock_vfs *bvfs,
+    struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
 
 struct dill_tcp_conn {
     struct dill_hvfs hvfs;
     struct dill_bsock_vfs bvfs;
-    int fd;
-    struct dill_fd_rxbuf rxbuf;
-    unsigned int rbusy : 1;
-    unsigned int sbusy : 1;
-    unsigned int indone : 1;
-    unsigned int outdone: 1;
-    unsigned int inerr : 1;
-    unsigned int outerr : 1;
+    struct dill_fd_stream st;
+    struct dill_fd_zerocopy zc;
+    /* TCP_NOTSENT_LOWAT value. 0 if not set. */
+    int lowat;
     unsigned int mem : 1;
 };
 
@@ -65,6 +79,7 @@ static void *dill_tcp_hquery(struct dill_hvfs *hvfs, const void *type) {
     struct dill_tcp_conn *self = (struct dill_tcp_conn*)hvfs;
     if(type == dill_bsock_type) return &self->bvfs;
     if(type == dill_tcp_type) return self;
+    if(type == dill_fd_stream_type) return &self->st;
     errno = ENOTSUP;
     return NULL;
 }
@@ -76,14 +91,21 @@ static int dill_tcp_makeconn(int fd, void *mem) {
     self->hvfs.close = dill_tcp_hclose;
     self->bvfs.bsendl = dill_tcp_bsendl;
     self->bvfs.brecvl = dill_tcp_brecvl;
-    self->fd = fd;
-    dill_fd_initrxbuf(&self->rxbuf);
-    self->rbusy = 0;
-    self->sbusy = 0;
-    self->indone = 0;
-    self->outdone = 0;
-    self->inerr = 0;
-    self->outerr = 0;
+    self->bvfs.bflush = dill_tcp_bflush;
+    self->bvfs.brecvsomel = dill_tcp_brecvsomel;
+    self->st.fd = fd;
+    dill_fd_initrxbuf(&self->st.rxbuf);
+    self->st.txbuf = NULL;
+    self->st.rbusy = 0;
+    self->st.sbusy = 0;
+    self->st.indone = 0;
+    self->st.outdone = 0;
+    self->st.inerr = 0;
+    self->st.outerr = 0;
+    self->zc.threshold = 0;
+    self->zc.issued = 0;
+    self->zc.completed = 0;
+    self->lowat = 0;
     self->mem = 1;
     /* Create the handle. */
     return dill_hmake(&self->hvfs);
@@ -126,8 +148,9 @@ error1:
     return -1;
 }
 
-int dill_tcp_connect_mem(const struct dill_ipaddr *addr,
-        struct dill_tcp_storage *mem, int64_t deadline) {
+static int dill_tcp_connect_(const struct dill_ipaddr *addr,
+      struct dill_iolist *first, struct dill_iolist *last,
+      struct dill_tcp_storage *mem, int64_t deadline) {
     int err;
     if(dill_slow(!mem)) {err = EINVAL; goto error1;}
     /* Open a socket. */
@@ -137,8 +160,8 @@ int dill_tcp_connect_mem(const struct dill_ipaddr *addr,
     int rc = dill_fd_unblock(s);
     if(dill_slow(rc < 0)) {err = errno; goto error2;}
     /* Connect to the remote endpoint. */
-    rc = dill_fd_connect(s, dill_ipaddr_sockaddr(addr), dill_ipaddr_len(addr),
-        deadline);
+    rc = dill_fd_connectl(s, dill_ipaddr_sockaddr(addr), dill_ipaddr_len(addr),
+        first, last, deadline);
     if(dill_slow(rc < 0)) {err = errno; goto error2;}
     /* Create the handle. */
     int h = dill_tcp_makeconn(s, mem);
@@ -151,6 +174,17 @@ error1:
     return -1;
 }
 
+int dill_tcp_connect_mem(const struct dill_ipaddr *addr,
+        struct dill_tcp_storage *mem, int64_t deadline) {
+    return dill_tcp_connect_(addr, NULL, NULL, mem, deadline);
+}
+
+int dill_tcp_connectl_mem(const struct dill_ipaddr *addr,
+      struct dill_iolist *first, struct dill_iolist *last,
+      struct dill_tcp_storage *mem, int64_t deadline) {
+    return dill_tcp_connect_(addr, first, last, mem, deadline);
+}
+
 int dill_tcp_connect(const struct dill_ipaddr *addr, int64_t deadline) {
     int err;
     struct dill_tcp_conn *obj = malloc(sizeof(struct dill_tcp_conn));
@@ -167,48 +201,142 @@ error1:
 
 }
 
+int dill_tcp_connectl(const struct dill_ipaddr *addr,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    int err;
+    struct dill_tcp_conn *obj = malloc(sizeof(struct dill_tcp_conn));
+    if(dill_slow(!obj)) {err = ENOMEM; goto error1;}
+    int s = dill_tcp_connectl_mem(addr, first, last,
+        (struct dill_tcp_storage*)obj, deadline);
+    if(dill_slow(s < 0)) {err = errno; goto error2;}
+    obj->mem = 0;
+    return s;
+error2:
+    free(obj);
+error1:
+    errno = err;
+    return -1;
+}
+
 static int dill_tcp_bsendl(struct dill_bsock_vfs *bvfs,
       struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
     struct dill_tcp_conn *self = dill_cont(bvfs, struct dill_tcp_conn, bvfs);
-    if(dill_slow(self->sbusy)) {errno = EBUSY; return -1;}
-    if(dill_slow(self->outdone)) {errno = EPIPE; return -1;}
-    if(dill_slow(self->outerr)) {errno = ECONNRESET; return -1;}
-    self->sbusy = 1;
-    ssize_t sz = dill_fd_send(self->fd, first, last, deadline);
-    self->sbusy = 0;
+    if(dill_slow(self->st.sbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.outdone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.outerr)) {errno = ECONNRESET; return -1;}
+    self->st.sbusy = 1;
+    ssize_t sz;
+    if(self->zc.threshold)
+        sz = dill_fd_sendzc(self->st.fd, &self->zc, self->st.txbuf, first,
+            last, deadline);
+    else
+        sz = dill_fd_sendbuf(self->st.fd, self->st.txbuf, first, last,
+            deadline);
+    /* Don't return till the kernel runs short of data. That way, the user
+       produces new data only when the connection is about to need it. */
+    if(dill_slow(self->lowat) && sz >= 0 &&
+          !(self->st.txbuf && self->st.txbuf->len))
+        sz = dill_fd_waitnotsent(self->st.fd, self->lowat, deadline);
+    self->st.sbusy = 0;
     if(dill_fast(sz >= 0)) return sz;
-    self->outerr = 1;
+    self->st.outerr = 1;
+    return -1;
+}
+
+static int dill_tcp_bflush(struct dill_bsock_vfs *bvfs, int64_t deadline) {
+    struct dill_tcp_conn *self = dill_cont(bvfs, struct dill_tcp_conn, bvfs);
+    if(dill_slow(self->st.sbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.outdone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.outerr)) {errno = ECONNRESET; return -1;}
+    self->st.sbusy = 1;
+    int rc = dill_fd_flush(self->st.fd, self->st.txbuf, deadline);
+    if(dill_slow(self->lowat) && rc == 0)
+        rc = dill_fd_waitnotsent(self->st.fd, self->lowat, deadline);
+    self->st.sbusy = 0;
+    if(dill_fast(rc == 0)) return 0;
+    self->st.outerr = 1;
     return -1;
 }
 
 static int dill_tcp_brecvl(struct dill_bsock_vfs *bvfs,
       struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
     struct dill_tcp_conn *self = dill_cont(bvfs, struct dill_tcp_conn, bvfs);
-    if(dill_slow(self->rbusy)) {errno = EBUSY; return -1;}
-    if(dill_slow(self->indone)) {errno = EPIPE; return -1;}
-    if(dill_slow(self->inerr)) {errno = ECONNRESET; return -1;}
-    self->rbusy = 1;
-    int rc = dill_fd_recv(self->fd, &self->rxbuf, first, last, deadline);
-    self->rbusy = 0;
+    if(dill_slow(self->st.rbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.indone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.inerr)) {errno = ECONNRESET; return -1;}
+    /* If the read is going to block, the peer may be waiting for the data
+       sitting in the transmit buffer. Send them first. If there's a send
+       in progress, the buffered data are being sent as a part of it. */
+    if(self->st.txbuf && self->st.txbuf->len && !self->st.sbusy &&
+          !self->st.outerr && !dill_fd_rxready(&self->st.rxbuf, first)) {
+        int rc = dill_tcp_bflush(&self->bvfs, deadline);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    self->st.rbusy = 1;
+    int rc = dill_fd_recv(self->st.fd, &self->st.rxbuf, first, last, deadline);
+    self->st.rbusy = 0;
     if(dill_fast(rc == 0)) return 0;
-    if(errno == EPIPE) self->indone = 1;
-    else self->inerr = 1;
+    if(errno == EPIPE) self->st.indone = 1;
+    else self->st.inerr = 1;
+    return -1;
+}
+
+static ssize_t dill_tcp_brecvsomel(struct dill_bsock_vfs *bvfs,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    struct dill_tcp_conn *self = dill_cont(bvfs, struct dill_tcp_conn, bvfs);
+    if(dill_slow(self->st.rbusy)) {errno = EBUSY; return -1;}
+    if(dill_slow(self->st.indone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.inerr)) {errno = ECONNRESET; return -1;}
+    /* See dill_tcp_brecvl(). Any buffered data will do here. */
+    if(self->st.txbuf && self->st.txbuf->len && !self->st.sbusy &&
+          !self->st.outerr && self->st.rxbuf.len == self->st.rxbuf.pos) {
+        int rc = dill_tcp_bflush(&self->bvfs, deadline);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    self->st.rbusy = 1;
+    ssize_t sz = dill_fd_recvsome(self->st.fd, &self->st.rxbuf, first, last,
+        deadline);
+    self->st.rbusy = 0;
+    if(dill_fast(sz >= 0)) return sz;
+    if(errno == EPIPE) self->st.indone = 1;
+    else self->st.inerr = 1;
     return -1;
 }
 
+int dill_tcp_cork(int s, size_t size) {
+    struct dill_tcp_conn *self = dill_hquery(s, dill_tcp_type);
+    if(dill_slow(!self)) return -1;
+    if(dill_slow(self->st.sbusy)) {errno = EBUSY; return -1;}
+    return dill_fd_settxbuf(&self->st.txbuf, size);
+}
+
+int dill_tcp_zerocopy(int s, size_t threshold) {
+    struct dill_tcp_conn *self = dill_hquery(s, dill_tcp_type);
+    if(dill_slow(!self)) return -1;
+    if(dill_slow(self->st.sbusy)) {errno = EBUSY; return -1;}
+    return dill_fd_setzerocopy(self->st.fd, &self->zc, threshold);
+}
+
 int dill_tcp_done(int s, int64_t deadline) {
     struct dill_tcp_conn *self = dill_hquery(s, dill_tcp_type);
     if(dill_slow(!self)) return -1;
-    if(dill_slow(self->outdone)) {errno = EPIPE; return -1;}
-    if(dill_slow(self->outerr)) {errno = ECONNRESET; return -1;}
+    if(dill_slow(self->st.outdone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->st.outerr)) {errno = ECONNRESET; return -1;}
+    /* Hand the buffered data to the kernel. */
+    int rc = dill_tcp_bflush(&self->bvfs, deadline);
+    if(dill_slow(rc < 0)) return -1;
     /* Flushing the tx buffer is done asynchronously on kernel level. */
-    int rc = shutdown(self->fd, SHUT_WR);
+    rc = shutdown(self->st.fd, SHUT_WR);
     if(dill_slow(rc < 0)) {
-        if(errno == ENOTCONN) {self->outerr = 1; errno = ECONNRESET; return -1;}
-        if(errno == ENOBUFS) {self->outerr = 1; errno = ENOMEM; return -1;}
+        if(errno == ENOTCONN) {
+            self->st.outerr = 1;
+            errno = ECONNRESET;
+            return -1;
+        }
+        if(errno == ENOBUFS) {self->st.outerr = 1; errno = ENOMEM; return -1;}
         dill_assert(rc == 0);
     }
-    self->outdone = 1;
+    self->st.outdone = 1;
     return 0;
 }
 
@@ -220,10 +348,13 @@ int dill_tcp_close(int s, int64_t deadline) {
     }
     struct dill_tcp_conn *self = dill_hquery(s, dill_tcp_type);
     if(dill_slow(!self)) return -1;
-    if(dill_slow(self->inerr || self->outerr)) {err = ECONNRESET; goto error;}
+    if(dill_slow(self->st.inerr || self->st.outerr)) {
+        err = ECONNRESET;
+        goto error;
+    }
     /* If not done already, flush the outbound data and start the terminal
        handshake. */
-    if(!self->outdone) {
+    if(!self->st.outdone) {
         int rc = dill_tcp_done(s, deadline);
         if(dill_slow(rc < 0)) {err = errno; goto error;}
     }
@@ -243,8 +374,9 @@ error:
 
 static void dill_tcp_hclose(struct dill_hvfs *hvfs) {
     struct dill_tcp_conn *self = (struct dill_tcp_conn*)hvfs;
-    dill_fd_close(self->fd);
-    dill_fd_termrxbuf(&self->rxbuf);
+    dill_fd_close(self->st.fd);
+    dill_fd_termrxbuf(&self->st.rxbuf);
+    dill_fd_termtxbuf(self->st.txbuf);
     if(!self->mem) free(self);
 }
 
@@ -259,6 +391,10 @@ struct dill_tcp_listener {
     struct dill_hvfs hvfs;
     int fd;
     struct dill_ipaddr addr;
+    /* Settings applied to the accepted connections. See dill_tcp_setopts().
+       'quickack' is -1 if not set. */
+    int quickack;
+    int lowat;
     unsigned int mem : 1;
 };
 
@@ -270,6 +406,8 @@ static int dill_tcp_makelistener(int fd, void *mem) {
     self->hvfs.query = dill_tcp_listener_hquery;
     self->hvfs.close = dill_tcp_listener_hclose;
     self->fd = fd;
+    self->quickack = -1;
+    self->lowat = 0;
     self->mem = 1;
     /* Create the handle. */
     return dill_hmake(&self->hvfs);
@@ -322,16 +460,28 @@ error1:
     return -1;
 }
 
-int dill_tcp_listen_mem(struct dill_ipaddr *addr, int backlog,
-      struct dill_tcp_listener_storage *mem) {
+static int dill_tcp_listen_(struct dill_ipaddr *addr, int backlog,
+      int reuseport, struct dill_tcp_listener_storage *mem) {
     int err;
     if(dill_slow(!mem)) {err = EINVAL; goto error1;}
+#if !defined DILL_TCP_REUSEPORT
+    if(dill_slow(reuseport)) {err = ENOTSUP; goto error1;}
+#endif
     /* Open the listening socket. */
     int s = socket(dill_ipaddr_family(addr), SOCK_STREAM, 0);
     if(dill_slow(s < 0)) {err = errno; goto error1;}
     /* Set it to non-blocking mode. */
     int rc = dill_fd_unblock(s);
     if(dill_slow(rc < 0)) {err = errno; goto error2;}
+#if defined DILL_TCP_REUSEPORT
+    /* Allow other sockets, typically owned by other threads, to listen on
+       the same address. */
+    if(reuseport) {
+        int opt = 1;
+        rc = setsockopt(s, SOL_SOCKET, DILL_TCP_REUSEPORT, &opt, sizeof(opt));
+        if(dill_slow(rc < 0)) {err = errno; goto error2;}
+    }
+#endif
     /* Start listening for incoming connections. */
     rc = bind(s, dill_ipaddr_sockaddr(addr), dill_ipaddr_len(addr));
     if(dill_slow(rc < 0)) {err = errno; goto error2;}
@@ -356,6 +506,16 @@ error1:
     return -1;
 }
 
+int dill_tcp_listen_mem(struct dill_ipaddr *addr, int backlog,
+      struct dill_tcp_listener_storage *mem) {
+    return dill_tcp_listen_(addr, backlog, 0, mem);
+}
+
+int dill_tcp_listen_reuseport_mem(struct dill_ipaddr *addr, int backlog,
+      struct dill_tcp_listener_storage *mem) {
+    return dill_tcp_listen_(addr, backlog, 1, mem);
+}
+
 int dill_tcp_listen(struct dill_ipaddr *addr, int backlog) {
     int err;
     struct dill_tcp_listener *obj = malloc(sizeof(struct dill_tcp_listener));
@@ -372,6 +532,201 @@ error1:
     return -1;
 }
 
+int dill_tcp_listen_reuseport(struct dill_ipaddr *addr, int backlog) {
+    int err;
+    struct dill_tcp_listener *obj = malloc(sizeof(struct dill_tcp_listener));
+    if(dill_slow(!obj)) {err = ENOMEM; goto error1;}
+    int ls = dill_tcp_listen_reuseport_mem(addr, backlog,
+        (struct dill_tcp_listener_storage*)obj);
+    if(dill_slow(ls < 0)) {err = errno; goto error2;}
+    obj->mem = 0;
+    return ls;
+error2:
+    free(obj);
+error1:
+    errno = err;
+    return -1;
+}
+
+int dill_tcp_fastopen(int s, int qlen) {
+    struct dill_tcp_listener *lst = dill_hquery(s, dill_tcp_listener_type);
+    if(dill_slow(!lst)) return -1;
+    if(dill_slow(qlen < 0)) {errno = EINVAL; return -1;}
+#if defined TCP_FASTOPEN
+    int rc = setsockopt(lst->fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen,
+        sizeof(qlen));
+    if(dill_slow(rc < 0)) {
+        if(errno == ENOPROTOOPT) errno = ENOTSUP;
+        return -1;
+    }
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int dill_tcp_reuseport_cpu(int s) {
+    struct dill_tcp_listener *lst = dill_hquery(s, dill_tcp_listener_type);
+    if(dill_slow(!lst)) return -1;
+#if defined __linux__ && defined SO_ATTACH_REUSEPORT_CBPF
+    /* The program returns the number of the CPU that is processing
+       the incoming connection. It is used as an index of the listening
+       socket within the group. If there's no socket with such index,
+       the kernel falls back to the default hash-based balancing. */
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU},
+        {BPF_RET | BPF_A, 0, 0, 0}
+    };
+    struct sock_fprog prog = {sizeof(code) / sizeof(code[0]), code};
+    int rc = setsockopt(lst->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+        sizeof(prog));
+    if(dill_slow(rc < 0)) return -1;
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+void dill_tcp_opts_init(struct dill_tcp_opts *opts) {
+    opts->nodelay = -1;
+    opts->quickack = -1;
+    opts->sndbuf = -1;
+    opts->rcvbuf = -1;
+    opts->keepidle = -1;
+    opts->keepintvl = -1;
+    opts->keepcnt = -1;
+    opts->notsent_lowat = -1;
+}
+
+static int dill_tcp_setopt(int fd, int level, int name, int val) {
+    int rc = setsockopt(fd, level, name, &val, sizeof(val));
+    if(dill_slow(rc < 0)) {
+        if(errno == ENOPROTOOPT) errno = ENOTSUP;
+        return -1;
+    }
+    return 0;
+}
+
+/* Sets all the options except TCP_QUICKACK, which is not a persistent
+   setting and makes no sense on a listening socket. */
+static int dill_tcp_applyopts(int fd, const struct dill_tcp_opts *opts) {
+    int rc;
+    if(opts->nodelay >= 0) {
+        rc = dill_tcp_setopt(fd, IPPROTO_TCP, TCP_NODELAY, !!opts->nodelay);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    if(opts->sndbuf >= 0) {
+        rc = dill_tcp_setopt(fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    if(opts->rcvbuf >= 0) {
+        rc = dill_tcp_setopt(fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    if(opts->keepidle >= 0) {
+        rc = dill_tcp_setopt(fd, SOL_SOCKET, SO_KEEPALIVE, !!opts->keepidle);
+        if(dill_slow(rc < 0)) return -1;
+        if(opts->keepidle) {
+#if defined TCP_KEEPIDLE
+            rc = dill_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                opts->keepidle);
+#elif defined TCP_KEEPALIVE
+            rc = dill_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPALIVE,
+                opts->keepidle);
+#else
+            errno = ENOTSUP;
+            rc = -1;
+#endif
+            if(dill_slow(rc < 0)) return -1;
+        }
+    }
+    if(opts->keepintvl >= 0) {
+#if defined TCP_KEEPINTVL
+        rc = dill_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, opts->keepintvl);
+        if(dill_slow(rc < 0)) return -1;
+#else
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
+    if(opts->keepcnt >= 0) {
+#if defined TCP_KEEPCNT
+        rc = dill_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPCNT, opts->keepcnt);
+        if(dill_slow(rc < 0)) return -1;
+#else
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
+    if(opts->notsent_lowat >= 0) {
+#if defined TCP_NOTSENT_LOWAT
+        rc = dill_tcp_setopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+            opts->notsent_lowat);
+        if(dill_slow(rc < 0)) return -1;
+#else
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
+    return 0;
+}
+
+static int dill_tcp_setquickack(int fd, int quickack) {
+#if defined TCP_QUICKACK
+    return dill_tcp_setopt(fd, IPPROTO_TCP, TCP_QUICKACK, !!quickack);
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int dill_tcp_setopts(int s, const struct dill_tcp_opts *opts) {
+    if(dill_slow(!opts)) {errno = EINVAL; return -1;}
+    if(dill_slow(opts->nodelay < -1 || opts->quickack < -1 ||
+          opts->sndbuf < -1 || opts->rcvbuf < -1 || opts->keepidle < -1 ||
+          opts->keepintvl < -1 || opts->keepintvl == 0 ||
+          opts->keepcnt < -1 || opts->keepcnt == 0 ||
+          opts->notsent_lowat < -1)) {
+        errno = EINVAL; return -1;}
+    /* Options set on a listening socket are inherited by the accepted
+       connections. Those that are not inherited by the kernel are stored
+       and applied on accept. */
+    struct dill_tcp_listener *lst = dill_hquery(s, dill_tcp_listener_type);
+    if(lst) {
+#if !defined TCP_QUICKACK
+        if(dill_slow(opts->quickack >= 0)) {errno = ENOTSUP; return -1;}
+#endif
+        int rc = dill_tcp_applyopts(lst->fd, opts);
+        if(dill_slow(rc < 0)) return -1;
+        if(opts->quickack >= 0) lst->quickack = !!opts->quickack;
+        if(opts->notsent_lowat >= 0) lst->lowat = opts->notsent_lowat;
+        return 0;
+    }
+    struct dill_tcp_conn *self = dill_hquery(s, dill_tcp_type);
+    if(dill_slow(!self)) return -1;
+    if(dill_slow(self->st.sbusy)) {errno = EBUSY; return -1;}
+    int rc = dill_tcp_applyopts(self->st.fd, opts);
+    if(dill_slow(rc < 0)) return -1;
+    if(opts->quickack >= 0) {
+        rc = dill_tcp_setquickack(self->st.fd, opts->quickack);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    if(opts->notsent_lowat >= 0) self->lowat = opts->notsent_lowat;
+    return 0;
+}
+
+/* Applies the socket options that the kernel doesn't pass from
+   the listening socket to the accepted connection. */
+static int dill_tcp_inherit(struct dill_tcp_listener *lst, int fd) {
+    if(lst->quickack >= 0) {
+        int rc = dill_tcp_setquickack(fd, lst->quickack);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    return 0;
+}
+
 int dill_tcp_accept_mem(int s, struct dill_ipaddr *addr,
         struct dill_tcp_storage *mem, int64_t deadline) {
     int err;
@@ -384,12 +739,13 @@ int dill_tcp_accept_mem(int s, struct dill_ipaddr *addr,
     int as = dill_fd_accept(lst->fd, (struct sockaddr*)addr, &addrlen,
         deadline);
     if(dill_slow(as < 0)) {err = errno; goto error1;}
-    /* Set it to non-blocking mode. */
-    int rc = dill_fd_unblock(as);
+    /* Apply the options set on the listener. */
+    int rc = dill_tcp_inherit(lst, as);
     if(dill_slow(rc < 0)) {err = errno; goto error2;}
     /* Create the handle. */
     int h = dill_tcp_makeconn(as, mem);
     if(dill_slow(h < 0)) {err = errno; goto error2;}
+    ((struct dill_tcp_conn*)mem)->lowat = lst->lowat;
     return h;
 error2:
     dill_fd_close(as);
@@ -414,6 +770,51 @@ error1:
     return -1;
 }
 
+ssize_t dill_tcp_accept_many(int s, int *hs, struct dill_ipaddr *addrs,
+      size_t count, int64_t deadline) {
+    if(dill_slow(!hs || !count)) {errno = EINVAL; return -1;}
+    /* Retrieve the listener object. */
+    struct dill_tcp_listener *lst = dill_hquery(s, dill_tcp_listener_type);
+    if(dill_slow(!lst)) return -1;
+    size_t n;
+    for(n = 0; n != count; ++n) {
+        struct dill_ipaddr *addr = addrs ? &addrs[n] : NULL;
+        socklen_t addrlen = sizeof(struct dill_ipaddr);
+        /* Wait only for the first connection. Then take whatever is
+           already in the backlog. */
+        int as;
+        if(n == 0) as = dill_fd_accept(lst->fd, (struct sockaddr*)addr,
+            &addrlen, deadline);
+        else as = dill_fd_tryaccept(lst->fd, (struct sockaddr*)addr,
+            &addrlen);
+        if(dill_slow(as < 0)) break;
+        int rc = dill_tcp_inherit(lst, as);
+        if(dill_slow(rc < 0)) {
+            int err = errno;
+            dill_fd_close(as);
+            errno = err;
+            break;
+        }
+        struct dill_tcp_conn *obj = malloc(sizeof(struct dill_tcp_conn));
+        if(dill_slow(!obj)) {dill_fd_close(as); errno = ENOMEM; break;}
+        int h = dill_tcp_makeconn(as, obj);
+        if(dill_slow(h < 0)) {
+            int err = errno;
+            dill_fd_close(as);
+            free(obj);
+            errno = err;
+            break;
+        }
+        obj->lowat = lst->lowat;
+        obj->mem = 0;
+        hs[n] = h;
+    }
+    /* If some connections were accepted the error, if persistent, will be
+       reported by the next call. */
+    if(dill_slow(n == 0)) return -1;
+    return n;
+}
+
 static void dill_tcp_listener_hclose(struct dill_hvfs *hvfs) {
     struct dill_tcp_listener *self = (struct dill_tcp_listener*)hvfs;
     dill_fd_close(self->fd);
@@ -0,0 +1,114 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "../libdill.h"
+
+#define COUNT 10000
+
+static struct event_storage ping;
+static struct event_storage pong;
+static struct event_storage ready;
+
+/* Plain thread, not using libdill at all. */
+void *signaler(void *arg) {
+    usleep(10000);
+    int rc = event_signal(&ready);
+    errno_assert(rc == 0);
+    return NULL;
+}
+
+/* Thread running a coroutine that bounces the event back. */
+void *ponger(void *arg) {
+    int e = event_open_mem(&ping);
+    errno_assert(e >= 0);
+    int rc = event_signal(&ready);
+    errno_assert(rc == 0);
+    int i;
+    for(i = 0; i != COUNT; ++i) {
+        rc = event_wait(e, -1);
+        errno_assert(rc == 0);
+        rc = event_signal(&pong);
+        errno_assert(rc == 0);
+    }
+    rc = hclose(e);
+    errno_assert(rc == 0);
+    return NULL;
+}
+
+int main() {
+    int e = event_open_mem(&ready);
+    errno_assert(e >= 0);
+
+    /* Deadline. */
+    int64_t start = now();
+    int rc = event_wait(e, start + 50);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    time_assert(now() - start, 50);
+
+    /* Multiple signals are coalesced. */
+    rc = event_signal(&ready);
+    errno_assert(rc == 0);
+    rc = event_signal(&ready);
+    errno_assert(rc == 0);
+    rc = event_wait(e, -1);
+    errno_assert(rc == 0);
+    rc = event_wait(e, 0);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+
+    /* Signaling from a non-libdill thread. */
+    pthread_t t;
+    rc = pthread_create(&t, NULL, signaler, NULL);
+    errno_assert(rc == 0);
+    rc = event_wait(e, -1);
+    errno_assert(rc == 0);
+    rc = pthread_join(t, NULL);
+    errno_assert(rc == 0);
+
+    /* Ping-pong between two libdill threads. */
+    int p = event_open_mem(&pong);
+    errno_assert(p >= 0);
+    rc = pthread_create(&t, NULL, ponger, NULL);
+    errno_assert(rc == 0);
+    rc = event_wait(e, -1);
+    errno_assert(rc == 0);
+    int i;
+    for(i = 0; i != COUNT; ++i) {
+        rc = event_signal(&ping);
+        errno_assert(rc == 0);
+        rc = event_wait(p, -1);
+        errno_assert(rc == 0);
+    }
+    rc = pthread_join(t, NULL);
+    errno_assert(rc == 0);
+
+    rc = hclose(p);
+    errno_assert(rc == 0);
+    rc = hclose(e);
+    errno_assert(rc == 0);
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "../libdill.h"
+
+#define TESTFILE "file.test"
+
+coroutine void writer(int id) {
+    int s = file_open(TESTFILE, O_WRONLY, 0, -1);
+    errno_assert(s >= 0);
+    char buf[1];
+    buf[0] = 'a' + id;
+    int i;
+    for(i = 0; i != 100; ++i) {
+        int rc = file_pwrite(s, buf, 1, id * 100 + i, -1);
+        errno_assert(rc == 0);
+    }
+    int rc = hclose(s);
+    errno_assert(rc == 0);
+}
+
+coroutine void syncer(int s) {
+    int rc = file_sync(s, -1);
+    errno_assert(rc == 0 || errno == ECANCELED);
+}
+
+int main(void) {
+    unlink(TESTFILE);
+
+    /* Opening a non-existent file. */
+    int s = file_open(TESTFILE, O_RDONLY, 0, -1);
+    errno_assert(s == -1 && errno == ENOENT);
+
+    /* Bytestream interface. */
+    s = file_open(TESTFILE, O_RDWR | O_CREAT | O_TRUNC, 0600, -1);
+    errno_assert(s >= 0);
+    int rc = bsend(s, "ABC", 3, -1);
+    errno_assert(rc == 0);
+    struct iolist iol2 = {"GHI", 3, NULL, 0};
+    struct iolist iol1 = {"DEF", 3, &iol2, 0};
+    rc = bsendl(s, &iol1, &iol2, -1);
+    errno_assert(rc == 0);
+    rc = file_sync(s, -1);
+    errno_assert(rc == 0);
+    char buf[16];
+    rc = brecv(s, buf, 1, -1);
+    errno_assert(rc == -1 && errno == EPIPE);
+    rc = hclose(s);
+    errno_assert(rc == 0);
+    s = file_open(TESTFILE, O_RDONLY, 0, -1);
+    errno_assert(s >= 0);
+    rc = brecv(s, buf, 3, -1);
+    errno_assert(rc == 0);
+    assert(memcmp(buf, "ABC", 3) == 0);
+    iol2.iol_base = buf;
+    iol1.iol_base = NULL;
+    rc = brecvl(s, &iol1, &iol2, -1);
+    errno_assert(rc == 0);
+    assert(memcmp(buf, "GHI", 3) == 0);
+    rc = brecv(s, buf, 3, -1);
+    errno_assert(rc == -1 && errno == EPIPE);
+    rc = bsend(s, "ABC", 3, -1);
+    errno_assert(rc == -1 && errno == EBADF);
+    rc = hclose(s);
+    errno_assert(rc == 0);
+
+    /* Positional interface. */
+    s = file_open(TESTFILE, O_RDWR, 0, -1);
+    errno_assert(s >= 0);
+    rc = file_pwrite(s, "XYZ", 3, 12, -1);
+    errno_assert(rc == 0);
+    ssize_t sz = file_pread(s, buf, sizeof(buf), 0, -1);
+    errno_assert(sz == 15);
+    assert(memcmp(buf, "ABCDEFGHI\0\0\0XYZ", 15) == 0);
+    sz = file_pread(s, buf, sizeof(buf), 13, -1);
+    errno_assert(sz == 2);
+    assert(memcmp(buf, "YZ", 2) == 0);
+    sz = file_pread(s, buf, sizeof(buf), 100, -1);
+    errno_assert(sz == 0);
+    sz = file_pread(s, buf, sizeof(buf), -1, -1);
+    errno_assert(sz == -1 && errno == EINVAL);
+    /* Positional operations don't affect the bytestream position. */
+    rc = brecv(s, buf, 3, -1);
+    errno_assert(rc == 0);
+    assert(memcmp(buf, "ABC", 3) == 0);
+    rc = hclose(s);
+    errno_assert(rc == 0);
+
+#if defined DILL_THREADS
+    /* Concurrent access to a single handle. Without helper threads
+       the operations are done synchronously and never overlap. */
+    s = file_open(TESTFILE, O_RDWR, 0, -1);
+    errno_assert(s >= 0);
+    int cr = go(syncer(s));
+    errno_assert(cr >= 0);
+    rc = file_sync(s, -1);
+    errno_assert(rc == -1 && errno == EBUSY);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+    rc = file_sync(s, -1);
+    errno_assert(rc == 0);
+    /* Handle can be closed right after the coroutine blocked on it was
+       canceled. */
+    cr = go(syncer(s));
+    errno_assert(cr >= 0);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+    rc = hclose(s);
+    errno_assert(rc == 0);
+#endif
+
+    /* Multiple coroutines accessing the file in parallel. */
+    s = file_open(TESTFILE, O_RDWR | O_TRUNC, 0, -1);
+    errno_assert(s >= 0);
+    int b = bundle();
+    errno_assert(b >= 0);
+    int i;
+    for(i = 0; i != 4; ++i) {
+        rc = bundle_go(b, writer(i));
+        errno_assert(rc == 0);
+    }
+    rc = bundle_wait(b, -1);
+    errno_assert(rc == 0);
+    rc = hclose(b);
+    errno_assert(rc == 0);
+    char data[400];
+    sz = file_pread(s, data, sizeof(data), 0, -1);
+    errno_assert(sz == 400);
+    for(i = 0; i != sizeof(data); ++i) assert(data[i] == 'a' + i / 100);
+    rc = hclose(s);
+    errno_assert(rc == 0);
+
+    /* Wrapping an existing file descriptor. */
+    int fd = open(TESTFILE, O_RDONLY);
+    errno_assert(fd >= 0);
+    off_t off = lseek(fd, 100, SEEK_SET);
+    errno_assert(off == 100);
+    s = file_fromfd(fd);
+    errno_assert(s >= 0);
+    rc = brecv(s, buf, 3, -1);
+    errno_assert(rc == 0);
+    assert(memcmp(buf, "bbb", 3) == 0);
+    rc = hclose(s);
+    errno_assert(rc == 0);
+
+    /* A non-file handle. */
+    b = bundle();
+    errno_assert(b >= 0);
+    rc = file_sync(b, -1);
+    errno_assert(rc == -1 && errno == ENOTSUP);
+    rc = hclose(b);
+    errno_assert(rc == 0);
+
+    unlink(TESTFILE);
+    return 0;
+}
@@ -40,6 +40,32 @@ static void test_close(struct hvfs *vfs) {
     status = 2;
 }
 
+/* Bytestream socket that implements only the mandatory operations. */
+struct bstest {
+    struct hvfs hvfs;
+    struct bsock_vfs bvfs;
+};
+
+static void *bstest_query(struct hvfs *hvfs, const void *type) {
+    struct bstest *self = (struct bstest*)hvfs;
+    if(type == bsock_type) return &self->bvfs;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static void bstest_close(struct hvfs *hvfs) {
+}
+
+static int bstest_bsendl(struct bsock_vfs *bvfs,
+      struct iolist *first, struct iolist *last, int64_t deadline) {
+    return 0;
+}
+
+static int bstest_brecvl(struct bsock_vfs *bvfs,
+      struct iolist *first, struct iolist *last, int64_t deadline) {
+    return 0;
+}
+
 int main(void) {
 
     struct test t;
@@ -67,6 +93,26 @@ int main(void) {
     rc = hclose(ch[1]);
     errno_assert(rc == 0);
 
+    /* Optional bytestream operations. */
+    struct bstest bs;
+    bs.hvfs.query = bstest_query;
+    bs.hvfs.close = bstest_close;
+    bs.bvfs.bsendl = bstest_bsendl;
+    bs.bvfs.brecvl = bstest_brecvl;
+    bs.bvfs.bflush = NULL;
+    bs.bvfs.brecvsomel = NULL;
+    h = hmake(&bs.hvfs);
+    errno_assert(h >= 0);
+    rc = bsend(h, "ABC", 3, -1);
+    errno_assert(rc == 0);
+    rc = bflush(h, -1);
+    errno_assert(rc == 0);
+    char buf[3];
+    ssize_t sz = brecvsome(h, buf, sizeof(buf), -1);
+    errno_assert(sz == -1 && errno == ENOTSUP);
+    rc = hclose(h);
+    errno_assert(rc == 0);
+
     return 0;
 }
 
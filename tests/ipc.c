@@ -198,6 +198,31 @@ int main() {
     rc = hclose(s[1]);
     errno_assert(rc == 0);
 
+    /* Iolists longer than IOV_MAX. */
+    rc = ipc_pair(s);
+    errno_assert(rc == 0);
+    static struct iolist liol[3000];
+    static uint8_t lbuf[3000];
+    int i;
+    for(i = 0; i != 3000; ++i) {
+        lbuf[i] = (uint8_t)i;
+        liol[i].iol_base = &lbuf[i];
+        liol[i].iol_len = 1;
+        liol[i].iol_next = i == 2999 ? NULL : &liol[i + 1];
+        liol[i].iol_rsvd = 0;
+    }
+    rc = bsendl(s[0], &liol[0], &liol[2999], -1);
+    errno_assert(rc == 0);
+    memset(lbuf, 0, sizeof(lbuf));
+    rc = brecvl(s[1], &liol[0], &liol[2999], -1);
+    errno_assert(rc == 0);
+    for(i = 0; i != 3000; ++i)
+        assert(lbuf[i] == (uint8_t)i);
+    rc = hclose(s[0]);
+    errno_assert(rc == 0);
+    rc = hclose(s[1]);
+    errno_assert(rc == 0);
+
     /* Try skipping some data using an iolist. */
     rc = ipc_pair(s);
     errno_assert(rc == 0);
@@ -62,6 +62,13 @@ coroutine void receiver(int ch) {
     errno_assert(rc == 0);
 }
 
+coroutine void raiser(int signo) {
+    int rc = msleep(now() + 50);
+    errno_assert(rc == 0);
+    rc = kill(getpid(), signo);
+    errno_assert(rc == 0);
+}
+
 int main() {
     int err = pipe(signal_pipe);
     errno_assert(err == 0);
@@ -104,6 +111,34 @@ int main() {
     rc = hclose(recvch[1]);
     errno_assert(rc == 0);
 
+    /* Wait for signals using signal handle. */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    sigaddset(&set, SIGHUP);
+    int s = signal_open(&set);
+    errno_assert(s >= 0);
+    rc = signal_wait(s, now() + 50);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    rc = kill(getpid(), SIGUSR2);
+    errno_assert(rc == 0);
+    rc = signal_wait(s, -1);
+    errno_assert(rc == SIGUSR2);
+    int cr = go(raiser(SIGHUP));
+    errno_assert(cr >= 0);
+    rc = signal_wait(s, -1);
+    errno_assert(rc == SIGHUP);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+    for(i = 0; i < COUNT; ++i) {
+        rc = kill(getpid(), SIGUSR2);
+        errno_assert(rc == 0);
+        rc = signal_wait(s, -1);
+        errno_assert(rc == SIGUSR2);
+    }
+    rc = hclose(s);
+    errno_assert(rc == 0);
+
     return 0;
 }
 
@@ -0,0 +1,197 @@
+/*
+
+  Copyright (c) 2016 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "../libdill.h"
+
+coroutine static void sleeper(int64_t deadline) {
+    msleep(deadline);
+}
+
+coroutine static void ready_check(void) {
+    struct stats s;
+    int rc = stats(&s);
+    errno_assert(rc == 0);
+    assert(s.ready == 1);
+    assert(s.coroutines == 1);
+}
+
+coroutine static void reader(int fd) {
+    int rc = fdin(fd, -1);
+    errno_assert(rc == 0);
+}
+
+coroutine static void hog(int64_t deadline) {
+    /* Keep the CPU busy without yielding. */
+    while(now() < deadline) {}
+}
+
+int main() {
+    struct stats s0, s1;
+    int rc = stats(&s0);
+    errno_assert(rc == 0);
+    assert(s0.coroutines == 0);
+    assert(s0.ready == 0);
+    assert(s0.timers == 0);
+
+    /* Coroutines, stacks and timers. */
+    int h = go(sleeper(now() + 1000));
+    errno_assert(h >= 0);
+    rc = stats(&s1);
+    errno_assert(rc == 0);
+    assert(s1.coroutines == 1);
+    assert(s1.spawns == s0.spawns + 1);
+    assert(s1.switches >= s0.switches + 2);
+    assert(s1.timers == 1);
+    assert(s1.stackhits + s1.stackmisses ==
+        s0.stackhits + s0.stackmisses + 1);
+    rc = hclose(h);
+    errno_assert(rc == 0);
+    rc = stats(&s1);
+    errno_assert(rc == 0);
+    assert(s1.coroutines == 0);
+    assert(s1.timers == 0);
+    assert(s1.stackcached >= 1);
+    /* The stack is reused from the cache. */
+    s0 = s1;
+    h = go(sleeper(now() - 1));
+    errno_assert(h >= 0);
+    rc = stats(&s1);
+    errno_assert(rc == 0);
+    assert(s1.stackhits == s0.stackhits + 1);
+    assert(s1.stackmisses == s0.stackmisses);
+    /* Let the timer expire. */
+    rc = msleep(now() + 10);
+    errno_assert(rc == 0);
+    rc = stats(&s1);
+    errno_assert(rc == 0);
+    assert(s1.timeouts >= s0.timeouts + 2);
+    assert(s1.polls > s0.polls);
+    /* Finished coroutine is deallocated even before its handle is closed. */
+    assert(s1.coroutines == 0);
+    rc = hclose(h);
+    errno_assert(rc == 0);
+
+    /* Ready queue. While the child is running, the parent is ready. */
+    h = go(ready_check());
+    errno_assert(h >= 0);
+    rc = hclose(h);
+    errno_assert(rc == 0);
+    rc = stats(&s0);
+    errno_assert(rc == 0);
+    assert(s0.ready == 0);
+
+    /* Pollset. */
+    int fds[2];
+    rc = pipe(fds);
+    errno_assert(rc == 0);
+    rc = stats(&s0);
+    errno_assert(rc == 0);
+    h = go(reader(fds[0]));
+    errno_assert(h >= 0);
+    ssize_t sz = write(fds[1], "A", 1);
+    errno_assert(sz == 1);
+    rc = msleep(now() + 10);
+    errno_assert(rc == 0);
+    rc = stats(&s1);
+    errno_assert(rc == 0);
+    assert(s1.pollevents > s0.pollevents);
+    assert(s1.pollchanges > s0.pollchanges);
+    rc = hclose(h);
+    errno_assert(rc == 0);
+    rc = fdclean(fds[0]);
+    errno_assert(rc == 0);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* Latency histograms. */
+    struct latency l;
+    rc = latency_enable(1);
+    assert(rc == 0);
+    rc = pipe(fds);
+    errno_assert(rc == 0);
+    h = go(reader(fds[0]));
+    errno_assert(h >= 0);
+    sz = write(fds[1], "A", 1);
+    errno_assert(sz == 1);
+    rc = msleep(now() + 10);
+    errno_assert(rc == 0);
+    rc = latency(&l, 0);
+    errno_assert(rc == 0);
+    /* Both the reader and the sleeping main coroutine were woken up. */
+    assert(l.wakeup.count >= 2);
+    assert(l.wakeup.sum >= l.wakeup.max);
+    uint64_t total = 0;
+    int i;
+    for(i = 0; i != HISTOGRAM_BUCKETS; ++i)
+        total += l.wakeup.buckets[i];
+    assert(total == l.wakeup.count);
+    rc = hclose(h);
+    errno_assert(rc == 0);
+    rc = fdclean(fds[0]);
+    errno_assert(rc == 0);
+    close(fds[0]);
+    close(fds[1]);
+    /* A coroutine hogging the CPU shows up as a long loop iteration. */
+    h = go(hog(now() + 20));
+    errno_assert(h >= 0);
+    rc = msleep(now() + 10);
+    errno_assert(rc == 0);
+    rc = latency(&l, 1);
+    errno_assert(rc == 0);
+    assert(l.loop.count >= 1);
+    /* now() is coarse-grained, so allow some slack. */
+    assert(l.loop.max >= 10000000);
+    rc = hclose(h);
+    errno_assert(rc == 0);
+    /* The histograms were reset. */
+    rc = latency(&l, 0);
+    errno_assert(rc == 0);
+    assert(l.loop.count == 0);
+    assert(l.wakeup.count == 0);
+    rc = latency_enable(0);
+    assert(rc == 1);
+    rc = latency(NULL, 0);
+    assert(rc == -1 && errno == EINVAL);
+
+    /* Busy polling. Spinning doesn't delay timers. Events arriving while
+       spinning are tested in tests/threads.c. */
+    rc = busypoll(1000000, 0);
+    errno_assert(rc == 0);
+    int64_t start = now();
+    rc = msleep(start + 10);
+    errno_assert(rc == 0);
+    assert(now() - start < 500);
+    rc = busypoll(0, 0);
+    errno_assert(rc == 0);
+    rc = busypoll(-1, 0);
+    assert(rc == -1 && errno == EINVAL);
+    rc = busypoll(100, 2);
+    assert(rc == -1 && errno == EINVAL);
+
+    return 0;
+}
@@ -28,7 +28,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
 #include <pthread.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -101,6 +103,23 @@ coroutine void client4(int port) {
     errno_assert(rc == -1 && errno == ETIMEDOUT);
 }
 
+coroutine void client5(int port, int n) {
+    struct ipaddr addr;
+    int rc = ipaddr_remote(&addr, "127.0.0.1", port, 0, -1);
+    errno_assert(rc == 0);
+    int cs = tcp_connect(&addr, -1);
+    errno_assert(cs >= 0);
+    uint8_t buf[3000];
+    int i;
+    for(i = 0; i != n; ++i) {
+        memset(buf, (uint8_t)i, sizeof(buf));
+        rc = bsend(cs, buf, sizeof(buf), -1);
+        errno_assert(rc == 0);
+    }
+    rc = tcp_close(cs, -1);
+    errno_assert(rc == 0);
+}
+
 coroutine void tcp_forward(int s1, int s2, int ch) {
     uint8_t c;
     while (1) {
@@ -145,6 +164,25 @@ coroutine void tcp_proxy(int s1, int s2) {
     return;
 }
 
+coroutine void relay(int s1, int s2, int ch) {
+    uint64_t nbytes[2];
+    int rc = brelay(s1, s2, nbytes, -1);
+    errno_assert(rc == 0);
+    rc = chsend(ch, nbytes, sizeof(nbytes), -1);
+    errno_assert(rc == 0);
+}
+
+coroutine void sendzc(int s, uint8_t *buf, size_t len) {
+    int rc = bsend(s, "ABC", 3, -1);
+    errno_assert(rc == 0);
+    rc = bsend(s, buf, len, -1);
+    errno_assert(rc == 0);
+    /* The buffer is not used by the kernel any more. */
+    memset(buf, 0, len);
+    rc = bsend(s, "DEF", 3, -1);
+    errno_assert(rc == 0);
+}
+
 coroutine void tcp_echo(int s) {
     while (1) {
         uint8_t c;
@@ -156,6 +194,45 @@ coroutine void tcp_echo(int s) {
     return;
 }
 
+coroutine void pool_server(int ls, int *accepted) {
+    int b = bundle();
+    errno_assert(b >= 0);
+    while(1) {
+        int s = tcp_accept(ls, NULL, -1);
+        if(s < 0 && errno == ECANCELED) break;
+        errno_assert(s >= 0);
+        (*accepted)++;
+        int rc = bundle_go(b, tcp_echo(s));
+        errno_assert(rc == 0);
+    }
+    int rc = hclose(b);
+    errno_assert(rc == 0);
+}
+
+coroutine void pool_release(int p, int s, int reuse) {
+    int rc = msleep(now() + 20);
+    errno_assert(rc == 0);
+    rc = tcp_pool_release(p, s, reuse);
+    errno_assert(rc == 0);
+}
+
+coroutine void pool_timeout(int p, const struct ipaddr *addr) {
+    int rc = tcp_pool_connect(p, addr, now() + 50);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+}
+
+coroutine void pool_drain(int ls) {
+    int rc = msleep(now() + 20);
+    errno_assert(rc == 0);
+    while(1) {
+        int s = tcp_accept(ls, NULL, now() + 10);
+        if(s < 0 && errno == ETIMEDOUT) break;
+        errno_assert(s >= 0);
+        rc = hclose(s);
+        errno_assert(rc == 0);
+    }
+}
+
 coroutine void middle_segment(void) {
     struct ipaddr laddr, raddr;
     int rc = ipaddr_local(&laddr, NULL, 5678, 0);
@@ -244,6 +321,7 @@ static void tcp_concurrency_test(void) {
 
 static void move_lots_of_data(size_t nbytes, size_t buffer_size);
 static void test_fromfd();
+static void test_opts();
 
 int main(void) {
     char buf[16];
@@ -301,6 +379,299 @@ int main(void) {
     rc = hclose(cr);
     errno_assert(rc == 0);
 
+    /* Reads larger than the initial rx buffer. The buffer should grow
+       and start being used. */
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    cr = go(client5(5555, 64));
+    errno_assert(cr >= 0);
+    as = tcp_accept(ls, NULL, -1);
+    errno_assert(as >= 0);
+    struct stats st0, st1;
+    rc = stats(&st0);
+    errno_assert(rc == 0);
+    uint8_t field[3000];
+    int i;
+    for(i = 0; i != 64; ++i) {
+        rc = brecv(as, field, sizeof(field), -1);
+        errno_assert(rc == 0);
+        int j;
+        for(j = 0; j != sizeof(field); ++j)
+            assert(field[j] == (uint8_t)i);
+    }
+    rc = stats(&st1);
+    errno_assert(rc == 0);
+    assert(st1.rxbufhits + st1.rxbufmisses >
+        st0.rxbufhits + st0.rxbufmisses);
+    rc = tcp_close(as, -1);
+    errno_assert(rc == 0);
+    rc = bundle_wait(cr, -1);
+    errno_assert(rc == 0);
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+
+    /* Write coalescing. */
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    int cs = tcp_connect(&addr, -1);
+    errno_assert(cs >= 0);
+    as = tcp_accept(ls, NULL, -1);
+    errno_assert(as >= 0);
+    rc = tcp_cork(as, 64);
+    errno_assert(rc == 0);
+    rc = bsend(as, "AB", 2, -1);
+    errno_assert(rc == 0);
+    rc = bsend(as, "C", 1, -1);
+    errno_assert(rc == 0);
+    rc = tcp_cork(as, 128);
+    errno_assert(rc == -1 && errno == EBUSY);
+    rc = bflush(as, -1);
+    errno_assert(rc == 0);
+    rc = brecv(cs, buf, 3, -1);
+    errno_assert(rc == 0);
+    assert(buf[0] == 'A' && buf[1] == 'B' && buf[2] == 'C');
+    /* Data that don't fit into the buffer are sent straight away. */
+    rc = bsend(as, "D", 1, -1);
+    errno_assert(rc == 0);
+    uint8_t big[100];
+    memset(big, 'E', sizeof(big));
+    rc = bsend(as, big, sizeof(big), -1);
+    errno_assert(rc == 0);
+    rc = brecv(cs, big, sizeof(big), -1);
+    errno_assert(rc == 0);
+    assert(big[0] == 'D' && big[1] == 'E');
+    /* Without a flush the data stay in the buffer. */
+    rc = bsend(as, "F", 1, -1);
+    errno_assert(rc == 0);
+    rc = brecv(cs, buf, 2, now() + 50);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    rc = hclose(cs);
+    errno_assert(rc == 0);
+    rc = hclose(as);
+    errno_assert(rc == 0);
+    /* Blocking read flushes the buffer. */
+    cr = go(client2(5555));
+    errno_assert(cr >= 0);
+    as = tcp_accept(ls, NULL, -1);
+    errno_assert(as >= 0);
+    rc = tcp_cork(as, 64);
+    errno_assert(rc == 0);
+    rc = bsend(as, "A", 1, -1);
+    errno_assert(rc == 0);
+    rc = bsend(as, "BC", 2, -1);
+    errno_assert(rc == 0);
+    rc = brecv(as, buf, 3, -1);
+    errno_assert(rc == 0);
+    assert(buf[0] == 'D' && buf[1] == 'E' && buf[2] == 'F');
+    rc = brecv(as, buf, sizeof(buf), -1);
+    errno_assert(rc == -1 && errno == EPIPE);
+    rc = tcp_close(as, -1);
+    errno_assert(rc == 0);
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+
+    /* Partial reads. */
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    cs = tcp_connect(&addr, -1);
+    errno_assert(cs >= 0);
+    as = tcp_accept(ls, NULL, -1);
+    errno_assert(as >= 0);
+    rc = bsend(as, "ABCDE", 5, -1);
+    errno_assert(rc == 0);
+    ssize_t ssz = brecvsome(cs, buf, 3, -1);
+    errno_assert(ssz == 3);
+    assert(buf[0] == 'A' && buf[1] == 'B' && buf[2] == 'C');
+    ssz = brecvsome(cs, buf, sizeof(buf), -1);
+    errno_assert(ssz == 2);
+    assert(buf[0] == 'D' && buf[1] == 'E');
+    rc = bsend(as, big, sizeof(big), -1);
+    errno_assert(rc == 0);
+    rc = tcp_done(as, -1);
+    errno_assert(rc == 0);
+    uint8_t large[65536];
+    size_t total = 0;
+    while(1) {
+        ssz = brecvsome(cs, large, sizeof(large), -1);
+        if(ssz < 0) break;
+        assert(ssz > 0);
+        total += ssz;
+    }
+    errno_assert(errno == EPIPE);
+    assert(total == sizeof(big));
+    rc = hclose(cs);
+    errno_assert(rc == 0);
+    rc = hclose(as);
+    errno_assert(rc == 0);
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+
+    /* Relay. */
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    cs = tcp_connect(&addr, -1);
+    errno_assert(cs >= 0);
+    as = tcp_accept(ls, NULL, -1);
+    errno_assert(as >= 0);
+    int cs2 = tcp_connect(&addr, -1);
+    errno_assert(cs2 >= 0);
+    int as2 = tcp_accept(ls, NULL, -1);
+    errno_assert(as2 >= 0);
+    /* Leave some data in the receive buffer of the relayed socket. */
+    rc = bsend(cs, "ABCDE", 5, -1);
+    errno_assert(rc == 0);
+    rc = brecv(as, buf, 1, -1);
+    errno_assert(rc == 0);
+    int rch[2];
+    rc = chmake(rch);
+    errno_assert(rc == 0);
+    cr = go(relay(as, cs2, rch[1]));
+    errno_assert(cr >= 0);
+    memset(large, 'x', sizeof(large));
+    rc = bsend(cs, large, sizeof(large), -1);
+    errno_assert(rc == 0);
+    rc = tcp_done(cs, -1);
+    errno_assert(rc == 0);
+    rc = brecv(as2, buf, 4, -1);
+    errno_assert(rc == 0);
+    assert(buf[0] == 'B' && buf[1] == 'C' && buf[2] == 'D' && buf[3] == 'E');
+    total = 0;
+    while(1) {
+        ssz = brecvsome(as2, large, sizeof(large), -1);
+        if(ssz < 0) break;
+        assert(large[0] == 'x' && large[ssz - 1] == 'x');
+        total += ssz;
+    }
+    errno_assert(errno == EPIPE);
+    assert(total == sizeof(large));
+    rc = bsend(as2, "FGH", 3, -1);
+    errno_assert(rc == 0);
+    rc = tcp_done(as2, -1);
+    errno_assert(rc == 0);
+    rc = brecv(cs, buf, 3, -1);
+    errno_assert(rc == 0);
+    assert(buf[0] == 'F' && buf[1] == 'G' && buf[2] == 'H');
+    rc = brecv(cs, buf, 1, -1);
+    errno_assert(rc == -1 && errno == EPIPE);
+    uint64_t relayed[2];
+    rc = chrecv(rch[0], relayed, sizeof(relayed), -1);
+    errno_assert(rc == 0);
+    assert(relayed[0] == sizeof(large) + 4);
+    assert(relayed[1] == 3);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+    rc = hclose(rch[1]);
+    errno_assert(rc == 0);
+    rc = hclose(rch[0]);
+    errno_assert(rc == 0);
+    rc = hclose(as2);
+    errno_assert(rc == 0);
+    rc = hclose(cs2);
+    errno_assert(rc == 0);
+    rc = hclose(as);
+    errno_assert(rc == 0);
+    rc = hclose(cs);
+    errno_assert(rc == 0);
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+
+    /* Zero-copy sending. */
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    cs = tcp_connect(&addr, -1);
+    errno_assert(cs >= 0);
+    as = tcp_accept(ls, NULL, -1);
+    errno_assert(as >= 0);
+    rc = tcp_zerocopy(cs, 16384);
+    if(rc == 0) {
+        uint8_t *zcbuf = malloc(1000000);
+        assert(zcbuf);
+        memset(zcbuf, 'x', 1000000);
+        cr = go(sendzc(cs, zcbuf, 1000000));
+        errno_assert(cr >= 0);
+        rc = brecv(as, buf, 3, -1);
+        errno_assert(rc == 0);
+        assert(buf[0] == 'A' && buf[1] == 'B' && buf[2] == 'C');
+        total = 0;
+        while(total < 1000000) {
+            size_t chunk = 1000000 - total;
+            if(chunk > sizeof(large)) chunk = sizeof(large);
+            rc = brecv(as, large, chunk, -1);
+            errno_assert(rc == 0);
+            assert(large[0] == 'x' && large[chunk - 1] == 'x');
+            total += chunk;
+        }
+        rc = brecv(as, buf, 3, -1);
+        errno_assert(rc == 0);
+        assert(buf[0] == 'D' && buf[1] == 'E' && buf[2] == 'F');
+        rc = bundle_wait(cr, -1);
+        errno_assert(rc == 0);
+        rc = hclose(cr);
+        errno_assert(rc == 0);
+        free(zcbuf);
+    }
+    else {
+        errno_assert(errno == ENOTSUP);
+    }
+    rc = hclose(cs);
+    errno_assert(rc == 0);
+    rc = hclose(as);
+    errno_assert(rc == 0);
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+
+    /* Sending a file. */
+    char fname[] = "/tmp/libdill-test-XXXXXX";
+    int fd = mkstemp(fname);
+    errno_assert(fd >= 0);
+    rc = unlink(fname);
+    errno_assert(rc == 0);
+    int k;
+    for(k = 0; k != sizeof(large); ++k) large[k] = (uint8_t)k;
+    ssz = write(fd, large, sizeof(large));
+    errno_assert(ssz == sizeof(large));
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    cs = tcp_connect(&addr, -1);
+    errno_assert(cs >= 0);
+    as = tcp_accept(ls, NULL, -1);
+    errno_assert(as >= 0);
+    rc = tcp_cork(cs, 1000);
+    errno_assert(rc == 0);
+    rc = bsend(cs, "ABC", 3, -1);
+    errno_assert(rc == 0);
+    rc = bsendfile(cs, fd, 1000, 50000, -1);
+    errno_assert(rc == 0);
+    rc = brecv(as, buf, 3, -1);
+    errno_assert(rc == 0);
+    assert(buf[0] == 'A' && buf[1] == 'B' && buf[2] == 'C');
+    rc = brecv(as, large, 50000, -1);
+    errno_assert(rc == 0);
+    for(k = 0; k != 50000; ++k) assert(large[k] == (uint8_t)(k + 1000));
+    /* The file is too short. Nothing is sent and the socket can still
+       be used. */
+    rc = bsendfile(cs, fd, 70000, 10, -1);
+    errno_assert(rc == -1 && errno == EINVAL);
+    rc = bsend(cs, "DEF", 3, -1);
+    errno_assert(rc == 0);
+    rc = bflush(cs, -1);
+    errno_assert(rc == 0);
+    rc = brecv(as, buf, 3, -1);
+    errno_assert(rc == 0);
+    assert(buf[0] == 'D' && buf[1] == 'E' && buf[2] == 'F');
+    rc = hclose(cs);
+    errno_assert(rc == 0);
+    rc = hclose(as);
+    errno_assert(rc == 0);
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+    rc = close(fd);
+    errno_assert(rc == 0);
+
     /* Manual termination handshake. */
     ls = tcp_listen(&addr, 10);
     errno_assert(ls >= 0);
@@ -324,6 +695,259 @@ int main(void) {
     rc = hclose(cr);
     errno_assert(rc == 0);    
 
+    /* Accepting multiple connections in one go. The handshakes are done
+       by the kernel, so the connections can be established beforehand. */
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    struct ipaddr caddr;
+    rc = ipaddr_remote(&caddr, "127.0.0.1", 5555, 0, -1);
+    errno_assert(rc == 0);
+    int ccs[5];
+    for(i = 0; i != 5; ++i) {
+        ccs[i] = tcp_connect(&caddr, -1);
+        errno_assert(ccs[i] >= 0);
+    }
+    int hs[10];
+    struct ipaddr haddrs[10];
+    int accepted = 0;
+    while(accepted < 5) {
+        ssize_t n = tcp_accept_many(ls, hs + accepted, haddrs + accepted,
+            10 - accepted, now() + 1000);
+        errno_assert(n > 0);
+        accepted += n;
+    }
+    assert(accepted == 5);
+    for(i = 0; i != 5; ++i) {
+        assert(ipaddr_port(&haddrs[i]) != 0);
+        rc = bsend(hs[i], "A", 1, -1);
+        errno_assert(rc == 0);
+    }
+    for(i = 0; i != 5; ++i) {
+        rc = brecv(ccs[i], buf, 1, -1);
+        errno_assert(rc == 0);
+        assert(buf[0] == 'A');
+    }
+    ssize_t nhs = tcp_accept_many(ls, hs + 5, NULL, 5, now() + 50);
+    errno_assert(nhs < 0 && errno == ETIMEDOUT);
+    for(i = 0; i != 5; ++i) {
+        rc = hclose(hs[i]);
+        errno_assert(rc == 0);
+        rc = hclose(ccs[i]);
+        errno_assert(rc == 0);
+    }
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+
+    /* Listeners sharing the same port. The kernel spreads the incoming
+       connections among them. */
+    int ls1 = tcp_listen_reuseport(&addr, 10);
+    errno_assert(ls1 >= 0);
+    int ls2 = tcp_listen_reuseport(&addr, 10);
+    errno_assert(ls2 >= 0);
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls < 0 && errno == EADDRINUSE);
+    rc = tcp_reuseport_cpu(ls1);
+    errno_assert(rc == 0);
+    for(i = 0; i != 5; ++i) {
+        ccs[i] = tcp_connect(&caddr, -1);
+        errno_assert(ccs[i] >= 0);
+    }
+    accepted = 0;
+    while(accepted < 5) {
+        ssize_t n = tcp_accept_many(ls1, hs + accepted, NULL, 10 - accepted,
+            now() + 50);
+        if(n < 0) {
+            errno_assert(errno == ETIMEDOUT);
+            n = tcp_accept_many(ls2, hs + accepted, NULL, 10 - accepted,
+                now() + 50);
+            errno_assert(n > 0 || errno == ETIMEDOUT);
+            if(n < 0) continue;
+        }
+        accepted += n;
+    }
+    assert(accepted == 5);
+    for(i = 0; i != 5; ++i) {
+        rc = hclose(hs[i]);
+        errno_assert(rc == 0);
+        rc = hclose(ccs[i]);
+        errno_assert(rc == 0);
+    }
+    /* Remaining listener gets all the new connections. */
+    rc = hclose(ls1);
+    errno_assert(rc == 0);
+    ccs[0] = tcp_connect(&caddr, -1);
+    errno_assert(ccs[0] >= 0);
+    hs[0] = tcp_accept(ls2, NULL, now() + 1000);
+    errno_assert(hs[0] >= 0);
+    rc = hclose(hs[0]);
+    errno_assert(rc == 0);
+    rc = hclose(ccs[0]);
+    errno_assert(rc == 0);
+    rc = hclose(ls2);
+    errno_assert(rc == 0);
+
+    /* TCP Fast Open. If the system doesn't support it, the data are sent
+       after the connection is established. Otherwise, the first connection
+       gets the cookie and the subsequent ones send the data in the SYN. */
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    rc = tcp_fastopen(ls, 10);
+    errno_assert(rc == 0 || errno == ENOTSUP);
+    for(i = 0; i != 3; ++i) {
+        struct iolist iol2 = {(void*)"DEF", 3, NULL, 0};
+        struct iolist iol1 = {(void*)"ABC", 3, &iol2, 0};
+        ccs[0] = tcp_connectl(&caddr, &iol1, &iol2, -1);
+        errno_assert(ccs[0] >= 0);
+        hs[0] = tcp_accept(ls, NULL, -1);
+        errno_assert(hs[0] >= 0);
+        rc = brecv(hs[0], buf, 6, -1);
+        errno_assert(rc == 0);
+        assert(memcmp(buf, "ABCDEF", 6) == 0);
+        rc = bsend(hs[0], "GHI", 3, -1);
+        errno_assert(rc == 0);
+        rc = brecv(ccs[0], buf, 3, -1);
+        errno_assert(rc == 0);
+        assert(memcmp(buf, "GHI", 3) == 0);
+        rc = hclose(hs[0]);
+        errno_assert(rc == 0);
+        rc = hclose(ccs[0]);
+        errno_assert(rc == 0);
+    }
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+
+    /* Connection pool. */
+    ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    accepted = 0;
+    cr = go(pool_server(ls, &accepted));
+    errno_assert(cr >= 0);
+    int p = tcp_pool(2, 100, 0);
+    errno_assert(p >= 0);
+    hs[0] = tcp_pool_connect(p, &caddr, -1);
+    errno_assert(hs[0] >= 0);
+    rc = bsend(hs[0], "A", 1, -1);
+    errno_assert(rc == 0);
+    rc = brecv(hs[0], buf, 1, -1);
+    errno_assert(rc == 0);
+    rc = tcp_pool_release(p, hs[0], 1);
+    errno_assert(rc == 0);
+    /* Idle connection is handed out again. */
+    hs[1] = tcp_pool_connect(p, &caddr, -1);
+    assert(hs[1] == hs[0]);
+    /* Number of connections to the destination is capped. */
+    hs[2] = tcp_pool_connect(p, &caddr, -1);
+    errno_assert(hs[2] >= 0);
+    rc = tcp_pool_connect(p, &caddr, now() + 50);
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    int rl = go(pool_release(p, hs[2], 1));
+    errno_assert(rl >= 0);
+    hs[3] = tcp_pool_connect(p, &caddr, -1);
+    assert(hs[3] == hs[2]);
+    rc = hclose(rl);
+    errno_assert(rc == 0);
+    rc = msleep(now() + 20);
+    errno_assert(rc == 0);
+    assert(accepted == 2);
+    /* Connections released without reuse are closed. */
+    rc = tcp_pool_release(p, hs[3], 0);
+    errno_assert(rc == 0);
+    rc = tcp_pool_release(p, hs[3], 1);
+    errno_assert(rc == -1 && errno == EINVAL);
+    /* Idle connections expire. */
+    rc = tcp_pool_release(p, hs[1], 1);
+    errno_assert(rc == 0);
+    rc = msleep(now() + 200);
+    errno_assert(rc == 0);
+    hs[0] = tcp_pool_connect(p, &caddr, -1);
+    errno_assert(hs[0] >= 0);
+    rc = bsend(hs[0], "B", 1, -1);
+    errno_assert(rc == 0);
+    rc = brecv(hs[0], buf, 1, -1);
+    errno_assert(rc == 0);
+    assert(accepted == 3);
+    /* Destinations given by name are distinct from those given by address. */
+    hs[1] = tcp_pool_connect_name(p, "127.0.0.1", 5555, -1);
+    errno_assert(hs[1] >= 0);
+    rc = tcp_pool_release(p, hs[1], 1);
+    errno_assert(rc == 0);
+    hs[2] = tcp_pool_connect_name(p, "127.0.0.1", 5555, -1);
+    assert(hs[2] == hs[1]);
+    rc = msleep(now() + 20);
+    errno_assert(rc == 0);
+    assert(accepted == 4);
+    rc = tcp_pool_release(p, hs[2], 1);
+    errno_assert(rc == 0);
+    /* Waiter is woken up when the last connection to the destination is
+       closed. */
+    int p2 = tcp_pool(1, 100, 0);
+    errno_assert(p2 >= 0);
+    hs[1] = tcp_pool_connect(p2, &caddr, -1);
+    errno_assert(hs[1] >= 0);
+    rl = go(pool_release(p2, hs[1], 0));
+    errno_assert(rl >= 0);
+    hs[2] = tcp_pool_connect(p2, &caddr, now() + 1000);
+    errno_assert(hs[2] >= 0);
+    rc = hclose(rl);
+    errno_assert(rc == 0);
+    rc = msleep(now() + 20);
+    errno_assert(rc == 0);
+    assert(accepted == 6);
+    rc = tcp_pool_release(p2, hs[2], 0);
+    errno_assert(rc == 0);
+    /* Waiter is woken up when the connection attempt that took the last
+       slot fails. The listener's backlog is filled up so that the attempt
+       hangs. */
+    struct ipaddr addr2;
+    rc = ipaddr_local(&addr2, NULL, 5557, 0);
+    errno_assert(rc == 0);
+    ls2 = tcp_listen(&addr2, 0);
+    errno_assert(ls2 >= 0);
+    int fill[4];
+    for(i = 0; i != 4; ++i) {
+        fill[i] = socket(AF_INET, SOCK_STREAM, 0);
+        errno_assert(fill[i] >= 0);
+        int opt = fcntl(fill[i], F_GETFL, 0);
+        errno_assert(opt >= 0);
+        rc = fcntl(fill[i], F_SETFL, opt | O_NONBLOCK);
+        errno_assert(rc == 0);
+        rc = connect(fill[i], ipaddr_sockaddr(&addr2), ipaddr_len(&addr2));
+        errno_assert(rc == 0 || errno == EINPROGRESS);
+    }
+    int rt = go(pool_timeout(p2, &addr2));
+    errno_assert(rt >= 0);
+    int rd = go(pool_drain(ls2));
+    errno_assert(rd >= 0);
+    hs[1] = tcp_pool_connect(p2, &addr2, now() + 500);
+    errno_assert(hs[1] >= 0);
+    rc = tcp_pool_release(p2, hs[1], 0);
+    errno_assert(rc == 0);
+    rc = hclose(rt);
+    errno_assert(rc == 0);
+    rc = hclose(rd);
+    errno_assert(rc == 0);
+    for(i = 0; i != 4; ++i) {
+        rc = close(fill[i]);
+        errno_assert(rc == 0);
+    }
+    rc = hclose(ls2);
+    errno_assert(rc == 0);
+    rc = hclose(p2);
+    errno_assert(rc == 0);
+    /* Connections that were handed out outlive the pool. */
+    rc = hclose(p);
+    errno_assert(rc == 0);
+    rc = bsend(hs[0], "C", 1, -1);
+    errno_assert(rc == 0);
+    rc = brecv(hs[0], buf, 1, -1);
+    errno_assert(rc == 0);
+    rc = hclose(hs[0]);
+    errno_assert(rc == 0);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+
     /* Emulate a DoS attack. */
     ls = tcp_listen(&addr, 10);
     cr = go(client4(5555));
@@ -362,6 +986,7 @@ int main(void) {
     move_lots_of_data(5000, 3000);
 
     test_fromfd();
+    test_opts();
     
     /* test concurrency in TCP */
     tcp_concurrency_test();
@@ -502,3 +1127,131 @@ static void test_fromfd() {
     rc = hclose(ls);
     errno_assert(rc == 0);
 }
+
+coroutine void opts_reader(int s, size_t len) {
+    char buf[4096];
+    while(len) {
+        size_t n = len < sizeof(buf) ? len : sizeof(buf);
+        int rc = brecv(s, buf, n, -1);
+        errno_assert(rc == 0);
+        len -= n;
+    }
+}
+
+/* Sends data to a peer that isn't reading till the send times out.
+   Returns the amount of data that was sent but not received by the peer,
+   i.e. data that's still waiting in the sender's buffer. */
+static size_t opts_unsent(struct ipaddr *addr, int ls, int nolowat) {
+    int fd = socket(ipaddr_family(addr), SOCK_STREAM, 0);
+    errno_assert(fd >= 0);
+    int val = 4096;
+    int rc = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+    errno_assert(rc == 0);
+    rc = connect(fd, ipaddr_sockaddr(addr), ipaddr_len(addr));
+    errno_assert(rc == 0);
+    int s = tcp_accept(ls, NULL, -1);
+    errno_assert(s >= 0);
+    if(nolowat) {
+        struct tcp_opts opts;
+        tcp_opts_init(&opts);
+        opts.notsent_lowat = 0;
+        rc = tcp_setopts(s, &opts);
+        errno_assert(rc == 0);
+    }
+    static char data[6000];
+    size_t total = 0;
+    int i;
+    for(i = 0; i != 1000; ++i) {
+        rc = bsend(s, data, sizeof(data), now() + 50);
+        if(rc < 0) break;
+        total += sizeof(data);
+    }
+    errno_assert(rc == -1 && errno == ETIMEDOUT);
+    int received;
+    rc = ioctl(fd, FIONREAD, &received);
+    errno_assert(rc == 0);
+    rc = hclose(s);
+    errno_assert(rc == 0);
+    close(fd);
+    return total - received;
+}
+
+static void test_opts() {
+    struct ipaddr addr;
+    int rc = ipaddr_local(&addr, "127.0.0.1", 5555, 0);
+    errno_assert(rc == 0);
+    int ls = tcp_listen(&addr, 10);
+    errno_assert(ls >= 0);
+    /* Options set on the listener are passed to accepted connections. */
+    struct tcp_opts opts;
+    tcp_opts_init(&opts);
+    opts.nodelay = 1;
+    opts.rcvbuf = 65536;
+    opts.keepidle = 30;
+    opts.keepintvl = 5;
+    opts.keepcnt = 3;
+    opts.notsent_lowat = 16384;
+    rc = tcp_setopts(ls, &opts);
+    errno_assert(rc == 0);
+    int s = tcp_connect(&addr, -1);
+    errno_assert(s >= 0);
+    int as = tcp_accept(ls, NULL, -1);
+    errno_assert(as >= 0);
+    tcp_opts_init(&opts);
+    opts.nodelay = 1;
+    opts.sndbuf = 65536;
+    opts.keepidle = 0;
+    rc = tcp_setopts(s, &opts);
+    errno_assert(rc == 0);
+    /* With the watermark set, sends wait till the data is on its way. */
+    int cr = go(opts_reader(s, 1024 * 1024));
+    errno_assert(cr >= 0);
+    static char data[65536];
+    int i;
+    for(i = 0; i != 16; ++i) {
+        rc = bsend(as, data, sizeof(data), -1);
+        errno_assert(rc == 0);
+    }
+    rc = bundle_wait(cr, -1);
+    errno_assert(rc == 0);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+    /* The watermark set on the listener keeps the amount of unsent data
+       low while the peer isn't reading. Without it, the whole send buffer
+       gets filled. */
+    tcp_opts_init(&opts);
+    opts.sndbuf = 1024 * 1024;
+    rc = tcp_setopts(ls, &opts);
+    errno_assert(rc == 0);
+    size_t unsent = opts_unsent(&addr, ls, 0);
+    assert(unsent > 0 && unsent <= 16384);
+    unsent = opts_unsent(&addr, ls, 1);
+    assert(unsent > 65536);
+    /* Invalid options. */
+    tcp_opts_init(&opts);
+    opts.keepcnt = 0;
+    rc = tcp_setopts(s, &opts);
+    errno_assert(rc == -1 && errno == EINVAL);
+    tcp_opts_init(&opts);
+    opts.sndbuf = -2;
+    rc = tcp_setopts(s, &opts);
+    errno_assert(rc == -1 && errno == EINVAL);
+    rc = tcp_setopts(s, NULL);
+    errno_assert(rc == -1 && errno == EINVAL);
+    int ch[2];
+    rc = chmake(ch);
+    errno_assert(rc == 0);
+    tcp_opts_init(&opts);
+    rc = tcp_setopts(ch[0], &opts);
+    errno_assert(rc == -1 && errno == ENOTSUP);
+    rc = hclose(ch[0]);
+    errno_assert(rc == 0);
+    rc = hclose(ch[1]);
+    errno_assert(rc == 0);
+    rc = hclose(as);
+    errno_assert(rc == 0);
+    rc = hclose(s);
+    errno_assert(rc == 0);
+    rc = hclose(ls);
+    errno_assert(rc == 0);
+}
@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "../libdill.h"
@@ -58,6 +59,14 @@ void *threadmain(void *arg)
     return NULL;
 }
 
+/* Writes to the pipe while the main thread is busy polling. */
+void *writer(void *arg) {
+    usleep(10000);
+    ssize_t sz = write(*(int*)arg, "A", 1);
+    errno_assert(sz == 1);
+    return NULL;
+}
+
 int main() {
     pthread_t t1;
     int rc = pthread_create(&t1, NULL, threadmain, NULL);
@@ -78,5 +87,30 @@ int main() {
     errno_assert(rc == 0);
     rc = pthread_join(t1, NULL);
     errno_assert(rc == 0);
+
+    /* The event arrives while the thread is busy polling. */
+    rc = busypoll(1000000, 0);
+    errno_assert(rc == 0);
+    int fds[2];
+    rc = pipe(fds);
+    errno_assert(rc == 0);
+    struct stats s0, s1;
+    rc = stats(&s0);
+    errno_assert(rc == 0);
+    rc = pthread_create(&t1, NULL, writer, &fds[1]);
+    errno_assert(rc == 0);
+    rc = fdin(fds[0], now() + 5000);
+    errno_assert(rc == 0);
+    rc = pthread_join(t1, NULL);
+    errno_assert(rc == 0);
+    rc = stats(&s1);
+    errno_assert(rc == 0);
+    assert(s1.busypolls == s0.busypolls + 1);
+    rc = fdclean(fds[0]);
+    errno_assert(rc == 0);
+    close(fds[0]);
+    close(fds[1]);
+    rc = busypoll(0, 0);
+    errno_assert(rc == 0);
     return 0;
 }
@@ -22,7 +22,9 @@
 
 */
 
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "../libdill.h"
@@ -78,6 +80,27 @@ coroutine void client3(int u) {
     errno_assert(rc == 0);
 }
 
+coroutine void client4(int u) {
+    int s = tls_attach_client(u, -1);
+    errno_assert(s >= 0);
+    uint8_t b[5000];
+    int rc = brecv(s, b, sizeof(b), -1);
+    errno_assert(rc == 0);
+    int i;
+    for(i = 0; i != sizeof(b); ++i) assert(b[i] == (uint8_t)(i + 100));
+    u = tls_detach(s, -1);
+    errno_assert(u >= 0);
+    rc = hclose(u);
+    errno_assert(rc == 0);
+}
+
+coroutine void relay(int s1, int s2) {
+    uint64_t nbytes[2];
+    int rc = brelay(s1, s2, nbytes, -1);
+    errno_assert(rc == 0);
+    assert(nbytes[0] == 3 && nbytes[1] == 3);
+}
+
 int main(void) {
     char buf[16];
 
@@ -107,6 +130,75 @@ int main(void) {
     rc = hclose(cr);
     errno_assert(rc == 0);
 
+    /* Relay between TLS and IPC sockets. */
+    rc = ipc_pair(u);
+    errno_assert(rc == 0);
+    cr = go(client1(u[1]));
+    errno_assert(cr >= 0);
+    s = tls_attach_server(u[0], "tests/cert.pem", "tests/key.pem", -1);
+    errno_assert(s >= 0);
+    int p[2];
+    rc = ipc_pair(p);
+    errno_assert(rc == 0);
+    int rl = go(relay(s, p[0]));
+    errno_assert(rl >= 0);
+    rc = brecv(p[1], buf, 3, -1);
+    errno_assert(rc == 0);
+    assert(buf[0] == 'A' && buf[1] == 'B' && buf[2] == 'C');
+    rc = brecv(p[1], buf, 3, -1);
+    errno_assert(rc == -1 && errno == EPIPE);
+    rc = bsend(p[1], "DEF", 3, -1);
+    errno_assert(rc == 0);
+    rc = ipc_done(p[1], -1);
+    errno_assert(rc == 0);
+    rc = bundle_wait(rl, -1);
+    errno_assert(rc == 0);
+    rc = hclose(rl);
+    errno_assert(rc == 0);
+    u[0] = tls_detach(s, -1);
+    errno_assert(u[0] >= 0);
+    rc = hclose(u[0]);
+    errno_assert(rc == 0);
+    rc = hclose(p[1]);
+    errno_assert(rc == 0);
+    rc = hclose(p[0]);
+    errno_assert(rc == 0);
+    rc = bundle_wait(cr, -1);
+    errno_assert(rc == 0);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+
+    /* Sending a file over a socket that isn't backed by a file
+       descriptor. */
+    char fname[] = "/tmp/libdill-test-XXXXXX";
+    int fd = mkstemp(fname);
+    errno_assert(fd >= 0);
+    rc = unlink(fname);
+    errno_assert(rc == 0);
+    uint8_t data[6000];
+    int k;
+    for(k = 0; k != sizeof(data); ++k) data[k] = (uint8_t)k;
+    ssize_t ssz = write(fd, data, sizeof(data));
+    errno_assert(ssz == sizeof(data));
+    rc = ipc_pair(u);
+    errno_assert(rc == 0);
+    cr = go(client4(u[1]));
+    errno_assert(cr >= 0);
+    s = tls_attach_server(u[0], "tests/cert.pem", "tests/key.pem", -1);
+    errno_assert(s >= 0);
+    rc = bsendfile(s, fd, 100, 5000, -1);
+    errno_assert(rc == 0);
+    u[0] = tls_detach(s, -1);
+    errno_assert(u[0] >= 0);
+    rc = bundle_wait(cr, -1);
+    errno_assert(rc == 0);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+    rc = hclose(u[0]);
+    errno_assert(rc == 0);
+    rc = close(fd);
+    errno_assert(rc == 0);
+
     /* Test simple data transfer, terminated by tls_detach().
        Then send some data over undelying IPC connection. */
     rc = ipc_pair(u);
@@ -157,7 +249,36 @@ int main(void) {
     errno_assert(rc == 0);
     rc = hclose(u[0]);
     errno_assert(rc == 0);
-    
+
+    /* Same thing, using partial reads. */
+    rc = ipc_pair(u);
+    errno_assert(rc == 0);
+    cr = go(client3(u[1]));
+    errno_assert(cr >= 0);
+    s = tls_attach_server(u[0], "tests/cert.pem", "tests/key.pem", -1);
+    errno_assert(s >= 0);
+    c = 0;
+    size_t total = 0;
+    while(total != 257 * 2777) {
+        uint8_t b[1000];
+        ssize_t sz = brecvsome(s, b, sizeof(b), -1);
+        errno_assert(sz > 0);
+        int j;
+        for(j = 0; j != sz; ++j) {
+            assert(b[j] == c);
+            c++;
+        }
+        total += sz;
+    }
+    u[0] = tls_detach(s, -1);
+    errno_assert(u[0] >= 0);
+    rc = bundle_wait(cr, -1);
+    errno_assert(rc == 0);
+    rc = hclose(cr);
+    errno_assert(rc == 0);
+    rc = hclose(u[0]);
+    errno_assert(rc == 0);
+
     return 0;
 }
 
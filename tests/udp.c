@@ -22,6 +22,8 @@
 
 */
 
+#include <string.h>
+
 #include "assert.h"
 #include "../libdill.h"
 
@@ -65,6 +67,155 @@ int main(void) {
         break;
     }
 
+    /* Datagram assembled from many buffers. */
+    struct iolist iol[100];
+    uint8_t data[100];
+    int i;
+    for(i = 0; i != 100; ++i) {
+        data[i] = (uint8_t)i;
+        iol[i].iol_base = &data[i];
+        iol[i].iol_len = 1;
+        iol[i].iol_next = i == 99 ? NULL : &iol[i + 1];
+        iol[i].iol_rsvd = 0;
+    }
+    while(1) {
+        rc = udp_sendl(s1, &dst, &iol[0], &iol[99]);
+        errno_assert(rc == 0);
+        memset(data, 0, sizeof(data));
+        ssize_t sz = mrecvl(s2, &iol[0], &iol[99], now() + 100);
+        if(sz < 0 && errno == ETIMEDOUT)
+            continue;
+        errno_assert(sz == 100);
+        for(i = 0; i != 100; ++i)
+            assert(data[i] == (uint8_t)i);
+        break;
+    }
+
+    /* Batches of datagrams. Datagrams from an address other than
+       the remote address of s2 are dropped. */
+    int s3 = udp_open(NULL, NULL);
+    errno_assert(s3 >= 0);
+    rc = udp_send(s3, &dst, "XYZ", 3);
+    errno_assert(rc == 0);
+    struct udp_msg msgs[10];
+    uint8_t bufs[10][16];
+    for(i = 0; i != 10; ++i) {
+        memset(bufs[i], 'A' + i, i + 1);
+        msgs[i].addr = &dst;
+        msgs[i].buf = bufs[i];
+        msgs[i].len = i + 1;
+    }
+    rc = udp_sendv(s1, msgs, 10);
+    errno_assert(rc == 0);
+    int received = 0;
+    while(received < 10) {
+        for(i = 0; i != 10; ++i) {
+            msgs[i].addr = NULL;
+            msgs[i].buf = bufs[i];
+            msgs[i].len = sizeof(bufs[i]);
+        }
+        ssize_t n = udp_recvv(s2, msgs, 10 - received, now() + 1000);
+        errno_assert(n > 0);
+        for(i = 0; i != n; ++i) {
+            assert(msgs[i].nbytes == received + 1);
+            assert(bufs[i][0] == 'A' + received);
+            ++received;
+        }
+    }
+    /* Destination defaults to the remote address of the socket. */
+    for(i = 0; i != 3; ++i) {
+        msgs[i].addr = NULL;
+        msgs[i].buf = "DEF";
+        msgs[i].len = 3;
+    }
+    rc = udp_sendv(s2, msgs, 3);
+    errno_assert(rc == 0);
+    received = 0;
+    while(received < 3) {
+        struct ipaddr addrs[3];
+        for(i = 0; i != 3; ++i) {
+            msgs[i].addr = &addrs[i];
+            msgs[i].buf = bufs[i];
+            msgs[i].len = sizeof(bufs[i]);
+        }
+        ssize_t n = udp_recvv(s1, msgs, 3, now() + 1000);
+        errno_assert(n > 0);
+        for(i = 0; i != n; ++i) {
+            assert(msgs[i].nbytes == 3 && bufs[i][0] == 'D');
+            assert(ipaddr_equal(&addrs[i], &addr2, 0));
+        }
+        received += n;
+    }
+
+    /* Segmentation offload. With coalescing enabled, the receiver may get
+       multiple segments in one go. */
+    uint8_t seg[10000];
+    for(i = 0; i != sizeof(seg); ++i)
+        seg[i] = (uint8_t)i;
+    rc = udp_gro(s2, 1);
+    errno_assert(rc == 0 || errno == ENOTSUP);
+    rc = udp_sendseg(s1, &dst, seg, sizeof(seg), 1000);
+    errno_assert(rc == 0);
+    static uint8_t train[65536];
+    received = 0;
+    while(received < sizeof(seg)) {
+        size_t segsize;
+        ssize_t sz = udp_recvseg(s2, NULL, train, sizeof(train), &segsize,
+            now() + 1000);
+        errno_assert(sz > 0);
+        assert(segsize == 1000 && sz % 1000 == 0);
+        assert(memcmp(train, seg + received, sz) == 0);
+        received += sz;
+    }
+    /* Without coalescing, segments arrive as individual packets. The last
+       one is shorter. */
+    rc = udp_sendseg(s2, NULL, seg, 2500, 1000);
+    errno_assert(rc == 0);
+    for(i = 0; i != 3; ++i) {
+        ssize_t sz = udp_recv(s1, NULL, train, sizeof(train), now() + 1000);
+        errno_assert(sz == (i == 2 ? 500 : 1000));
+        assert(memcmp(train, seg + i * 1000, sz) == 0);
+    }
+    rc = udp_sendseg(s1, &dst, seg, sizeof(seg), 0);
+    errno_assert(rc < 0 && errno == EINVAL);
+
+    /* Connected socket. Packets from other addresses are filtered out by
+       the kernel. */
+    rc = udp_connect(s2);
+    errno_assert(rc == 0);
+    rc = udp_connect(s3);
+    errno_assert(rc < 0 && errno == EINVAL);
+    rc = udp_send(s3, &dst, "XYZ", 3);
+    errno_assert(rc == 0);
+    rc = udp_send(s1, &dst, "ABC", 3);
+    errno_assert(rc == 0);
+    char cbuf[16];
+    ssize_t csz = udp_recv(s2, NULL, cbuf, sizeof(cbuf), now() + 1000);
+    errno_assert(csz == 3);
+    assert(memcmp(cbuf, "ABC", 3) == 0);
+    rc = udp_send(s2, &addr1, "DEF", 3);
+    errno_assert(rc == 0);
+    csz = udp_recv(s1, NULL, cbuf, sizeof(cbuf), now() + 1000);
+    errno_assert(csz == 3);
+    rc = udp_send(s2, &dst, "DEF", 3);
+    errno_assert(rc < 0 && errno == EISCONN);
+    /* ICMP errors are reported to the connected socket. */
+    struct ipaddr closed;
+    rc = ipaddr_remote(&closed, "127.0.0.1", 5557, 0, -1);
+    errno_assert(rc == 0);
+    int s4 = udp_open(NULL, &closed);
+    errno_assert(s4 >= 0);
+    rc = udp_connect(s4);
+    errno_assert(rc == 0);
+    rc = udp_send(s4, NULL, "GHI", 3);
+    errno_assert(rc == 0);
+    csz = udp_recv(s4, NULL, cbuf, sizeof(cbuf), now() + 1000);
+    errno_assert(csz < 0 && errno == ECONNREFUSED);
+    rc = hclose(s4);
+    errno_assert(rc == 0);
+
+    rc = hclose(s3);
+    errno_assert(rc == 0);
     rc = hclose(s2);
     errno_assert(rc == 0);
     rc = hclose(s1);
@@ -23,6 +23,7 @@
 */
 
 #include <errno.h>
+#include <limits.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
@@ -30,6 +31,7 @@
 #include <stdlib.h>
 
 #define DILL_DISABLE_RAW_NAMES
+#include "iol.h"
 #include "libdillimpl.h"
 #include "utils.h"
 
@@ -42,8 +44,8 @@ struct dill_tls_sock {
     struct dill_bsock_vfs bvfs;
     SSL_CTX *ctx;
     SSL *ssl;
-    int u;
     int64_t deadline;
+    int u;
     unsigned int indone : 1;
     unsigned int outdone: 1;
     unsigned int inerr : 1;
@@ -63,6 +65,9 @@ static int dill_tls_bsendl(struct dill_bsock_vfs *bvfs,
     struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
 static int dill_tls_brecvl(struct dill_bsock_vfs *bvfs,
     struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
+static int dill_tls_bflush(struct dill_bsock_vfs *bvfs, int64_t deadline);
+static ssize_t dill_tls_brecvsomel(struct dill_bsock_vfs *bvfs,
+    struct dill_iolist *first, struct dill_iolist *last, int64_t deadline);
 
 static void *dill_tls_hquery(struct dill_hvfs *hvfs, const void *type) {
     struct dill_tls_sock *self = (struct dill_tls_sock*)hvfs;
@@ -103,6 +108,8 @@ int dill_tls_attach_client_mem(int s, struct dill_tls_storage *mem,
     self->hvfs.close = dill_tls_hclose;
     self->bvfs.bsendl = dill_tls_bsendl;
     self->bvfs.brecvl = dill_tls_brecvl;
+    self->bvfs.bflush = dill_tls_bflush;
+    self->bvfs.brecvsomel = dill_tls_brecvsomel;
     self->ctx = ctx;
     self->ssl = ssl;
     self->u = s;
@@ -189,6 +196,8 @@ int dill_tls_attach_server_mem(int s, const char *cert, const char *pkey,
     self->hvfs.close = dill_tls_hclose;
     self->bvfs.bsendl = dill_tls_bsendl;
     self->bvfs.brecvl = dill_tls_brecvl;
+    self->bvfs.bflush = dill_tls_bflush;
+    self->bvfs.brecvsomel = dill_tls_brecvsomel;
     self->ctx = ctx;
     self->ssl = ssl;
     self->u = s;
@@ -313,6 +322,49 @@ static int dill_tls_bsendl(struct dill_bsock_vfs *bvfs,
     return 0;
 }
 
+/* Once some data were received, only the data that were already decrypted
+   are used to fill in the rest of the iolist. */
+static ssize_t dill_tls_brecvsomel(struct dill_bsock_vfs *bvfs,
+      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+    struct dill_tls_sock *self = dill_cont(bvfs, struct dill_tls_sock, bvfs);
+    if(dill_slow(self->indone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->inerr)) {errno = ECONNRESET; return -1;}
+    int rc = dill_iolcheck(first, last, NULL, NULL);
+    if(dill_slow(rc < 0)) return -1;
+    self->deadline = deadline;
+    size_t sz = 0;
+    struct dill_iolist *it;
+    for(it = first; it; it = it->iol_next) {
+        if(!it->iol_len) continue;
+        if(sz && !SSL_pending(self->ssl)) break;
+        while(1) {
+            ERR_clear_error();
+            rc = SSL_read(self->ssl, it->iol_base,
+                it->iol_len > INT_MAX ? INT_MAX : it->iol_len);
+            if(dill_tls_followup(self, rc)) break;
+        }
+        if(dill_slow(errno != 0)) {
+            if(errno == EPIPE) self->indone = 1;
+            else self->inerr = 1;
+            return -1;
+        }
+        sz += rc;
+        if(rc < it->iol_len) break;
+    }
+    return sz;
+}
+
+/* Encrypted records are passed to the underlying socket as soon as they are
+   produced. Any buffering happens there. */
+static int dill_tls_bflush(struct dill_bsock_vfs *bvfs, int64_t deadline) {
+    struct dill_tls_sock *self = dill_cont(bvfs, struct dill_tls_sock, bvfs);
+    if(dill_slow(self->outdone)) {errno = EPIPE; return -1;}
+    if(dill_slow(self->outerr)) {errno = ECONNRESET; return -1;}
+    int rc = dill_bflush(self->u, deadline);
+    if(dill_slow(rc < 0)) {self->outerr = 1; return -1;}
+    return 0;
+}
+
 static int dill_tls_brecvl(struct dill_bsock_vfs *bvfs,
       struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
     struct dill_tls_sock *self = dill_cont(bvfs, struct dill_tls_sock, bvfs);
@@ -451,11 +503,10 @@ static long dill_tls_cbio_ctrl(BIO *bio, int cmd, long larg, void *parg) {
     switch(cmd) {
     case BIO_CTRL_FLUSH:
         return 1;
-    case BIO_CTRL_PUSH:
-    case BIO_CTRL_POP:
-        return 0;
     default:
-        dill_assert(0);
+        /* Push, pop and the queries issued by newer versions of OpenSSL,
+           e.g. whether kTLS is in use, are not supported. */
+        return 0;
     }
 }
 
@@ -0,0 +1,66 @@
+/*
+
+  Copyright (c) 2017 Martin Sustrik
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom
+  the Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included
+  in all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+  IN THE SOFTWARE.
+
+*/
+
+#ifndef DILL_TRACE_H_INCLUDED
+#define DILL_TRACE_H_INCLUDED
+
+/* Static tracepoints for tools like bpftrace, perf or SystemTap. When the
+   library is built with --enable-usdt the probes are emitted using sys/sdt.h.
+   They compile into a single nop instruction each and an entry in the ELF
+   notes section, so the cost is negligible when no tracer is attached.
+   Otherwise, they compile into nothing.
+
+   All the probes belong to 'libdill' provider:
+
+     cr_start(cr, file, line)       coroutine launched by go()
+     cr_end(cr)                     coroutine finished
+     cr_switch(from, to)            switch to a different coroutine
+     cr_trigger(cr, id, err)        suspended coroutine made ready
+     poll_begin(timeout)            about to poll for external events
+     poll_end(fired)                polling done
+     timer_fire(cr, deadline)       timer expired
+     fd_send(fd, bytes)             result of a send syscall
+     fd_recv(fd, bytes)             result of a recv syscall
+
+   'cr' is the address of the coroutine's control block. It can be used to
+   correlate events belonging to the same coroutine. */
+
+#if defined DILL_USDT
+
+#include <sys/sdt.h>
+
+#define DILL_TRACE1(name, a) DTRACE_PROBE1(libdill, name, a)
+#define DILL_TRACE2(name, a, b) DTRACE_PROBE2(libdill, name, a, b)
+#define DILL_TRACE3(name, a, b, c) DTRACE_PROBE3(libdill, name, a, b, c)
+
+#else
+
+#define DILL_TRACE1(name, a) do {} while(0)
+#define DILL_TRACE2(name, a, b) do {} while(0)
+#define DILL_TRACE3(name, a, b, c) do {} while(0)
+
+#endif
+
+#endif
+
@@ -22,7 +22,15 @@
 
 */
 
+#if defined __linux__
+#define _GNU_SOURCE
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#endif
+
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -35,6 +43,15 @@
 
 dill_unique_id(dill_udp_type);
 
+/* Maximum number of datagrams passed to the kernel in a single batch. */
+#define DILL_UDP_BATCH 32
+
+/* Limits on a single segmentation offload send. The kernel refuses to split
+   a buffer into more than 64 datagrams and the buffer itself has to fit into
+   a single IP packet. */
+#define DILL_UDP_GSOSEGS 64
+#define DILL_UDP_GSOMAX 65000
+
 static void *dill_udp_hquery(struct dill_hvfs *hvfs, const void *type);
 static void dill_udp_hclose(struct dill_hvfs *hvfs);
 static int dill_udp_msendl(struct dill_msock_vfs *mvfs,
@@ -50,6 +67,12 @@ struct dill_udp_sock {
     unsigned int busy : 1;
     unsigned int hasremote : 1;
     unsigned int mem : 1;
+    /* Whether the underlying socket is connected to the remote address. */
+    unsigned int connected : 1;
+    /* Whether the kernel supports UDP_SEGMENT. Checked on the first
+       udp_sendseg() call. */
+    unsigned int gsoprobed : 1;
+    unsigned int gso : 1;
 };
 
 DILL_CHECK_STORAGE(dill_udp_sock, dill_udp_storage)
@@ -102,6 +125,9 @@ int dill_udp_open_mem(struct dill_ipaddr *local,
     obj->busy = 0;
     obj->hasremote = remote ? 1 : 0;
     obj->mem = 1;
+    obj->connected = 0;
+    obj->gsoprobed = 0;
+    obj->gso = 0;
     if(remote) obj->remote = *remote;
     /* Create the handle. */
     int h = dill_hmake(&obj->hvfs);
@@ -129,40 +155,74 @@ error1:
     return -1;
 }
 
+/* Fills in the destination address of an outgoing packet. Connected socket
+   doesn't need one, but it can't send packets to other addresses either. */
+static int dill_udp_setdst(struct dill_udp_sock *obj,
+      const struct dill_ipaddr *addr, struct msghdr *hdr) {
+    if(!addr) {
+        if(dill_slow(!obj->hasremote)) {errno = EINVAL; return -1;}
+        if(obj->connected) return 0;
+        addr = &obj->remote;
+    }
+    else if(obj->connected) {
+        if(dill_slow(!dill_ipaddr_equal(addr, &obj->remote, 0))) {
+            errno = EISCONN; return -1;}
+        return 0;
+    }
+    hdr->msg_name = (void*)dill_ipaddr_sockaddr(addr);
+    hdr->msg_namelen = dill_ipaddr_len(addr);
+    return 0;
+}
+
+int dill_udp_connect(int s) {
+    struct dill_udp_sock *obj = dill_hquery(s, dill_udp_type);
+    if(dill_slow(!obj)) return -1;
+    if(dill_slow(!obj->hasremote)) {errno = EINVAL; return -1;}
+    if(obj->connected) return 0;
+    int rc = connect(obj->fd, dill_ipaddr_sockaddr(&obj->remote),
+        dill_ipaddr_len(&obj->remote));
+    if(dill_slow(rc < 0)) return -1;
+    obj->connected = 1;
+    return 0;
+}
+
 static int dill_udp_sendl_(struct dill_msock_vfs *mvfs,
       const struct dill_ipaddr *addr,
       struct dill_iolist *first, struct dill_iolist *last) {
     struct dill_udp_sock *obj = dill_cont(mvfs, struct dill_udp_sock, mvfs);
     if(dill_slow(obj->busy)) {errno = EBUSY; return -1;}
     /* If no destination IP address is provided, fall back to the stored one. */
-    const struct dill_ipaddr *dstaddr = addr;
-    if(!dstaddr) {
-        if(dill_slow(!obj->hasremote)) {errno = EINVAL; return -1;}
-        dstaddr = &obj->remote;
-    }
     struct msghdr hdr;
     memset(&hdr, 0, sizeof(hdr));
-    hdr.msg_name = (void*)dill_ipaddr_sockaddr(dstaddr);
-    hdr.msg_namelen = dill_ipaddr_len(dstaddr);
-    /* Make a local iovec array. */
-    /* TODO: This is dangerous, it may cause stack overflow.
-       There should probably be a on-heap per-socket buffer for that. */
+    int rc = dill_udp_setdst(obj, addr, &hdr);
+    if(dill_slow(rc < 0)) return -1;
+    /* Make a local iovec array. Datagram can't be split into multiple
+       sendmsg() calls, so long iolists need an array from the cache. */
     size_t niov;
-    int rc = dill_iolcheck(first, last, &niov, NULL);
+    rc = dill_iolcheck(first, last, &niov, NULL);
     if(dill_slow(rc < 0)) return -1;
-    struct iovec iov[niov];
+    if(dill_slow(niov > DILL_FD_IOVMAX)) {errno = EMSGSIZE; return -1;}
+    struct iovec siov[DILL_FD_IOVSTACK];
+    struct iovec *iov = siov;
+    if(niov > DILL_FD_IOVSTACK) {
+        iov = dill_fd_allociov();
+        if(dill_slow(!iov)) return -1;
+    }
     dill_ioltoiov(first, iov);
-    hdr.msg_iov = (struct iovec*)iov;
+    hdr.msg_iov = iov;
     hdr.msg_iovlen = niov;
     ssize_t sz = sendmsg(obj->fd, &hdr, 0);
+    if(iov != siov) dill_fd_freeiov(iov);
     if(dill_fast(sz >= 0)) return 0;
     if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
     return -1;
 }
 
+/* If segsize is not NULL, it is filled in with the size of the individual
+   datagrams the kernel coalesced into the one received. */
 static ssize_t dill_udp_recvl_(struct dill_msock_vfs *mvfs,
-      struct dill_ipaddr *addr,
-      struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
+      struct dill_ipaddr *addr, struct dill_iolist *first,
+      struct dill_iolist *last, size_t *segsize, int64_t deadline) {
     struct dill_udp_sock *obj = dill_cont(mvfs, struct dill_udp_sock, mvfs);
     if(dill_slow(obj->busy)) {errno = EBUSY; return -1;}
     struct msghdr hdr;
@@ -170,32 +230,65 @@ static ssize_t dill_udp_recvl_(struct dill_msock_vfs *mvfs,
     memset(&hdr, 0, sizeof(hdr));
     hdr.msg_name = (void*)&raddr;
     hdr.msg_namelen = sizeof(struct dill_ipaddr);
-    /* Make a local iovec array. */
-    /* TODO: This is dangerous, it may cause stack overflow.
-       There should probably be a on-heap per-socket buffer for that. */
+    /* Make a local iovec array. See dill_udp_sendl_() for details. */
     size_t niov;
     int rc = dill_iolcheck(first, last, &niov, NULL);
     if(dill_slow(rc < 0)) return -1;
-    struct iovec iov[niov];
+    if(dill_slow(niov > DILL_FD_IOVMAX)) {errno = EMSGSIZE; return -1;}
+    struct iovec siov[DILL_FD_IOVSTACK];
+    struct iovec *iov = siov;
+    if(niov > DILL_FD_IOVSTACK) {
+        iov = dill_fd_allociov();
+        if(dill_slow(!iov)) return -1;
+    }
     dill_ioltoiov(first, iov);
-    hdr.msg_iov = (struct iovec*)iov;
+    hdr.msg_iov = iov;
     hdr.msg_iovlen = niov;
+#if defined __linux__
+    char ctrl[CMSG_SPACE(sizeof(int))];
+#endif
+    ssize_t sz;
     while(1) {
-        ssize_t sz = recvmsg(obj->fd, &hdr, 0);
+#if defined __linux__
+        if(segsize) {
+            hdr.msg_control = ctrl;
+            hdr.msg_controllen = sizeof(ctrl);
+        }
+#endif
+        sz = recvmsg(obj->fd, &hdr, 0);
         if(sz >= 0) {
             /* If remote IP address is specified we'll silently drop all
-               packets coming from different addresses. */
-            if(obj->hasremote && !dill_ipaddr_equal(&raddr, &obj->remote, 0))
+               packets coming from different addresses. Connected socket
+               gets them filtered by the kernel. */
+            if(obj->hasremote && !obj->connected &&
+                  !dill_ipaddr_equal(&raddr, &obj->remote, 0))
                 continue;
             if(addr) *addr = raddr;
-            return sz;
+            if(segsize) {
+                *segsize = sz;
+#if defined __linux__
+                struct cmsghdr *cmsg;
+                for(cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+                      cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                    if(cmsg->cmsg_level == IPPROTO_UDP &&
+                          cmsg->cmsg_type == UDP_GRO) {
+                        int gsosize;
+                        memcpy(&gsosize, CMSG_DATA(cmsg), sizeof(gsosize));
+                        if(gsosize > 0 && gsosize < sz) *segsize = gsosize;
+                    }
+                }
+#endif
+            }
+            break;
         }
-        if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if(errno != EAGAIN && errno != EWOULDBLOCK) break;
         obj->busy = 1;
         rc = dill_fdin(obj->fd, deadline);
         obj->busy = 0;
-        if(dill_slow(rc < 0)) return -1;
+        if(dill_slow(rc < 0)) break;
     }
+    if(iov != siov) dill_fd_freeiov(iov);
+    return sz;
 }
 
 int dill_udp_send(int s, const struct dill_ipaddr *addr,
@@ -211,7 +304,7 @@ ssize_t dill_udp_recv(int s, struct dill_ipaddr *addr, void *buf, size_t len,
     struct dill_msock_vfs *m = dill_hquery(s, dill_msock_type);
     if(dill_slow(!m)) return -1;
     struct dill_iolist iol = {(void*)buf, len, NULL, 0};
-    return dill_udp_recvl_(m, addr, &iol, &iol, deadline);
+    return dill_udp_recvl_(m, addr, &iol, &iol, NULL, deadline);
 }
 
 int dill_udp_sendl(int s, const struct dill_ipaddr *addr,
@@ -225,7 +318,240 @@ ssize_t dill_udp_recvl(int s, struct dill_ipaddr *addr,
       struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
     struct dill_msock_vfs *m = dill_hquery(s, dill_msock_type);
     if(dill_slow(!m)) return -1;
-    return dill_udp_recvl_(m, addr, first, last, deadline);
+    return dill_udp_recvl_(m, addr, first, last, NULL, deadline);
+}
+
+#if defined __linux__
+
+int dill_udp_sendv(int s, struct dill_udp_msg *msgs, size_t count) {
+    struct dill_udp_sock *obj = dill_hquery(s, dill_udp_type);
+    if(dill_slow(!obj)) return -1;
+    if(dill_slow(obj->busy)) {errno = EBUSY; return -1;}
+    if(dill_slow(!msgs && count)) {errno = EINVAL; return -1;}
+    struct mmsghdr hdrs[DILL_UDP_BATCH];
+    struct iovec iovs[DILL_UDP_BATCH];
+    size_t pos = 0;
+    while(pos < count) {
+        size_t n = count - pos;
+        if(n > DILL_UDP_BATCH) n = DILL_UDP_BATCH;
+        memset(hdrs, 0, n * sizeof(struct mmsghdr));
+        size_t i;
+        for(i = 0; i != n; ++i) {
+            struct dill_udp_msg *msg = &msgs[pos + i];
+            int rc = dill_udp_setdst(obj, msg->addr, &hdrs[i].msg_hdr);
+            if(dill_slow(rc < 0)) return -1;
+            iovs[i].iov_base = msg->buf;
+            iovs[i].iov_len = msg->len;
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int rc = sendmmsg(obj->fd, hdrs, n, 0);
+        if(dill_slow(rc < 0)) {
+            /* Same as with udp_send(), datagrams that don't fit into
+               the socket's buffer are dropped. */
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        /* If sending of a datagram failed, the next call will report
+           the error. */
+        pos += rc;
+    }
+    return 0;
+}
+
+ssize_t dill_udp_recvv(int s, struct dill_udp_msg *msgs, size_t count,
+      int64_t deadline) {
+    struct dill_udp_sock *obj = dill_hquery(s, dill_udp_type);
+    if(dill_slow(!obj)) return -1;
+    if(dill_slow(obj->busy)) {errno = EBUSY; return -1;}
+    if(dill_slow(!msgs || !count)) {errno = EINVAL; return -1;}
+    if(count > DILL_UDP_BATCH) count = DILL_UDP_BATCH;
+    struct mmsghdr hdrs[DILL_UDP_BATCH];
+    struct iovec iovs[DILL_UDP_BATCH];
+    struct dill_ipaddr raddrs[DILL_UDP_BATCH];
+    size_t i;
+    memset(hdrs, 0, count * sizeof(struct mmsghdr));
+    for(i = 0; i != count; ++i) {
+        hdrs[i].msg_hdr.msg_name = &raddrs[i];
+        hdrs[i].msg_hdr.msg_namelen = sizeof(struct dill_ipaddr);
+        iovs[i].iov_base = msgs[i].buf;
+        iovs[i].iov_len = msgs[i].len;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+    while(1) {
+        int n = recvmmsg(obj->fd, hdrs, count, 0, NULL);
+        if(n > 0) {
+            /* If remote IP address is specified we'll silently drop all
+               packets coming from different addresses. The remaining ones
+               are moved to the beginning of the array. */
+            size_t nmsgs = 0;
+            for(i = 0; i != (size_t)n; ++i) {
+                if(obj->hasremote && !obj->connected &&
+                      !dill_ipaddr_equal(&raddrs[i], &obj->remote, 0))
+                    continue;
+                size_t sz = hdrs[i].msg_len;
+                if(nmsgs != i) {
+                    if(sz > msgs[nmsgs].len) sz = msgs[nmsgs].len;
+                    memcpy(msgs[nmsgs].buf, msgs[i].buf, sz);
+                }
+                msgs[nmsgs].nbytes = sz;
+                if(msgs[nmsgs].addr) *msgs[nmsgs].addr = raddrs[i];
+                ++nmsgs;
+            }
+            if(nmsgs) return nmsgs;
+            continue;
+        }
+        if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        obj->busy = 1;
+        int rc = dill_fdin(obj->fd, deadline);
+        obj->busy = 0;
+        if(dill_slow(rc < 0)) return -1;
+    }
+}
+
+#else
+
+int dill_udp_sendv(int s, struct dill_udp_msg *msgs, size_t count) {
+    struct dill_msock_vfs *m = dill_hquery(s, dill_msock_type);
+    if(dill_slow(!m)) return -1;
+    if(dill_slow(!msgs && count)) {errno = EINVAL; return -1;}
+    size_t i;
+    for(i = 0; i != count; ++i) {
+        struct dill_iolist iol = {msgs[i].buf, msgs[i].len, NULL, 0};
+        int rc = dill_udp_sendl_(m, msgs[i].addr, &iol, &iol);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    return 0;
+}
+
+/* Waits for the first datagram, then takes whatever else is available. */
+ssize_t dill_udp_recvv(int s, struct dill_udp_msg *msgs, size_t count,
+      int64_t deadline) {
+    struct dill_msock_vfs *m = dill_hquery(s, dill_msock_type);
+    if(dill_slow(!m)) return -1;
+    if(dill_slow(!msgs || !count)) {errno = EINVAL; return -1;}
+    size_t i;
+    for(i = 0; i != count; ++i) {
+        struct dill_iolist iol = {msgs[i].buf, msgs[i].len, NULL, 0};
+        ssize_t sz = dill_udp_recvl_(m, msgs[i].addr, &iol, &iol, NULL,
+            i ? 0 : deadline);
+        if(sz < 0) {
+            if(i && errno == ETIMEDOUT) break;
+            return -1;
+        }
+        msgs[i].nbytes = sz;
+    }
+    return i;
+}
+
+#endif
+
+/* Sends the segments one by one, in batches. */
+static int dill_udp_sendsegv(int s, const struct dill_ipaddr *addr,
+      const uint8_t *buf, size_t len, size_t segsize) {
+    struct dill_udp_msg msgs[DILL_UDP_BATCH];
+    while(len) {
+        size_t n;
+        for(n = 0; n != DILL_UDP_BATCH && len; ++n) {
+            size_t sz = len < segsize ? len : segsize;
+            msgs[n].addr = (struct dill_ipaddr*)addr;
+            msgs[n].buf = (void*)buf;
+            msgs[n].len = sz;
+            buf += sz;
+            len -= sz;
+        }
+        int rc = dill_udp_sendv(s, msgs, n);
+        if(dill_slow(rc < 0)) return -1;
+    }
+    return 0;
+}
+
+int dill_udp_sendseg(int s, const struct dill_ipaddr *addr,
+      const void *buf, size_t len, size_t segsize) {
+    struct dill_udp_sock *obj = dill_hquery(s, dill_udp_type);
+    if(dill_slow(!obj)) return -1;
+    if(dill_slow(obj->busy)) {errno = EBUSY; return -1;}
+    if(dill_slow(!segsize || (!buf && len))) {errno = EINVAL; return -1;}
+    const uint8_t *pos = buf;
+#if defined __linux__
+    /* Older kernels silently ignore unknown control messages and would send
+       the whole buffer as a single datagram. Make sure that UDP_SEGMENT is
+       supported before using it. */
+    if(dill_slow(!obj->gsoprobed)) {
+        int val;
+        socklen_t vallen = sizeof(val);
+        int rc = getsockopt(obj->fd, IPPROTO_UDP, UDP_SEGMENT, &val, &vallen);
+        obj->gso = rc == 0 ? 1 : 0;
+        obj->gsoprobed = 1;
+    }
+    size_t chunk = (DILL_UDP_GSOMAX / segsize) * segsize;
+    if(chunk > DILL_UDP_GSOSEGS * segsize) chunk = DILL_UDP_GSOSEGS * segsize;
+    if(obj->gso && chunk >= 2 * segsize) {
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        int rc = dill_udp_setdst(obj, addr, &hdr);
+        if(dill_slow(rc < 0)) return -1;
+        struct iovec iov;
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        char ctrl[CMSG_SPACE(sizeof(uint16_t))];
+        memset(ctrl, 0, sizeof(ctrl));
+        hdr.msg_control = ctrl;
+        hdr.msg_controllen = sizeof(ctrl);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t gsosize = segsize;
+        memcpy(CMSG_DATA(cmsg), &gsosize, sizeof(gsosize));
+        while(len > segsize) {
+            iov.iov_base = (void*)pos;
+            iov.iov_len = len < chunk ? len : chunk;
+            ssize_t sz = sendmsg(obj->fd, &hdr, 0);
+            if(dill_slow(sz < 0)) {
+                /* Same as with udp_send(), datagrams that don't fit into
+                   the socket's buffer are dropped. */
+                if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                /* The route may not support segmentation offload or
+                   the segment may exceed the MTU. Either way, individual
+                   datagrams can still be sent. */
+                if(errno == EIO || errno == EINVAL) break;
+                return -1;
+            }
+            pos += iov.iov_len;
+            len -= iov.iov_len;
+        }
+    }
+#endif
+    return dill_udp_sendsegv(s, addr, pos, len, segsize);
+}
+
+ssize_t dill_udp_recvseg(int s, struct dill_ipaddr *addr, void *buf,
+      size_t len, size_t *segsize, int64_t deadline) {
+    struct dill_msock_vfs *m = dill_hquery(s, dill_msock_type);
+    if(dill_slow(!m)) return -1;
+    if(dill_slow(!segsize)) {errno = EINVAL; return -1;}
+    struct dill_iolist iol = {buf, len, NULL, 0};
+    return dill_udp_recvl_(m, addr, &iol, &iol, segsize, deadline);
+}
+
+int dill_udp_gro(int s, int enable) {
+    struct dill_udp_sock *obj = dill_hquery(s, dill_udp_type);
+    if(dill_slow(!obj)) return -1;
+#if defined __linux__
+    int val = enable ? 1 : 0;
+    int rc = setsockopt(obj->fd, IPPROTO_UDP, UDP_GRO, &val, sizeof(val));
+    if(dill_slow(rc < 0)) {
+        if(errno == ENOPROTOOPT) errno = ENOTSUP;
+        return -1;
+    }
+    return 0;
+#else
+    if(!enable) return 0;
+    errno = ENOTSUP;
+    return -1;
+#endif
 }
 
 static int dill_udp_msendl(struct dill_msock_vfs *mvfs,
@@ -235,7 +561,7 @@ static int dill_udp_msendl(struct dill_msock_vfs *mvfs,
 
 static ssize_t dill_udp_mrecvl(struct dill_msock_vfs *mvfs,
       struct dill_iolist *first, struct dill_iolist *last, int64_t deadline) {
-    return dill_udp_recvl_(mvfs, NULL, first, last, deadline);
+    return dill_udp_recvl_(mvfs, NULL, first, last, NULL, deadline);
 }
 
 static void dill_udp_hclose(struct dill_hvfs *hvfs) {
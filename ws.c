@@ -349,25 +349,47 @@ static int dill_ws_sendl_base(struct dill_msock_vfs *mvfs, uint8_t type,
         memcpy(buf + sz, mask, 4);
         sz += 4;
     }
-    rc = dill_bsend(self->u, buf, sz, deadline);
-    if(dill_slow(rc < 0)) return -1;
-    /* On the server side we can send the payload as is. */
+    /* On the server side we can send the payload as is. Send it along with
+       the header so that they are written out using a single syscall. */
     if(self->server) {
-        rc = dill_bsendl(self->u, first, last, deadline);
+        struct dill_iolist hdr = {buf, sz, first, 0};
+        if(!first) last = &hdr;
+        rc = dill_bsendl(self->u, &hdr, last, deadline);
         if(dill_slow(rc < 0)) return -1;
         return 0;
     }
-    /* On the client side, the payload has to be masked. */
+    /* On the client side, the payload has to be masked. Do so in chunks.
+       The first chunk is sent together with the header. */
+    uint8_t chunk[512];
     size_t pos = 0;
-    while(first) {
-        size_t i;
-        for(i = 0; i != first->iol_len; ++i) {
-            uint8_t b = ((uint8_t*)first->iol_base)[i] ^
-                mask[pos++ % sizeof(mask)];
-            rc = dill_bsend(self->u, &b, 1, deadline); 
-            if(dill_slow(rc < 0)) return -1;
+    size_t off = 0;
+    int hdrsent = 0;
+    while(1) {
+        size_t n = 0;
+        while(first && n < sizeof(chunk)) {
+            size_t cnt = first->iol_len - off;
+            if(cnt > sizeof(chunk) - n) cnt = sizeof(chunk) - n;
+            uint8_t *src = (uint8_t*)first->iol_base + off;
+            size_t i;
+            for(i = 0; i != cnt; ++i)
+                chunk[n++] = src[i] ^ mask[pos++ % sizeof(mask)];
+            off += cnt;
+            if(off == first->iol_len) {first = first->iol_next; off = 0;}
         }
-        first = first->iol_next;
+        struct dill_iolist iol[2];
+        iol[0].iol_base = buf;
+        iol[0].iol_len = sz;
+        iol[0].iol_next = &iol[1];
+        iol[0].iol_rsvd = 0;
+        iol[1].iol_base = chunk;
+        iol[1].iol_len = n;
+        iol[1].iol_next = NULL;
+        iol[1].iol_rsvd = 0;
+        rc = dill_bsendl(self->u, hdrsent ? &iol[1] : &iol[0], &iol[1],
+            deadline);
+        if(dill_slow(rc < 0)) return -1;
+        hdrsent = 1;
+        if(!first) break;
     }
     return 0;
 }